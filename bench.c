@@ -0,0 +1,598 @@
+// Microbenchmarks of the headers
+// Usage: bench [--max entries] [--repeats count] [document.json ...]
+// -> --max (default 10000000) sets the largest hashtable, the tables grow tenfold from 1000
+// -> --repeats (default 5) sets how many times every measurement is taken, the minimum and median are reported
+// -> The json benchmarks run on a generated document and on every document given
+//
+// Every result is written to stdout as one json object per line, starting with the configuration of the build
+// {"bench": "hashtable_uint32_find_hit", "variant": "chained", "n": 1000, "ops": 1000000, "ns_per_op_min": 12.5, ...}
+// Json results also have "bytes" and "mb_per_s" from the minimum time
+// Build with the configuration macros of the headers, e.g; -DHASHTABLE_OPEN_ADDRESSING, to compare them
+//
+// The input is generated from a fixed seed, so runs of the same build do the same work
+
+#define MP_IMPLEMENTATION
+// Keep the leak report out of the results
+#define MP_MESSAGE(m) fprintf(stderr, "%s\n", m)
+#include "magpie.h"
+
+#define MEMPOOL_IMPLEMENTATION
+#include "mempool.h"
+
+#define HASHTABLE_IMPLEMENTATION
+#include "hashtable.h"
+
+#define LIBJSON_IMPLEMENTATION
+#define JSON_MEMPOOL
+#define JSON_THREADS
+#include "libjson.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_REPEATS 64
+
+// How many operations a measurement does at least, small inputs are run several rounds
+#define BENCH_MIN_OPS 1000000
+// How many bytes a json measurement parses or writes at least
+#define BENCH_MIN_BYTES (1 << 24)
+
+static int repeats = 5;
+static json_writer_t* out;
+// Results are added here so that the work is not optimized away
+static volatile size_t sink;
+
+static uint64_t bench_seed = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t bench_rand()
+{
+	bench_seed ^= bench_seed << 13;
+	bench_seed ^= bench_seed >> 7;
+	bench_seed ^= bench_seed << 17;
+	return (uint32_t)(bench_seed >> 16);
+}
+
+static double bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int bench_compare(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+// Writes one result line from the times of every repeat
+// bytes is the input or output size of a run for a throughput, or 0
+static void bench_report(const char* name, const char* variant, size_t n, size_t ops, size_t bytes, double* times)
+{
+	qsort(times, repeats, sizeof(double), bench_compare);
+	double min = times[0];
+	double median = times[repeats / 2];
+
+	JSON* result = json_create_object();
+	json_add_member(result, "bench", json_create_string(name));
+	json_add_member(result, "variant", json_create_string(variant));
+	json_add_member(result, "n", json_create_number(n));
+	json_add_member(result, "ops", json_create_number(ops));
+	json_add_member(result, "ns_per_op_min", json_create_number(min / ops * 1e9));
+	json_add_member(result, "ns_per_op_median", json_create_number(median / ops * 1e9));
+	if (bytes)
+	{
+		json_add_member(result, "bytes", json_create_number(bytes));
+		json_add_member(result, "mb_per_s", json_create_number(bytes / min / 1e6));
+	}
+	json_writer_write(out, result, JSON_COMPACT);
+	json_writer_raw(out, "\n", 1);
+	json_writer_flush(out);
+	json_destroy(result);
+}
+
+static void bench_config()
+{
+	JSON* config = json_create_object();
+	json_add_member(config, "bench", json_create_string("config"));
+#ifdef __VERSION__
+	json_add_member(config, "compiler", json_create_string(__VERSION__));
+#endif
+#ifdef HASHTABLE_OPEN_ADDRESSING
+	json_add_member(config, "hashtable", json_create_string("open_addressing"));
+#else
+	json_add_member(config, "hashtable", json_create_string("chained"));
+#endif
+#if defined(JSON_SIMD_AVX2)
+	json_add_member(config, "json_simd", json_create_string("avx2"));
+#elif defined(JSON_SIMD_SSE2)
+	json_add_member(config, "json_simd", json_create_string("sse2"));
+#elif defined(JSON_SIMD_NEON)
+	json_add_member(config, "json_simd", json_create_string("neon"));
+#else
+	json_add_member(config, "json_simd", json_create_string("none"));
+#endif
+	json_add_member(config, "repeats", json_create_number(repeats));
+	json_writer_write(out, config, JSON_COMPACT);
+	json_writer_raw(out, "\n", 1);
+	json_writer_flush(out);
+	json_destroy(config);
+}
+
+#ifdef HASHTABLE_OPEN_ADDRESSING
+#define BENCH_HASHTABLE "open_addressing"
+#else
+#define BENCH_HASHTABLE "chained"
+#endif
+
+// Inserts, finds and removes the first n keys, the next n keys are misses
+// Keys are visited in a scattered order so that large tables miss the cache like real lookups do
+static void bench_hashtable(const char* prefix, hashtable_t* (*create)(), const void* const* keys, size_t n)
+{
+	size_t rounds = n < BENCH_MIN_OPS ? BENCH_MIN_OPS / n : 1;
+	double insert[BENCH_MAX_REPEATS], hit[BENCH_MAX_REPEATS], miss[BENCH_MAX_REPEATS], mixed[BENCH_MAX_REPEATS],
+		remove[BENCH_MAX_REPEATS];
+	for (int r = 0; r < repeats; r++)
+	{
+		insert[r] = hit[r] = miss[r] = mixed[r] = remove[r] = 0;
+		for (size_t round = 0; round < rounds; round++)
+		{
+			hashtable_t* table = create();
+			size_t found = 0;
+			double start = bench_now();
+			for (size_t i = 0; i < n; i++)
+				hashtable_insert(table, keys[i], (void*)keys[i]);
+			double t = bench_now();
+			insert[r] += t - start;
+
+			start = t;
+			for (size_t i = 0; i < n; i++)
+				found += hashtable_find(table, keys[i * 7919 % n]) != NULL;
+			t = bench_now();
+			hit[r] += t - start;
+
+			start = t;
+			for (size_t i = 0; i < n; i++)
+				found += hashtable_find(table, keys[n + i * 7919 % n]) != NULL;
+			t = bench_now();
+			miss[r] += t - start;
+
+			// Every other lookup hits
+			start = t;
+			for (size_t i = 0; i < n; i++)
+				found += hashtable_find(table, keys[(i & 1) * n + i * 7919 % n]) != NULL;
+			t = bench_now();
+			mixed[r] += t - start;
+
+			start = t;
+			for (size_t i = 0; i < n; i++)
+				found += hashtable_remove(table, keys[i * 7919 % n]) != NULL;
+			remove[r] += bench_now() - start;
+
+			hashtable_destroy(table);
+			sink += found;
+		}
+	}
+
+	char name[64];
+	snprintf(name, sizeof name, "%s_insert", prefix);
+	bench_report(name, BENCH_HASHTABLE, n, n * rounds, 0, insert);
+	snprintf(name, sizeof name, "%s_find_hit", prefix);
+	bench_report(name, BENCH_HASHTABLE, n, n * rounds, 0, hit);
+	snprintf(name, sizeof name, "%s_find_miss", prefix);
+	bench_report(name, BENCH_HASHTABLE, n, n * rounds, 0, miss);
+	snprintf(name, sizeof name, "%s_find_half", prefix);
+	bench_report(name, BENCH_HASHTABLE, n, n * rounds, 0, mixed);
+	snprintf(name, sizeof name, "%s_remove", prefix);
+	bench_report(name, BENCH_HASHTABLE, n, n * rounds, 0, remove);
+}
+
+static hashtable_t* bench_create_uint32()
+{
+	return hashtable_create_uint32();
+}
+
+static hashtable_t* bench_create_string()
+{
+	return hashtable_create_string();
+}
+
+static void bench_hashtables(size_t max)
+{
+	// Twice the keys for the misses
+	uint32_t* numbers = malloc(2 * max * sizeof(uint32_t));
+	char(*strings)[16] = malloc(2 * max * sizeof(*strings));
+	const void** keys = malloc(2 * max * sizeof(void*));
+	// Multiplying by an odd constant is a bijection, so all keys are unique
+	for (size_t i = 0; i < 2 * max; i++)
+		numbers[i] = (uint32_t)(i * 2654435761u);
+	for (size_t i = 0; i < 2 * max; i++)
+		snprintf(strings[i], sizeof strings[i], "key%u", numbers[i]);
+
+	for (size_t n = 1000; n <= max; n *= 10)
+	{
+		for (size_t i = 0; i < 2 * n; i++)
+			keys[i] = &numbers[i];
+		// The misses are taken from the end, so they do not depend on n
+		for (size_t i = 0; i < n; i++)
+			keys[n + i] = &numbers[2 * max - 1 - i];
+		bench_hashtable("hashtable_uint32", bench_create_uint32, keys, n);
+
+		for (size_t i = 0; i < n; i++)
+		{
+			keys[i] = strings[i];
+			keys[n + i] = strings[2 * max - 1 - i];
+		}
+		bench_hashtable("hashtable_string", bench_create_string, keys, n);
+	}
+	free(numbers);
+	free(strings);
+	free(keys);
+}
+
+#define BENCH_POOL_ELEMENT 32
+#define BENCH_POOL_COUNT   100000
+
+// Allocation patterns of BENCH_POOL_COUNT elements, with malloc or a pool if pool is not NULL
+// 0: allocate all and free in reverse, 1: allocate all and free in order, 2: replace random live elements
+static double bench_pattern(mempool_t* pool, void** live, int pattern)
+{
+	const size_t n = BENCH_POOL_COUNT;
+	double start = bench_now();
+	for (size_t i = 0; i < n; i++)
+		live[i] = pool ? mempool_alloc(pool) : malloc(BENCH_POOL_ELEMENT);
+	if (pattern == 2)
+	{
+		// The scattered frees and reuse of a long running program
+		for (size_t i = 0; i < 4 * n; i++)
+		{
+			size_t j = bench_rand() % n;
+			if (pool)
+			{
+				mempool_free(pool, live[j]);
+				live[j] = mempool_alloc(pool);
+			}
+			else
+			{
+				free(live[j]);
+				live[j] = malloc(BENCH_POOL_ELEMENT);
+			}
+		}
+	}
+	for (size_t i = 0; i < n; i++)
+	{
+		void* p = live[pattern == 0 ? n - 1 - i : i];
+		if (pool)
+			mempool_free(pool, p);
+		else
+			free(p);
+	}
+	return bench_now() - start;
+}
+
+static void bench_mempool()
+{
+	static const char* patterns[] = {"mempool_lifo", "mempool_fifo", "mempool_random"};
+	static const size_t ops[] = {2 * BENCH_POOL_COUNT, 2 * BENCH_POOL_COUNT, 10 * BENCH_POOL_COUNT};
+	void** live = malloc(BENCH_POOL_COUNT * sizeof(void*));
+	double times[BENCH_MAX_REPEATS];
+	for (int pattern = 0; pattern < 3; pattern++)
+	{
+		for (int r = 0; r < repeats; r++)
+			times[r] = bench_pattern(NULL, live, pattern);
+		bench_report(patterns[pattern], "malloc", BENCH_POOL_COUNT, ops[pattern], 0, times);
+
+		mempool_t pool = MEMPOOL_INIT(BENCH_POOL_ELEMENT, 1024);
+		for (int r = 0; r < repeats; r++)
+			times[r] = bench_pattern(&pool, live, pattern);
+		mempool_destroy(&pool);
+		bench_report(patterns[pattern], "mempool", BENCH_POOL_COUNT, ops[pattern], 0, times);
+	}
+
+	// Bump allocation of the same elements, freed at once
+	for (int r = 0; r < repeats; r++)
+	{
+		mempool_arena_t arena = MEMPOOL_ARENA_INIT(64 * 1024);
+		double start = bench_now();
+		for (size_t i = 0; i < BENCH_POOL_COUNT; i++)
+			live[i] = mempool_arena_alloc(&arena, BENCH_POOL_ELEMENT, sizeof(void*));
+		mempool_arena_destroy(&arena);
+		times[r] = bench_now() - start;
+	}
+	bench_report("mempool_arena_alloc", "arena", BENCH_POOL_COUNT, BENCH_POOL_COUNT, 0, times);
+	free(live);
+}
+
+// Allocates and frees BENCH_POOL_COUNT blocks of 16 to 256 bytes with magpie or malloc
+static void bench_magpie()
+{
+	const size_t n = BENCH_POOL_COUNT;
+	void** live = malloc(n * sizeof(void*));
+	size_t* sizes = malloc(n * sizeof(size_t));
+	for (size_t i = 0; i < n; i++)
+		sizes[i] = 16 + bench_rand() % 241;
+
+	double plain[BENCH_MAX_REPEATS], tracked[BENCH_MAX_REPEATS], overhead[BENCH_MAX_REPEATS];
+	for (int r = 0; r < repeats; r++)
+	{
+		double start = bench_now();
+		for (size_t i = 0; i < n; i++)
+			live[i] = malloc(sizes[i]);
+		for (size_t i = 0; i < n; i++)
+			free(live[i]);
+		plain[r] = bench_now() - start;
+
+		start = bench_now();
+		for (size_t i = 0; i < n; i++)
+			live[i] = mp_malloc(sizes[i]);
+		for (size_t i = 0; i < n; i++)
+			mp_free(live[i]);
+		tracked[r] = bench_now() - start;
+		overhead[r] = tracked[r] - plain[r];
+	}
+	bench_report("magpie_malloc_free", "malloc", n, 2 * n, 0, plain);
+	bench_report("magpie_malloc_free", "magpie", n, 2 * n, 0, tracked);
+	bench_report("magpie_overhead", "magpie", n, 2 * n, 0, overhead);
+	mp_terminate();
+	free(live);
+	free(sizes);
+}
+
+// Writes a record like those of a paged api response
+static char* bench_record(char* p, uint32_t i)
+{
+	static const char* words[] = {"alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta"};
+	p += sprintf(p, "{\"id\": %u, \"name\": \"%s %s\", \"email\": \"user%u@example.com\", ", i, words[i % 8],
+				 words[(i / 8) % 8], i);
+	p += sprintf(p, "\"active\": %s, \"score\": %.6f, \"balance\": %d.%02u, \"parent\": null, ", i % 3 ? "true" : "false",
+				 bench_rand() / 4294967296.0, (int)(bench_rand() % 20000) - 10000, bench_rand() % 100);
+	p += sprintf(p, "\"bio\": \"Line one\\nLine \\\"two\\\" \\u00e9t\\u00e9 %u\", ", bench_rand());
+	p += sprintf(p, "\"tags\": [\"%s\", \"%s\", \"%s\"], ", words[bench_rand() % 8], words[bench_rand() % 8],
+				 words[bench_rand() % 8]);
+	p += sprintf(p, "\"location\": {\"lat\": %.5f, \"lon\": %.5f, \"city\": \"City %u\"}}", bench_rand() / 4e7 - 50,
+				 bench_rand() / 2e7 - 100, bench_rand() % 1000);
+	return p;
+}
+
+static size_t bench_discard(void* ctx, const char* buf, size_t size)
+{
+	(void)ctx;
+	sink += buf[0];
+	return size;
+}
+
+// Parse and serialize throughput on text, which is not modified
+// Small documents are run several rounds per measurement
+static void bench_json(const char* document, const char* text)
+{
+	size_t length = strlen(text);
+	size_t rounds = length < BENCH_MIN_BYTES ? BENCH_MIN_BYTES / (length + 1) : 1;
+	char* copy = malloc(length + 1);
+	double times[BENCH_MAX_REPEATS];
+
+	JSON* root = json_loadstring(strcpy(copy, text));
+	if (root == NULL)
+	{
+		fprintf(stderr, "Failed to parse %s\n", document);
+		free(copy);
+		return;
+	}
+
+	// Parsing modifies the copy, which is restored outside the timing
+	for (int r = 0; r < repeats; r++)
+	{
+		times[r] = 0;
+		for (size_t i = 0; i < rounds; i++)
+		{
+			memcpy(copy, text, length + 1);
+			double start = bench_now();
+			JSON* parsed = json_loadstring(copy);
+			times[r] += bench_now() - start;
+			json_destroy(parsed);
+		}
+	}
+	bench_report("json_parse", document, rounds, rounds, length * rounds, times);
+
+	for (int r = 0; r < repeats; r++)
+	{
+		times[r] = 0;
+		for (size_t i = 0; i < rounds; i++)
+		{
+			memcpy(copy, text, length + 1);
+			double start = bench_now();
+			JSON* parsed = json_loadstring_insitu(copy);
+			times[r] += bench_now() - start;
+			json_destroy(parsed);
+		}
+	}
+	bench_report("json_parse_insitu", document, rounds, rounds, length * rounds, times);
+
+	for (int r = 0; r < repeats; r++)
+	{
+		times[r] = 0;
+		for (size_t i = 0; i < rounds; i++)
+		{
+			memcpy(copy, text, length + 1);
+			double start = bench_now();
+			json_doc_t* doc = json_doc_loadstring_insitu(copy);
+			times[r] += bench_now() - start;
+			if (doc)
+				json_doc_destroy(doc);
+		}
+	}
+	bench_report("json_parse_doc", document, rounds, rounds, length * rounds, times);
+
+	// Only the structure is recorded, reading the count parses the root
+	for (int r = 0; r < repeats; r++)
+	{
+		times[r] = 0;
+		for (size_t i = 0; i < rounds; i++)
+		{
+			memcpy(copy, text, length + 1);
+			double start = bench_now();
+			JSON* parsed = json_loadstring_lazy(copy);
+			sink += json_get_count(parsed);
+			times[r] += bench_now() - start;
+			json_destroy(parsed);
+		}
+	}
+	bench_report("json_parse_lazy", document, rounds, rounds, length * rounds, times);
+
+	for (int r = 0; r < repeats; r++)
+	{
+		double start = bench_now();
+		for (size_t i = 0; i < rounds; i++)
+		{
+			json_reader_t* reader = json_reader_create(NULL, NULL);
+			json_reader_feed(reader, text, length);
+			json_reader_finish(reader);
+			int token;
+			while ((token = json_reader_next(reader)) > JSON_TOKEN_MORE)
+				sink += token;
+			json_reader_destroy(reader);
+		}
+		times[r] = bench_now() - start;
+	}
+	bench_report("json_reader", document, rounds, rounds, length * rounds, times);
+
+	// Throughput of serializing is measured in written bytes
+	size_t written[2] = {0, 0};
+	for (int format = 0; format < 2; format++)
+	{
+		for (int r = 0; r < repeats; r++)
+		{
+			double start = bench_now();
+			for (size_t i = 0; i < rounds; i++)
+			{
+				char* str = json_tostring(root, format);
+				written[format] = strlen(str);
+				free(str);
+			}
+			times[r] = bench_now() - start;
+		}
+		bench_report(format ? "json_tostring_format" : "json_tostring", document, rounds, rounds,
+					 written[format] * rounds, times);
+	}
+	for (int r = 0; r < repeats; r++)
+	{
+		double start = bench_now();
+		for (size_t i = 0; i < rounds; i++)
+		{
+			json_writer_t* writer = json_writer_create(bench_discard, NULL);
+			json_writer_write(writer, root, JSON_COMPACT);
+			json_writer_destroy(writer);
+		}
+		times[r] = bench_now() - start;
+	}
+	bench_report("json_writer", document, rounds, rounds, written[0] * rounds, times);
+	json_destroy(root);
+	free(copy);
+}
+
+static void bench_count_record(JSON* record, size_t offset, void* ctx)
+{
+	(void)offset;
+	(void)ctx;
+	sink += json_get_count(record);
+	json_destroy(record);
+}
+
+static void bench_jsons(int count, char** paths)
+{
+	// About 12 MB in records
+	const uint32_t records = 40000;
+	char* text = malloc((size_t)records * 512 + 16);
+	char* p = text;
+	p += sprintf(p, "{\"page\": 1, \"total\": %u, \"records\": [", records);
+	for (uint32_t i = 0; i < records; i++)
+	{
+		if (i)
+			p += sprintf(p, ", ");
+		p = bench_record(p, i);
+	}
+	sprintf(p, "]}");
+	bench_json("generated", text);
+
+	// The same records as json lines from a file
+	const char* lines_path = "bench_lines.json";
+	FILE* fp = fopen(lines_path, "w");
+	size_t length = 0;
+	for (uint32_t i = 0; fp && i < records; i++)
+	{
+		p = bench_record(text, i);
+		*p++ = '\n';
+		length += fwrite(text, 1, p - text, fp);
+	}
+	if (fp && fclose(fp) == 0)
+	{
+		int threads[] = {1, (int)sysconf(_SC_NPROCESSORS_ONLN)};
+		double times[BENCH_MAX_REPEATS];
+		// A single core only has the first
+		for (int t = 0; t < (threads[1] > 1 ? 2 : 1); t++)
+		{
+			for (int r = 0; r < repeats; r++)
+			{
+				double start = bench_now();
+				sink += json_load_lines(lines_path, threads[t], bench_count_record, NULL);
+				times[r] = bench_now() - start;
+			}
+			char variant[32];
+			snprintf(variant, sizeof variant, "threads_%d", threads[t]);
+			bench_report("json_load_lines", variant, records, records, length, times);
+		}
+		remove(lines_path);
+	}
+	free(text);
+
+	for (int i = 0; i < count; i++)
+	{
+		fp = fopen(paths[i], "rb");
+		if (fp == NULL)
+		{
+			fprintf(stderr, "Failed to open %s\n", paths[i]);
+			continue;
+		}
+		fseek(fp, 0, SEEK_END);
+		length = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		text = malloc(length + 1);
+		text[fread(text, 1, length, fp)] = '\0';
+		fclose(fp);
+		bench_json(paths[i], text);
+		free(text);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	size_t max = 10000000;
+	int first_path = argc;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--max") == 0 && i + 1 < argc)
+			max = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--repeats") == 0 && i + 1 < argc)
+			repeats = atoi(argv[++i]);
+		else
+		{
+			first_path = i;
+			break;
+		}
+	}
+	if (repeats < 1)
+		repeats = 1;
+	if (repeats > BENCH_MAX_REPEATS)
+		repeats = BENCH_MAX_REPEATS;
+
+	out = json_writer_create_file(stdout);
+	bench_config();
+	bench_hashtables(max);
+	bench_mempool();
+	bench_magpie();
+	bench_jsons(argc - first_path, argv + first_path);
+	json_writer_destroy(out);
+	return 0;
+}
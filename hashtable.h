@@ -11,12 +11,41 @@
 
 // CONFIGURATION
 // HASHTABLE_SIZE_TOLERANCE (70) sets the tolerance in percent that will cause the table to resize
-// -> If the table count is HASHTABLE_SIZE_TOLERANCE of the total size, it will resize, likewise down
-// -> If set to 0, the hashtable will not resize
+// -> If the table count is HASHTABLE_SIZE_TOLERANCE of the total size, it will grow
+// -> If set to 0, the hashtable will not resize, except open addressing tables which are rehashed when full
+// -> hashtable_reserve still makes room for the count it is given
 // -> Value is clamped to >= 50 if not 0
+// HASHTABLE_SHRINK_TOLERANCE (default (100 - HASHTABLE_SIZE_TOLERANCE) / 2, at most (HASHTABLE_SIZE_TOLERANCE - 1) / 2)
+// sets the load in percent below which hashtable_remove shrinks the table
+// -> Needs to be below half of HASHTABLE_SIZE_TOLERANCE so a shrunk table does not directly grow again
+// -> If set to 0, the hashtable will not shrink
+// -> The table never shrinks below HASHTABLE_DEFAULT_SIZE or the size given to hashtable_reserve
+// -> hashtable_pop never shrinks, draining a table does not resize it on the way
+// HASHTABLE_INCREMENTAL_RESIZE to spread resizing over the following operations instead of rehashing everything at once
+// -> A resize allocates the new array and every insert, remove, and pop migrates HASHTABLE_MIGRATE_STEP buckets to it
+// -> Lookups check both arrays until the migration is done, finding does not migrate
+// -> Bounds the worst case insert latency to the allocation of the new array
+// HASHTABLE_MIGRATE_STEP (default 16) sets how many buckets are migrated per operation when resizing incrementally
 // HASHTABLE_DEFAULT_SIZE (default 16) decides the default size of the hashtable
 // -> Table will resize up and down in powers of two automatically
 // -> Note, must be a power of 2
+// HASHTABLE_OPEN_ADDRESSING to store the items in a flat slot array with a parallel control byte array instead of chaining
+// -> Inserting does not allocate per item and a lookup touches the control bytes and usually a single slot
+// -> Collisions are resolved by linear probing, removing leaves a tombstone unless the following slot is empty
+// -> Tombstones count towards HASHTABLE_SIZE_TOLERANCE, a table with mostly tombstones is cleaned up without growing
+// -> The api is the same for both storage types
+// HASHTABLE_PREFETCH(addr) to define how the batch functions prefetch (default __builtin_prefetch on gcc and clang)
+// HASHTABLE_BATCH_GROUP (default 16) sets how many keys ahead the batch functions prefetch
+// HASHTABLE_CONCURRENT to enable hashtable_concurrent_t, a table that can be shared between threads
+// -> Requires pthreads
+// -> The keys are split over independently locked shards, each a hashtable_t behind a reader/writer lock
+// -> Finds on different shards, and finds on the same shard, run in parallel
+// HASHTABLE_MEMPOOL to allocate the chain items of every table from a mempool_t owned by the table
+// -> mempool.h needs to be included before the file defining HASHTABLE_IMPLEMENTATION includes hashtable.h
+// -> Items are allocated contiguously in blocks without a malloc header each, hashtable_destroy frees whole blocks
+// -> The bucket arrays vary in size and are still allocated with HASHTABLE_CALLOC
+// -> Has no effect with HASHTABLE_OPEN_ADDRESSING which has no per item allocations
+// HASHTABLE_MEMPOOL_BLOCK (default 64) sets how many items each pool block holds
 // HASHTABLE_MALLOC, HASHTABLE_CALLOC, and HASHTABLE_FREE to define your own allocators
 // hashtable_create to make a wrapper for hashtable_create_internal allowing for custom leak detection
 
@@ -45,12 +74,24 @@
 // To then create the hashtable with your custom functions, use hashtable_create(hashfunc, compfunc)
 // Usage is exactly like a hashtable storing strings or any other type
 
+// Typed tables
+// For hot paths, HASHTABLE_DEFINE generates a table for a fixed key and value type
+// The keys and values are stored inline and the hash and compare functions are inlined instead of called through pointers
+// See HASHTABLE_DEFINE below for usage
+
 // See end of file for license
 
 typedef struct hashtable_t Hashtable;
 typedef struct hashtable_t hashtable_t;
 
-typedef struct hashtable_iterator hashtable_iterator;
+// Iterator over all items of a table
+// Can be declared on the stack and started with hashtable_iterator_init, the fields are private
+typedef struct hashtable_iterator
+{
+	hashtable_t* table;
+	struct hashtable_item* item;
+	uint32_t index;
+} hashtable_iterator;
 
 // Creates a hashtable with the specified functionality
 // hashfunc should be the function that generates a hash from the key
@@ -80,11 +121,35 @@ void* hashtable_find(hashtable_t* hashtable, const void* key);
 // Removes and returns an item from a hashtable
 void* hashtable_remove(hashtable_t* hashtable, const void* key);
 
+// Length aware variants for tables created with hashtable_create_string
+// Hash len bytes of key with hashtable_hash_bytes instead of calling strlen and hashfunc
+// The key given to hashtable_insert_n is stored and needs to be terminated at len like any other string key
+// The key given to hashtable_find_n and hashtable_remove_n can be a slice that is not terminated, e.g; from a network buffer
+void* hashtable_insert_n(hashtable_t* hashtable, const char* key, size_t len, void* data);
+void* hashtable_find_n(hashtable_t* hashtable, const char* key, size_t len);
+void* hashtable_remove_n(hashtable_t* hashtable, const char* key, size_t len);
+
+// Finds n keys and writes the data of keys[i], or NULL, to out[i]
+// Keys are hashed and their buckets prefetched ahead of being resolved
+// This overlaps the cache misses of the lookups, which is faster than calling hashtable_find in a loop on large tables
+void hashtable_find_batch(hashtable_t* hashtable, const void* const* keys, uint32_t n, void** out);
+
+// Inserts n keys with data[i] associated with keys[i]
+// Grows the table once up front and prefetches like hashtable_find_batch
+// If out is not NULL, the replaced data of keys[i], or NULL, is written to out[i]
+void hashtable_insert_batch(hashtable_t* hashtable, const void* const* keys, void* const* data, uint32_t n,
+							void** out);
+
 // Removes and returns the first element in the hashtable
 // Returns NUL when table is empty
 // Can be used to clear free the stored data before hashtable_destroy
 void* hashtable_pop(hashtable_t* hashtable);
 
+// Makes room for count items without resizing
+// The table will also not shrink below that size
+// Resizes directly even with HASHTABLE_INCREMENTAL_RESIZE
+void hashtable_reserve(hashtable_t* hashtable, uint32_t count);
+
 // Returns how many items are in the hashtable
 uint32_t hashtable_get_count(hashtable_t* hashtable);
 
@@ -95,15 +160,63 @@ void hashtable_destroy(hashtable_t* hashtable);
 // Prints the hash table to a file descriptor, use for debug purposes
 void hashtable_print(hashtable_t* hashtable, FILE* fp);
 
-// Starts and returns an iterator
+// Starts an iterator in place, e.g; one declared on the stack
+// Nothing is allocated and there is nothing to end
+// hashtable_iterator it;
+// hashtable_iterator_init(&it, table);
+// while (hashtable_iterator_next_pair(&it, &key, &data))
+void hashtable_iterator_init(hashtable_iterator* it, hashtable_t* hashtable);
+// Starts and returns a heap allocated iterator, needs to be freed with hashtable_iterator_end
 // An empty table returns a valid iterator, but hashtable_iterator_next will return NULL directly
 hashtable_iterator* hashtable_iterator_begin(hashtable_t* hashtable);
 // Returns data at location and moves to the next
 // Bahaviour is undefines if hashtable resizes
 void* hashtable_iterator_next(hashtable_iterator* it);
-// Ends and frees an iterator
+// Writes the key and data at location to key and data if not NULL and moves to the next
+// Returns 0 when the iterator has reached the end
+// Unlike hashtable_iterator_next, items with NULL data do not look like the end
+int hashtable_iterator_next_pair(hashtable_iterator* it, const void** key, void** data);
+// Ends and frees an iterator from hashtable_iterator_begin
 void hashtable_iterator_end(hashtable_iterator* it);
 
+// Calls fn with the key and data of every item in a table
+// Stops and returns the value of fn if it returns nonzero, otherwise returns 0 after all items
+// Walks the buckets directly which is faster than an iterator
+// fn must not insert into or remove from the table
+int hashtable_foreach(hashtable_t* hashtable, int (*fn)(const void* key, void* data, void* ctx), void* ctx);
+
+#ifdef HASHTABLE_CONCURRENT
+typedef struct hashtable_concurrent hashtable_concurrent_t;
+
+// Creates a concurrent hashtable split into shard_count shards
+// shard_count is rounded up to a power of two and clamped to [1, 256], a few times the number of threads is a good start
+// The table stores key and data pointers exactly like hashtable_t
+// Keeping the data alive after it is found or removed is up to the caller, the table only locks its own state
+hashtable_concurrent_t* hashtable_concurrent_create(uint32_t (*hashfunc)(const void*),
+													int32_t (*compfunc)(const void*, const void*), uint32_t shard_count);
+
+#define hashtable_concurrent_create_string(shard_count)                                                                \
+	hashtable_concurrent_create(hashtable_hashfunc_string, hashtable_comp_string, shard_count)
+#define hashtable_concurrent_create_uint32(shard_count)                                                                \
+	hashtable_concurrent_create(hashtable_hashfunc_uint32, hashtable_comp_uint32, shard_count)
+
+// Same as the hashtable_t functions, but safe to call from several threads at once
+// The key is hashed before any lock is taken
+void* hashtable_concurrent_insert(hashtable_concurrent_t* table, const void* key, void* data);
+void* hashtable_concurrent_find(hashtable_concurrent_t* table, const void* key);
+void* hashtable_concurrent_remove(hashtable_concurrent_t* table, const void* key);
+void* hashtable_concurrent_pop(hashtable_concurrent_t* table);
+
+// Returns the sum of the shard counts
+// The shards are counted one at a time, so the result is not exact while other threads modify the table
+uint32_t hashtable_concurrent_get_count(hashtable_concurrent_t* table);
+
+// Destroys and frees a concurrent hashtable
+// No other thread can use the table during or after the call
+// Does not free the stored data
+void hashtable_concurrent_destroy(hashtable_concurrent_t* table);
+#endif
+
 // Predefined hash function
 uint32_t hashtable_hashfunc_uint32(const void* pkey);
 // Predefined compare function
@@ -114,12 +227,15 @@ uint32_t hashtable_hashfunc_string(const void* pkey);
 // Predefined compare function
 int32_t hashtable_comp_string(const void* pkey1, const void* pkey2);
 
-#ifdef HASHTABLE_IMPLEMENTATION
+#include <string.h>
+#include <stdlib.h>
 
+// The configuration is also used by typed tables and needs to be visible wherever HASHTABLE_DEFINE is expanded
 #ifndef HASHTABLE_DEFAULT_SIZE
 #define HASHTABLE_DEFAULT_SIZE 16
 #endif
-#if HASHTABLE != 0 && HASHTABLE_SIZE_TOLERANCE < 50
+#if defined(HASHTABLE_SIZE_TOLERANCE) && HASHTABLE_SIZE_TOLERANCE != 0 && HASHTABLE_SIZE_TOLERANCE < 50
+#undef HASHTABLE_SIZE_TOLERANCE
 #define HASHTABLE_SIZE_TOLERANCE 50
 #endif
 
@@ -127,6 +243,30 @@ int32_t hashtable_comp_string(const void* pkey1, const void* pkey2);
 #define HASHTABLE_SIZE_TOLERANCE 70
 #endif
 
+// A table that does not grow does not shrink either
+#ifndef HASHTABLE_SHRINK_TOLERANCE
+#if HASHTABLE_SIZE_TOLERANCE == 0
+#define HASHTABLE_SHRINK_TOLERANCE 0
+#else
+// Strictly below half of the size tolerance
+#define HASHTABLE_SHRINK_TOLERANCE \
+	((100 - HASHTABLE_SIZE_TOLERANCE) / 2 < (HASHTABLE_SIZE_TOLERANCE - 1) / 2 ? (100 - HASHTABLE_SIZE_TOLERANCE) / 2 \
+																				: (HASHTABLE_SIZE_TOLERANCE - 1) / 2)
+#endif
+#endif
+#if HASHTABLE_SHRINK_TOLERANCE * 2 >= HASHTABLE_SIZE_TOLERANCE && HASHTABLE_SHRINK_TOLERANCE != 0
+#error "HASHTABLE_SHRINK_TOLERANCE needs to be below half of HASHTABLE_SIZE_TOLERANCE"
+#endif
+
+// The load in percent at which open addressing rehashes
+// Slots can not all be used since a probe needs an empty slot to stop at, so a table that does not resize still has to
+// when it is full
+#if HASHTABLE_SIZE_TOLERANCE == 0
+#define HASHTABLE_REHASH_TOLERANCE 100
+#else
+#define HASHTABLE_REHASH_TOLERANCE HASHTABLE_SIZE_TOLERANCE
+#endif
+
 #ifndef HASHTABLE_MALLOC
 #define HASHTABLE_MALLOC(s) malloc(s)
 #endif
@@ -139,225 +279,1071 @@ int32_t hashtable_comp_string(const void* pkey1, const void* pkey2);
 #define HASHTABLE_FREE(p) free(p)
 #endif
 
+// Control byte values for open addressing and typed tables
+// An empty slot ends a probe sequence, a deleted slot (tombstone) does not
+#define HASHTABLE_CTRL_EMPTY   0x80
+#define HASHTABLE_CTRL_DELETED 0xFE
+// A full slot stores the top 7 bits of the hash
+// Most mismatching slots are rejected by the control byte without touching the slot or calling compfunc
+#define HASHTABLE_CTRL_TAG(hash) ((uint8_t)((hash) >> 25))
+
+// Built in key specializations, used by the predefined hash functions and typed tables
+static inline uint32_t hashtable_hash_uint32(uint32_t key)
+{
+	key = ((key >> 16) ^ key) * 0x45d9f3b;
+	key = ((key >> 16) ^ key) * 0x45d9f3b;
+	key = (key >> 16) ^ key;
+	return key;
+}
+
+static inline int hashtable_eq_uint32(uint32_t key1, uint32_t key2)
+{
+	return key1 == key2;
+}
+
+// Multiplies two 64 bit values into 128 bits and returns the low and high halves in a and b
+static inline void hashtable_mum(uint64_t* a, uint64_t* b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32);
+	uint64_t c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t hashtable_mix(uint64_t a, uint64_t b)
+{
+	hashtable_mum(&a, &b);
+	return a ^ b;
+}
+
+// Unaligned little endian reads, compiles to single loads on common targets
+static inline uint64_t hashtable_read64(const uint8_t* p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+static inline uint64_t hashtable_read32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+// Hashes len bytes, the key does not need to be terminated
+// Follows the construction of wyhash: reads 8 or 16 bytes per step and mixes with 64x64->128 bit multiplies
+// Short keys are read with a few overlapping loads and no loop
+static inline uint32_t hashtable_hash_bytes(const void* key, size_t len)
+{
+	const uint64_t s0 = 0x2d358dccaa6c78a5ull, s1 = 0x8bb84b93962eacc9ull, s2 = 0x4b33a62ed433d4a3ull,
+				   s3 = 0x4d5a2da51de1aa47ull;
+	const uint8_t* p = key;
+	uint64_t seed = hashtable_mix(s0 ^ s1, s1);
+	uint64_t a, b;
+	if (len <= 16)
+	{
+		if (len >= 4)
+		{
+			a = (hashtable_read32(p) << 32) | hashtable_read32(p + ((len >> 3) << 2));
+			b = (hashtable_read32(p + len - 4) << 32) | hashtable_read32(p + len - 4 - ((len >> 3) << 2));
+		}
+		else if (len > 0)
+		{
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		}
+		else
+		{
+			a = b = 0;
+		}
+	}
+	else
+	{
+		size_t i = len;
+		if (i > 48)
+		{
+			uint64_t see1 = seed, see2 = seed;
+			do
+			{
+				seed = hashtable_mix(hashtable_read64(p) ^ s1, hashtable_read64(p + 8) ^ seed);
+				see1 = hashtable_mix(hashtable_read64(p + 16) ^ s2, hashtable_read64(p + 24) ^ see1);
+				see2 = hashtable_mix(hashtable_read64(p + 32) ^ s3, hashtable_read64(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16)
+		{
+			seed = hashtable_mix(hashtable_read64(p) ^ s1, hashtable_read64(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = hashtable_read64(p + i - 16);
+		b = hashtable_read64(p + i - 8);
+	}
+	a ^= s1;
+	b ^= seed;
+	hashtable_mum(&a, &b);
+	uint64_t h = hashtable_mix(a ^ s0 ^ len, b ^ s1);
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+static inline uint32_t hashtable_hash_string(const char* key)
+{
+	return hashtable_hash_bytes(key, strlen(key));
+}
+
+static inline int hashtable_eq_string(const char* key1, const char* key2)
+{
+	return strcmp(key1, key2) == 0;
+}
+
+// Typed hashtables
+// HASHTABLE_DEFINE(name, KeyType, ValueType, hash, eq) generates the type name_t and static inline functions for it
+// -> Keys and values are stored by value in an open addressed slot array, no pointer to the key needs to be kept valid
+// -> hash(KeyType) returns a uint32_t and eq(KeyType, KeyType) returns non zero on match, both are inlined
+// -> Can be expanded in any file, does not require HASHTABLE_IMPLEMENTATION
+// A zero initialized name_t is an empty table and is allocated on the first insert
+//
+// name_t table = {0};
+// int name_insert(name_t* table, KeyType key, ValueType value, ValueType* old)
+// -> Returns 1 and writes the replaced value to old if not NULL if key already existed
+// ValueType* name_find(const name_t* table, KeyType key)
+// -> Returns a pointer to the stored value or NULL, valid until the table is modified
+// int name_remove(name_t* table, KeyType key, ValueType* value)
+// -> Returns 1 and writes the removed value to value if not NULL if key existed
+// uint32_t name_count(const name_t* table)
+// int name_next(const name_t* table, uint32_t* index, KeyType* key, ValueType* value)
+// -> Iterates from *index = 0 until it returns 0, key and value can be NULL
+// void name_destroy(name_t* table)
+// -> Frees the slots and leaves an empty table
+//
+// Example:
+// HASHTABLE_DEFINE(agemap, uint32_t, struct Person*, hashtable_hash_uint32, hashtable_eq_uint32)
+// agemap_t ages = {0};
+// agemap_insert(&ages, p->age, p, NULL);
+// struct Person** found = agemap_find(&ages, 2);
+// agemap_destroy(&ages);
+#define HASHTABLE_DEFINE(name, KeyType, ValueType, hash, eq)                                                           \
+	struct name##_slot                                                                                                 \
+	{                                                                                                                  \
+		KeyType key;                                                                                                   \
+		ValueType value;                                                                                               \
+	};                                                                                                                 \
+                                                                                                                       \
+	typedef struct name##_t                                                                                            \
+	{                                                                                                                  \
+		uint32_t size;                                                                                                 \
+		uint32_t count;                                                                                                \
+		uint32_t deleted;                                                                                              \
+		uint8_t* ctrl;                                                                                                 \
+		struct name##_slot* slots;                                                                                     \
+	} name##_t;                                                                                                        \
+                                                                                                                       \
+	static inline uint32_t name##_probe(const name##_t* table, KeyType key, uint32_t h)                                \
+	{                                                                                                                  \
+		uint32_t mask = table->size - 1;                                                                               \
+		uint8_t tag = HASHTABLE_CTRL_TAG(h);                                                                           \
+		for (uint32_t i = h & mask;; i = (i + 1) & mask)                                                               \
+		{                                                                                                              \
+			if (table->ctrl[i] == HASHTABLE_CTRL_EMPTY)                                                                \
+				return table->size;                                                                                    \
+			if (table->ctrl[i] == tag && eq(table->slots[i].key, key))                                                 \
+				return i;                                                                                              \
+		}                                                                                                              \
+	}                                                                                                                  \
+                                                                                                                       \
+	static inline void name##_place(name##_t* table, KeyType key, ValueType value, uint32_t h)                         \
+	{                                                                                                                  \
+		uint32_t mask = table->size - 1;                                                                               \
+		uint32_t i = h & mask;                                                                                         \
+		while (table->ctrl[i] != HASHTABLE_CTRL_EMPTY && table->ctrl[i] != HASHTABLE_CTRL_DELETED)                     \
+			i = (i + 1) & mask;                                                                                        \
+		if (table->ctrl[i] == HASHTABLE_CTRL_DELETED)                                                                  \
+			table->deleted--;                                                                                          \
+		table->ctrl[i] = HASHTABLE_CTRL_TAG(h);                                                                        \
+		table->slots[i].key = key;                                                                                     \
+		table->slots[i].value = value;                                                                                 \
+	}                                                                                                                  \
+                                                                                                                       \
+	static inline void name##_resize(name##_t* table, uint32_t new_size)                                               \
+	{                                                                                                                  \
+		uint32_t old_size = table->size;                                                                               \
+		uint8_t* old_ctrl = table->ctrl;                                                                               \
+		struct name##_slot* old_slots = table->slots;                                                                  \
+		table->size = new_size;                                                                                        \
+		table->deleted = 0;                                                                                            \
+		table->slots = HASHTABLE_MALLOC(new_size * (sizeof(struct name##_slot) + 1));                                  \
+		table->ctrl = (uint8_t*)(table->slots + new_size);                                                             \
+		memset(table->ctrl, HASHTABLE_CTRL_EMPTY, new_size);                                                           \
+		for (uint32_t i = 0; i < old_size; i++)                                                                        \
+		{                                                                                                              \
+			if (!(old_ctrl[i] & HASHTABLE_CTRL_EMPTY))                                                                 \
+				name##_place(table, old_slots[i].key, old_slots[i].value, hash(old_slots[i].key));                     \
+		}                                                                                                              \
+		if (old_slots)                                                                                                 \
+		{                                                                                                              \
+			HASHTABLE_FREE(old_slots);                                                                                 \
+		}                                                                                                              \
+	}                                                                                                                  \
+                                                                                                                       \
+	static inline int name##_insert(name##_t* table, KeyType key, ValueType value, ValueType* old)                     \
+	{                                                                                                                  \
+		if (table->size == 0)                                                                                          \
+			name##_resize(table, HASHTABLE_DEFAULT_SIZE);                                                              \
+		uint32_t h = hash(key);                                                                                        \
+		uint32_t i = name##_probe(table, key, h);                                                                      \
+		if (i != table->size)                                                                                          \
+		{                                                                                                              \
+			if (old)                                                                                                   \
+				*old = table->slots[i].value;                                                                          \
+			table->slots[i].key = key;                                                                                 \
+			table->slots[i].value = value;                                                                             \
+			return 1;                                                                                                  \
+		}                                                                                                              \
+		uint64_t load = (uint64_t)table->count + table->deleted + 1;                                                   \
+		if (load * 100 >= (uint64_t)table->size * HASHTABLE_REHASH_TOLERANCE || load >= table->size)                   \
+		{                                                                                                              \
+			if (((uint64_t)table->count + 1) * 200 < (uint64_t)table->size * HASHTABLE_REHASH_TOLERANCE)               \
+				name##_resize(table, table->size);                                                                     \
+			else                                                                                                       \
+				name##_resize(table, table->size << 1);                                                                \
+		}                                                                                                              \
+		name##_place(table, key, value, h);                                                                            \
+		table->count++;                                                                                                \
+		return 0;                                                                                                      \
+	}                                                                                                                  \
+                                                                                                                       \
+	static inline ValueType* name##_find(const name##_t* table, KeyType key)                                           \
+	{                                                                                                                  \
+		if (table->count == 0)                                                                                         \
+			return NULL;                                                                                               \
+		uint32_t i = name##_probe(table, key, hash(key));                                                              \
+		if (i == table->size)                                                                                          \
+			return NULL;                                                                                               \
+		return &table->slots[i].value;                                                                                 \
+	}                                                                                                                  \
+                                                                                                                       \
+	static inline int name##_remove(name##_t* table, KeyType key, ValueType* value)                                    \
+	{                                                                                                                  \
+		if (table->count == 0)                                                                                         \
+			return 0;                                                                                                  \
+		uint32_t i = name##_probe(table, key, hash(key));                                                              \
+		if (i == table->size)                                                                                          \
+			return 0;                                                                                                  \
+		if (value)                                                                                                     \
+			*value = table->slots[i].value;                                                                            \
+		if (table->ctrl[(i + 1) & (table->size - 1)] == HASHTABLE_CTRL_EMPTY)                                          \
+			table->ctrl[i] = HASHTABLE_CTRL_EMPTY;                                                                     \
+		else                                                                                                           \
+		{                                                                                                              \
+			table->ctrl[i] = HASHTABLE_CTRL_DELETED;                                                                   \
+			table->deleted++;                                                                                          \
+		}                                                                                                              \
+		table->count--;                                                                                                \
+		if (table->size > HASHTABLE_DEFAULT_SIZE &&                                                                    \
+			(uint64_t)table->count * 100 < (uint64_t)table->size * HASHTABLE_SHRINK_TOLERANCE)                         \
+			name##_resize(table, table->size >> 1);                                                                    \
+		return 1;                                                                                                      \
+	}                                                                                                                  \
+                                                                                                                       \
+	static inline uint32_t name##_count(const name##_t* table)                                                         \
+	{                                                                                                                  \
+		return table->count;                                                                                           \
+	}                                                                                                                  \
+                                                                                                                       \
+	static inline int name##_next(const name##_t* table, uint32_t* index, KeyType* key, ValueType* value)              \
+	{                                                                                                                  \
+		for (; *index < table->size; (*index)++)                                                                       \
+		{                                                                                                              \
+			if (table->ctrl[*index] & HASHTABLE_CTRL_EMPTY)                                                            \
+				continue;                                                                                              \
+			if (key)                                                                                                   \
+				*key = table->slots[*index].key;                                                                       \
+			if (value)                                                                                                 \
+				*value = table->slots[*index].value;                                                                   \
+			(*index)++;                                                                                                \
+			return 1;                                                                                                  \
+		}                                                                                                              \
+		return 0;                                                                                                      \
+	}                                                                                                                  \
+                                                                                                                       \
+	static inline void name##_destroy(name##_t* table)                                                                 \
+	{                                                                                                                  \
+		if (table->slots)                                                                                              \
+		{                                                                                                              \
+			HASHTABLE_FREE(table->slots);                                                                              \
+		}                                                                                                              \
+		table->size = 0;                                                                                               \
+		table->count = 0;                                                                                              \
+		table->deleted = 0;                                                                                            \
+		table->ctrl = NULL;                                                                                            \
+		table->slots = NULL;                                                                                           \
+	}
+
+// Predefined typed tables storing pointers, the typed counterparts of hashtable_create_uint32 and hashtable_create_string
+HASHTABLE_DEFINE(hashtable_uint32, uint32_t, void*, hashtable_hash_uint32, hashtable_eq_uint32)
+HASHTABLE_DEFINE(hashtable_string, const char*, void*, hashtable_hash_string, hashtable_eq_string)
+
+#ifdef HASHTABLE_IMPLEMENTATION
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+#ifndef HASHTABLE_MIGRATE_STEP
+#define HASHTABLE_MIGRATE_STEP 16
+#endif
+
+#ifndef HASHTABLE_PREFETCH
+#if defined(__GNUC__) || defined(__clang__)
+#define HASHTABLE_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define HASHTABLE_PREFETCH(addr) ((void)(addr))
+#endif
+#endif
+
+#ifndef HASHTABLE_BATCH_GROUP
+#define HASHTABLE_BATCH_GROUP 16
+#endif
+
+#ifdef HASHTABLE_MEMPOOL
+#ifndef MEMPOOL_H
+#error "HASHTABLE_MEMPOOL requires mempool.h to be included before the hashtable implementation"
+#endif
+#ifndef HASHTABLE_MEMPOOL_BLOCK
+#define HASHTABLE_MEMPOOL_BLOCK 64
+#endif
+#endif
+
+#ifdef HASHTABLE_OPEN_ADDRESSING
+// A slot in the flat slot array, no chaining
+struct hashtable_item
+{
+	const void* key;
+	void* data;
+	// The full hash of key
+	// Resizing does not need to call hashfunc and only slots with an equal hash are compared
+	uint32_t hash;
+};
+#else
 struct hashtable_item
 {
 	const void* key;
 	void* data;
+	// The full hash of key
+	// Resizing does not need to call hashfunc and only items with an equal hash are compared
+	uint32_t hash;
 	// For collision chaining
 	struct hashtable_item* next;
 };
+#endif
+
+// A bucket or slot array
+// While incrementally resizing the table has two of them
+struct hashtable_array
+{
+	// The amount of buckets in the list
+	uint32_t size;
+#ifdef HASHTABLE_OPEN_ADDRESSING
+	// How many slots are tombstones, they take up space in probe sequences and count towards the load
+	uint32_t deleted;
+	// One control byte per slot, parallel to items
+	// Stored in the same allocation directly after the slot array
+	uint8_t* ctrl;
+	struct hashtable_item* items;
+#else
+	struct hashtable_item** items;
+#endif
+};
 
 struct hashtable_t
 {
 	uint32_t (*hashfunc)(const void*);
 	int32_t (*compfunc)(const void*, const void*);
 
-	// The amount of buckets in the list
-	uint32_t size;
-
 	// How many items are in the table, including
 	uint32_t count;
-	struct hashtable_item** items;
+	// The table does not shrink below this size
+	// Raised by hashtable_reserve
+	uint32_t min_size;
+	// No bucket in the current array below this index holds an item
+	// Lets consecutive pops continue where the last one stopped
+	uint32_t pop_start;
+	struct hashtable_array cur;
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	// The array items are migrated from while resizing, size is 0 when no resize is in progress
+	struct hashtable_array old;
+	// All buckets in the old array below this index have been migrated
+	uint32_t migrate;
+#endif
+#if defined(HASHTABLE_MEMPOOL) && !defined(HASHTABLE_OPEN_ADDRESSING)
+	// Chain items, freed all at once by hashtable_destroy
+	mempool_t pool;
+#endif
 };
 
-struct hashtable_iterator
+// Passed as the length of keys that are compared with compfunc
+#define HASHTABLE_NO_LENGTH ((size_t)-1)
+
+// Compares a stored key to a searched key
+// A searched key with a length is a string slice that does not need to be terminated
+static inline int hashtable_key_match(hashtable_t* hashtable, const void* stored, const void* key, size_t len)
 {
-	hashtable_t* table;
-	struct hashtable_item* item;
-	uint32_t index;
-};
+	if (len == HASHTABLE_NO_LENGTH)
+		return hashtable->compfunc(stored, key) == 0;
+	return strncmp(stored, key, len) == 0 && ((const char*)stored)[len] == '\0';
+}
 
-hashtable_t* hashtable_create_internal(uint32_t (*hashfunc)(const void*), int32_t (*compfunc)(const void*, const void*))
+#ifdef HASHTABLE_OPEN_ADDRESSING
+// Allocates the slot and control arrays in one block
+// All slots start out empty
+static void hashtable_array_alloc(struct hashtable_array* array, uint32_t size)
 {
-	hashtable_t* hashtable = HASHTABLE_MALLOC(sizeof(hashtable_t));
-	hashtable->hashfunc = hashfunc;
-	hashtable->compfunc = compfunc;
-	hashtable->count = 0;
-	hashtable->size = HASHTABLE_DEFAULT_SIZE;
-	hashtable->items = HASHTABLE_CALLOC(HASHTABLE_DEFAULT_SIZE, sizeof(struct hashtable_item*));
-	return hashtable;
+	array->size = size;
+	array->deleted = 0;
+	array->items = HASHTABLE_MALLOC(size * (sizeof(struct hashtable_item) + 1));
+	array->ctrl = (uint8_t*)(array->items + size);
+	memset(array->ctrl, HASHTABLE_CTRL_EMPTY, size);
+}
+
+// Returns the slot holding key or NULL
+// The array always has at least one empty slot so the probe terminates
+static struct hashtable_item* hashtable_array_find(hashtable_t* hashtable, struct hashtable_array* array,
+												   const void* key, size_t len, uint32_t hash)
+{
+	uint32_t mask = array->size - 1;
+	uint8_t tag = HASHTABLE_CTRL_TAG(hash);
+	for (uint32_t i = hash & mask;; i = (i + 1) & mask)
+	{
+		uint8_t ctrl = array->ctrl[i];
+		if (ctrl == HASHTABLE_CTRL_EMPTY)
+			return NULL;
+		if (ctrl == tag && array->items[i].hash == hash && hashtable_key_match(hashtable, array->items[i].key, key, len))
+			return &array->items[i];
+	}
+}
+
+// Inserts a key that is known to not be in the array into the first free slot of its probe sequence
+// Returns the slot index
+static uint32_t hashtable_array_place(hashtable_t* hashtable, struct hashtable_array* array, const void* key, void* data,
+									  uint32_t hash)
+{
+	// Slots are stored inline, the table is only needed by chaining
+	(void)hashtable;
+	uint32_t mask = array->size - 1;
+	uint32_t i = hash & mask;
+	while (array->ctrl[i] != HASHTABLE_CTRL_EMPTY && array->ctrl[i] != HASHTABLE_CTRL_DELETED)
+		i = (i + 1) & mask;
+
+	if (array->ctrl[i] == HASHTABLE_CTRL_DELETED)
+		array->deleted--;
+	array->ctrl[i] = HASHTABLE_CTRL_TAG(hash);
+	array->items[i].key = key;
+	array->items[i].data = data;
+	array->items[i].hash = hash;
+	return i;
 }
 
-// Inserts an already allocated item struct into the hash table
-// Does not resize the hash table
-// Does no increase count
-static void* hashtable_insert_internal(hashtable_t* hashtable, struct hashtable_item* item)
-{
-	// Discard the next since collision chain will be reevaluated
-	item->next = NULL;
-	// Calculate the hash with the provided hash function to determine index
-	uint32_t index = hashtable->hashfunc(item->key);
-	// Make sure hash fits inside table
-	index = index & (hashtable->size - 1);
-	// Slot is empty, no collision
-	struct hashtable_item* cur = hashtable->items[index];
-	if (cur == NULL)
+// Marks a full slot as free
+// If the next slot is empty no probe sequence continues past this slot and it can be emptied instead of leaving a tombstone
+static void hashtable_array_erase(struct hashtable_array* array, uint32_t index)
+{
+	if (array->ctrl[(index + 1) & (array->size - 1)] == HASHTABLE_CTRL_EMPTY)
 	{
-		hashtable->items[index] = item;
+		array->ctrl[index] = HASHTABLE_CTRL_EMPTY;
 	}
-	// Insert at tail if collision
-	// Check for duplicate
 	else
 	{
-		struct hashtable_item* prev = NULL;
-		while (cur)
-		{
-			// Duplicate
-			if (hashtable->compfunc(cur->key, item->key) == 0)
-			{
-				// Handle beginning
-				if (prev == NULL)
-					hashtable->items[index] = item;
-				else
-					prev->next = item;
-
-				item->next = cur->next;
-
-				void* retdata = cur->data;
-				HASHTABLE_FREE(cur);
-				return retdata;
-			}
-			prev = cur;
-			cur = cur->next;
-		}
-		// Insert at tail
-		prev->next = item;
+		array->ctrl[index] = HASHTABLE_CTRL_DELETED;
+		array->deleted++;
 	}
-	return NULL;
 }
 
-// Resizes the list either up (1) or down (-1)
-// Internal function
-static void hashtable_resize(hashtable_t* hashtable, int32_t direction)
+// Removes key from the array
+// Returns 1 and writes the data if found
+static int hashtable_array_remove(hashtable_t* hashtable, struct hashtable_array* array, const void* key,
+								  size_t len, uint32_t hash, void** data)
 {
-	// Save the old values
-	uint32_t old_size = hashtable->size;
-	struct hashtable_item** old_items = hashtable->items;
+	struct hashtable_item* item = hashtable_array_find(hashtable, array, key, len, hash);
+	if (item == NULL)
+		return 0;
+	*data = item->data;
+	hashtable_array_erase(array, item - array->items);
+	return 1;
+}
 
-	if (direction == 1)
-		hashtable->size = hashtable->size << 1;
-	else if (direction == -1)
-		hashtable->size = hashtable->size >> 1;
-	else
+// Removes the first item in slot *index or later
+// Returns 1 and writes the data and the slot it was found in if not empty
+static int hashtable_array_pop(hashtable_t* hashtable, struct hashtable_array* array, uint32_t* index, void** data)
+{
+	(void)hashtable;
+	for (uint32_t i = *index; i < array->size; i++)
+	{
+		if (array->ctrl[i] & HASHTABLE_CTRL_EMPTY)
+			continue;
+
+		*data = array->items[i].data;
+		hashtable_array_erase(array, i);
+		*index = i;
+		return 1;
+	}
+	*index = array->size;
+	return 0;
+}
+
+// Moves the item in slot index of from to the current array
+static void hashtable_array_move(hashtable_t* hashtable, struct hashtable_array* from, uint32_t index)
+{
+	if (from->ctrl[index] & HASHTABLE_CTRL_EMPTY)
 		return;
+	// The keys are unique, no need to look for duplicates
+	struct hashtable_item* item = &from->items[index];
+	uint32_t i = hashtable_array_place(hashtable, &hashtable->cur, item->key, item->data, item->hash);
+	hashtable_array_erase(from, index);
+	if (i < hashtable->pop_start)
+		hashtable->pop_start = i;
+}
 
-	// Allocate the larger list
-	hashtable->items = HASHTABLE_CALLOC(hashtable->size, sizeof(struct hashtable_item*));
+// Returns the item in slot index, or NULL if free
+static struct hashtable_item* hashtable_array_bucket(struct hashtable_array* array, uint32_t index)
+{
+	if (array->ctrl[index] & HASHTABLE_CTRL_EMPTY)
+		return NULL;
+	return &array->items[index];
+}
 
-	for (uint32_t i = 0; i < old_size; i++)
-	{
-		struct hashtable_item* cur = old_items[i];
-		struct hashtable_item* next = NULL;
-		while (cur)
-		{
-			// Save the next since it will be changed with insert
-			next = cur->next;
+// Prefetches the control byte and slot at the start of the probe sequence for hash
+static void hashtable_array_prefetch(struct hashtable_array* array, uint32_t hash)
+{
+	uint32_t index = hash & (array->size - 1);
+	HASHTABLE_PREFETCH(&array->ctrl[index]);
+	HASHTABLE_PREFETCH(&array->items[index]);
+}
 
-			// Reinsert into the new list
-			// This won't resize the table again
-			hashtable_insert_internal(hashtable, cur);
+// Prefetches the stored key of the first slot if its tag matches, so the key compare does not miss
+// The slot should already be in cache from hashtable_array_prefetch
+static void hashtable_array_prefetch_next(struct hashtable_array* array, uint32_t hash)
+{
+	uint32_t index = hash & (array->size - 1);
+	if (array->ctrl[index] == HASHTABLE_CTRL_TAG(hash))
+		HASHTABLE_PREFETCH(array->items[index].key);
+}
 
-			cur = next;
-		}
+static int hashtable_array_foreach(struct hashtable_array* array, int (*fn)(const void*, void*, void*), void* ctx)
+{
+	for (uint32_t i = 0; i < array->size; i++)
+	{
+		if (array->ctrl[i] & HASHTABLE_CTRL_EMPTY)
+			continue;
+		int ret = fn(array->items[i].key, array->items[i].data, ctx);
+		if (ret)
+			return ret;
 	}
-	HASHTABLE_FREE(old_items);
+	return 0;
 }
-
-void* hashtable_insert(hashtable_t* hashtable, const void* key, void* data)
+#else
+// Chain items come from the pool of the table with HASHTABLE_MEMPOOL
+static struct hashtable_item* hashtable_item_alloc(hashtable_t* hashtable)
 {
-	// Check if table needs to be resized before calculating the hash as it will change
-	if (++hashtable->count * 100 >= hashtable->size * HASHTABLE_SIZE_TOLERANCE)
-		hashtable_resize(hashtable, 1);
+#ifdef HASHTABLE_MEMPOOL
+	return mempool_alloc(&hashtable->pool);
+#else
+	(void)hashtable;
+	return HASHTABLE_MALLOC(sizeof(struct hashtable_item));
+#endif
+}
 
-	struct hashtable_item* item = HASHTABLE_MALLOC(sizeof(struct hashtable_item));
-	item->key = key;
-	item->data = data;
-	item->next = NULL;
-	return hashtable_insert_internal(hashtable, item);
+static void hashtable_item_free(hashtable_t* hashtable, struct hashtable_item* item)
+{
+#ifdef HASHTABLE_MEMPOOL
+	mempool_free(&hashtable->pool, item);
+#else
+	(void)hashtable;
+	HASHTABLE_FREE(item);
+#endif
 }
 
-void* hashtable_find(hashtable_t* hashtable, const void* key)
+static void hashtable_array_alloc(struct hashtable_array* array, uint32_t size)
 {
-	uint32_t index = hashtable->hashfunc(key);
-	// Make sure hash fits inside table
-	index = index & (hashtable->size - 1);
-	struct hashtable_item* cur = hashtable->items[index];
+	array->size = size;
+	array->items = HASHTABLE_CALLOC(size, sizeof(struct hashtable_item*));
+}
 
+// Returns the item holding key or NULL
+static struct hashtable_item* hashtable_array_find(hashtable_t* hashtable, struct hashtable_array* array,
+												   const void* key, size_t len, uint32_t hash)
+{
+	struct hashtable_item* cur = array->items[hash & (array->size - 1)];
 	while (cur)
 	{
 		// Match
-		if (hashtable->compfunc(cur->key, key) == 0)
+		if (cur->hash == hash && hashtable_key_match(hashtable, cur->key, key, len))
 		{
-			return cur->data;
+			return cur;
 		}
 		cur = cur->next;
 	}
 	return NULL;
 }
 
-// Removes and returns an item from a hashtable
-void* hashtable_remove(hashtable_t* hashtable, const void* key)
+// Allocates and links an item for a key that is known to not be in the array
+// Returns the bucket index
+static uint32_t hashtable_array_place(hashtable_t* hashtable, struct hashtable_array* array, const void* key, void* data,
+									  uint32_t hash)
 {
-	uint32_t index = hashtable->hashfunc(key);
-	// Make sure hash fits inside table
-	index = index & (hashtable->size - 1);
+	uint32_t index = hash & (array->size - 1);
+	struct hashtable_item* item = hashtable_item_alloc(hashtable);
+	item->key = key;
+	item->data = data;
+	item->hash = hash;
+	// Order within a chain does not matter, insert at head
+	item->next = array->items[index];
+	array->items[index] = item;
+	return index;
+}
 
-	struct hashtable_item* cur = hashtable->items[index];
+// Removes key from the array
+// Returns 1 and writes the data if found
+static int hashtable_array_remove(hashtable_t* hashtable, struct hashtable_array* array, const void* key,
+								  size_t len, uint32_t hash, void** data)
+{
+	uint32_t index = hash & (array->size - 1);
+	struct hashtable_item* cur = array->items[index];
 	struct hashtable_item* prev = NULL;
 
 	while (cur)
 	{
 		// Match
-		if (hashtable->compfunc(cur->key, key) == 0)
+		if (cur->hash == hash && hashtable_key_match(hashtable, cur->key, key, len))
 		{
 			// Handle beginning
 			if (prev == NULL)
-				hashtable->items[index] = cur->next;
+				array->items[index] = cur->next;
 			else
 				prev->next = cur->next;
 
-			void* cur_data = cur->data;
-			HASHTABLE_FREE(cur);
-
-			// Check if table needs to be resized down after removing item
-			if (--hashtable->count * 100 < hashtable->size * (100 - HASHTABLE_SIZE_TOLERANCE))
-				hashtable_resize(hashtable, -1);
-
-			return cur_data;
+			*data = cur->data;
+			hashtable_item_free(hashtable, cur);
+			return 1;
 		}
 		prev = cur;
 		cur = cur->next;
 	}
-	return NULL;
+	return 0;
 }
 
-void* hashtable_pop(hashtable_t* hashtable)
+// Removes the first item in bucket *index or later
+// Returns 1 and writes the data and the bucket it was found in if not empty
+static int hashtable_array_pop(hashtable_t* hashtable, struct hashtable_array* array, uint32_t* index, void** data)
 {
-	for (uint32_t i = 0; i < hashtable->size; i++)
+	for (uint32_t i = *index; i < array->size; i++)
 	{
-		struct hashtable_item* cur = hashtable->items[i];
+		struct hashtable_item* cur = array->items[i];
 		if (cur != NULL)
 		{
-			hashtable->items[i] = cur->next;
-			void* cur_data = cur->data;
-			HASHTABLE_FREE(cur);
+			array->items[i] = cur->next;
+			*data = cur->data;
+			hashtable_item_free(hashtable, cur);
+			*index = i;
+			return 1;
+		}
+	}
+	*index = array->size;
+	return 0;
+}
+
+// Relinks the chain in bucket index of from into the current array
+static void hashtable_array_move(hashtable_t* hashtable, struct hashtable_array* from, uint32_t index)
+{
+	struct hashtable_item* cur = from->items[index];
+	struct hashtable_item* next = NULL;
+	from->items[index] = NULL;
+	while (cur)
+	{
+		// Save the next since it will be changed when relinking
+		next = cur->next;
+
+		uint32_t i = cur->hash & (hashtable->cur.size - 1);
+		cur->next = hashtable->cur.items[i];
+		hashtable->cur.items[i] = cur;
+		if (i < hashtable->pop_start)
+			hashtable->pop_start = i;
+
+		cur = next;
+	}
+}
+
+// Returns the head of the chain in bucket index
+static struct hashtable_item* hashtable_array_bucket(struct hashtable_array* array, uint32_t index)
+{
+	return array->items[index];
+}
 
-			// Check if table needs to be resized down after removing item
-			if (--hashtable->count * 100 <= hashtable->size * (100 - HASHTABLE_SIZE_TOLERANCE))
-				hashtable_resize(hashtable, -1);
+// Prefetches the bucket for hash
+static void hashtable_array_prefetch(struct hashtable_array* array, uint32_t hash)
+{
+	HASHTABLE_PREFETCH(&array->items[hash & (array->size - 1)]);
+}
 
-			return cur_data;
+// Prefetches the head of the chain, the bucket should already be in cache from hashtable_array_prefetch
+static void hashtable_array_prefetch_next(struct hashtable_array* array, uint32_t hash)
+{
+	struct hashtable_item* head = array->items[hash & (array->size - 1)];
+	if (head)
+		HASHTABLE_PREFETCH(head);
+}
+
+static int hashtable_array_foreach(struct hashtable_array* array, int (*fn)(const void*, void*, void*), void* ctx)
+{
+	for (uint32_t i = 0; i < array->size; i++)
+	{
+		for (struct hashtable_item* cur = array->items[i]; cur; cur = cur->next)
+		{
+			int ret = fn(cur->key, cur->data, ctx);
+			if (ret)
+				return ret;
 		}
 	}
+	return 0;
+}
+#endif
+
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+// Migrates up to count buckets from the old array
+// Frees the old array and ends the resize when all buckets are migrated
+static void hashtable_migrate(hashtable_t* hashtable, uint32_t count)
+{
+	if (hashtable->old.size == 0)
+		return;
+
+	for (; count && hashtable->migrate < hashtable->old.size; count--)
+		hashtable_array_move(hashtable, &hashtable->old, hashtable->migrate++);
+
+	if (hashtable->migrate == hashtable->old.size)
+	{
+		HASHTABLE_FREE(hashtable->old.items);
+		hashtable->old.items = NULL;
+		hashtable->old.size = 0;
+	}
+}
+#endif
+
+// Replaces the bucket array with one of new_size
+// Resizing to the same size cleans up tombstones in open addressing
+// With HASHTABLE_INCREMENTAL_RESIZE the items are migrated by the following operations
+// Internal function
+static void hashtable_resize(hashtable_t* hashtable, uint32_t new_size)
+{
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	// Only one resize can be in progress, finish the previous one
+	hashtable_migrate(hashtable, UINT32_MAX);
+	hashtable->old = hashtable->cur;
+	hashtable->migrate = 0;
+	hashtable_array_alloc(&hashtable->cur, new_size);
+	hashtable->pop_start = new_size;
+#else
+	// Save the old values
+	struct hashtable_array old = hashtable->cur;
+	hashtable_array_alloc(&hashtable->cur, new_size);
+	hashtable->pop_start = new_size;
+
+	for (uint32_t i = 0; i < old.size; i++)
+		hashtable_array_move(hashtable, &old, i);
+	HASHTABLE_FREE(old.items);
+#endif
+}
+
+// Check if table needs to be resized before inserting an item
+static void hashtable_check_grow(hashtable_t* hashtable)
+{
+	uint64_t size = hashtable->cur.size;
+	uint64_t count = hashtable->count;
+#ifdef HASHTABLE_OPEN_ADDRESSING
+	// Tombstones take up slots just like items do
+	// The table is never allowed to fill up entirely since a probe needs an empty slot to stop at
+	uint64_t load = count + hashtable->cur.deleted + 1;
+	if (load * 100 >= size * HASHTABLE_REHASH_TOLERANCE || load >= size)
+	{
+		// Mostly tombstones, clean up without growing
+		if ((count + 1) * 200 < size * HASHTABLE_REHASH_TOLERANCE)
+			hashtable_resize(hashtable, size);
+		else
+			hashtable_resize(hashtable, size << 1);
+	}
+#else
+	// A tolerance of 0 never grows
+	if (HASHTABLE_SIZE_TOLERANCE != 0 && (count + 1) * 100 >= size * HASHTABLE_SIZE_TOLERANCE)
+		hashtable_resize(hashtable, size << 1);
+#endif
+}
 
+// Check if table needs to be resized down after removing item
+static void hashtable_check_shrink(hashtable_t* hashtable)
+{
+	uint32_t size = hashtable->cur.size;
+	if (size > hashtable->min_size &&
+		(uint64_t)hashtable->count * 100 < (uint64_t)size * HASHTABLE_SHRINK_TOLERANCE)
+		hashtable_resize(hashtable, size >> 1);
+}
+
+// Searches both arrays while resizing
+static struct hashtable_item* hashtable_lookup(hashtable_t* hashtable, const void* key, size_t len, uint32_t hash)
+{
+	struct hashtable_item* item = hashtable_array_find(hashtable, &hashtable->cur, key, len, hash);
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	if (item == NULL && hashtable->old.size)
+		item = hashtable_array_find(hashtable, &hashtable->old, key, len, hash);
+#endif
+	return item;
+}
+
+// Returns the total number of buckets, which is both arrays while resizing
+static uint32_t hashtable_bucket_count(hashtable_t* hashtable)
+{
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	return hashtable->cur.size + hashtable->old.size;
+#else
+	return hashtable->cur.size;
+#endif
+}
+
+// Returns the first item in bucket index
+// Indices past the current array continue into the old array while resizing
+static struct hashtable_item* hashtable_bucket(hashtable_t* hashtable, uint32_t index)
+{
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	if (index >= hashtable->cur.size)
+		return hashtable_array_bucket(&hashtable->old, index - hashtable->cur.size);
+#endif
+	return hashtable_array_bucket(&hashtable->cur, index);
+}
+
+hashtable_t* hashtable_create_internal(uint32_t (*hashfunc)(const void*), int32_t (*compfunc)(const void*, const void*))
+{
+	hashtable_t* hashtable = HASHTABLE_MALLOC(sizeof(hashtable_t));
+	hashtable->hashfunc = hashfunc;
+	hashtable->compfunc = compfunc;
+	hashtable->count = 0;
+	hashtable->min_size = HASHTABLE_DEFAULT_SIZE;
+	hashtable->pop_start = 0;
+	hashtable_array_alloc(&hashtable->cur, HASHTABLE_DEFAULT_SIZE);
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	hashtable->old.size = 0;
+	hashtable->old.items = NULL;
+	hashtable->migrate = 0;
+#endif
+#if defined(HASHTABLE_MEMPOOL) && !defined(HASHTABLE_OPEN_ADDRESSING)
+	hashtable->pool = MEMPOOL_INIT(sizeof(struct hashtable_item), HASHTABLE_MEMPOOL_BLOCK);
+	// Keep a block for tables that repeatedly become empty
+	hashtable->pool.retain_blocks = 1;
+#endif
+	return hashtable;
+}
+
+// Inserts key with an already calculated hash
+static void* hashtable_insert_hashed(hashtable_t* hashtable, const void* key, size_t len, void* data, uint32_t hash)
+{
+	// Duplicate, replace
+	struct hashtable_item* item = hashtable_lookup(hashtable, key, len, hash);
+	if (item)
+	{
+		void* retdata = item->data;
+		item->key = key;
+		item->data = data;
+		return retdata;
+	}
+
+	// Check if table needs to be resized before inserting as the bucket will change
+	hashtable_check_grow(hashtable);
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	hashtable_migrate(hashtable, HASHTABLE_MIGRATE_STEP);
+#endif
+
+	uint32_t index = hashtable_array_place(hashtable, &hashtable->cur, key, data, hash);
+	if (index < hashtable->pop_start)
+		hashtable->pop_start = index;
+	hashtable->count++;
 	return NULL;
 }
 
+static void* hashtable_find_hashed(hashtable_t* hashtable, const void* key, size_t len, uint32_t hash)
+{
+	struct hashtable_item* item = hashtable_lookup(hashtable, key, len, hash);
+	if (item == NULL)
+		return NULL;
+	return item->data;
+}
+
+static void* hashtable_remove_hashed(hashtable_t* hashtable, const void* key, size_t len, uint32_t hash)
+{
+	void* data = NULL;
+	int found = hashtable_array_remove(hashtable, &hashtable->cur, key, len, hash, &data);
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	if (!found && hashtable->old.size)
+		found = hashtable_array_remove(hashtable, &hashtable->old, key, len, hash, &data);
+#endif
+	if (!found)
+		return NULL;
+
+	hashtable->count--;
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	hashtable_migrate(hashtable, HASHTABLE_MIGRATE_STEP);
+#endif
+	hashtable_check_shrink(hashtable);
+	return data;
+}
+
+void* hashtable_insert(hashtable_t* hashtable, const void* key, void* data)
+{
+	return hashtable_insert_hashed(hashtable, key, HASHTABLE_NO_LENGTH, data, hashtable->hashfunc(key));
+}
+
+void* hashtable_find(hashtable_t* hashtable, const void* key)
+{
+	return hashtable_find_hashed(hashtable, key, HASHTABLE_NO_LENGTH, hashtable->hashfunc(key));
+}
+
+// Removes and returns an item from a hashtable
+void* hashtable_remove(hashtable_t* hashtable, const void* key)
+{
+	return hashtable_remove_hashed(hashtable, key, HASHTABLE_NO_LENGTH, hashtable->hashfunc(key));
+}
+
+void* hashtable_insert_n(hashtable_t* hashtable, const char* key, size_t len, void* data)
+{
+	return hashtable_insert_hashed(hashtable, key, len, data, hashtable_hash_bytes(key, len));
+}
+
+void* hashtable_find_n(hashtable_t* hashtable, const char* key, size_t len)
+{
+	return hashtable_find_hashed(hashtable, key, len, hashtable_hash_bytes(key, len));
+}
+
+void* hashtable_remove_n(hashtable_t* hashtable, const char* key, size_t len)
+{
+	return hashtable_remove_hashed(hashtable, key, len, hashtable_hash_bytes(key, len));
+}
+
+// Does not shrink the table, draining a table with pop does not resize it on the way
+void* hashtable_pop(hashtable_t* hashtable)
+{
+	void* data = NULL;
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	// Take from the part of the old array that is not yet migrated first
+	// All buckets before the one popped from are empty, so the migration can skip ahead to it
+	if (hashtable->old.size && hashtable_array_pop(hashtable, &hashtable->old, &hashtable->migrate, &data))
+	{
+		hashtable->count--;
+		hashtable_migrate(hashtable, HASHTABLE_MIGRATE_STEP);
+		return data;
+	}
+	// Nothing left to migrate
+	hashtable_migrate(hashtable, UINT32_MAX);
+#endif
+	if (hashtable_array_pop(hashtable, &hashtable->cur, &hashtable->pop_start, &data))
+	{
+		hashtable->count--;
+		return data;
+	}
+
+	return NULL;
+}
+
+// Returns the smallest size that holds count items without exceeding the tolerance
+static uint32_t hashtable_size_for(uint32_t count)
+{
+	uint32_t size = HASHTABLE_DEFAULT_SIZE;
+	while (size < (UINT32_C(1) << 31) && (uint64_t)count * 100 >= (uint64_t)size * HASHTABLE_REHASH_TOLERANCE)
+		size <<= 1;
+	return size;
+}
+
+// The batch functions run a software pipeline over the keys, HASHTABLE_BATCH_GROUP keys apart per stage
+// Key i is hashed and its bucket prefetched, the bucket of key i - GROUP is read to prefetch what it points to,
+// and key i - 2 * GROUP is resolved, by which time its memory should be in cache
+#define HASHTABLE_BATCH_RING (HASHTABLE_BATCH_GROUP * 2 + 1)
+
+// Runs the first two pipeline stages for key i and returns the index of the key to resolve
+// Returns n if there is nothing to resolve yet
+static uint32_t hashtable_batch_step(hashtable_t* hashtable, const void* const* keys, uint32_t n, uint32_t i,
+									 uint32_t* hashes)
+{
+	if (i < n)
+	{
+		hashes[i % HASHTABLE_BATCH_RING] = hashtable->hashfunc(keys[i]);
+		hashtable_array_prefetch(&hashtable->cur, hashes[i % HASHTABLE_BATCH_RING]);
+	}
+	if (i >= HASHTABLE_BATCH_GROUP && i - HASHTABLE_BATCH_GROUP < n)
+		hashtable_array_prefetch_next(&hashtable->cur, hashes[(i - HASHTABLE_BATCH_GROUP) % HASHTABLE_BATCH_RING]);
+	if (i >= 2 * HASHTABLE_BATCH_GROUP)
+		return i - 2 * HASHTABLE_BATCH_GROUP;
+	return n;
+}
+
+void hashtable_find_batch(hashtable_t* hashtable, const void* const* keys, uint32_t n, void** out)
+{
+	uint32_t hashes[HASHTABLE_BATCH_RING];
+	for (uint32_t i = 0; i < n + 2 * HASHTABLE_BATCH_GROUP; i++)
+	{
+		uint32_t j = hashtable_batch_step(hashtable, keys, n, i, hashes);
+		if (j < n)
+			out[j] = hashtable_find_hashed(hashtable, keys[j], HASHTABLE_NO_LENGTH, hashes[j % HASHTABLE_BATCH_RING]);
+	}
+}
+
+void hashtable_insert_batch(hashtable_t* hashtable, const void* const* keys, void* const* data, uint32_t n,
+							void** out)
+{
+#if HASHTABLE_SIZE_TOLERANCE != 0 || defined(HASHTABLE_OPEN_ADDRESSING)
+	// Grow once for the whole batch instead of on the way, duplicates may make it larger than needed
+	uint32_t size = hashtable_size_for(hashtable->count + n);
+	if (size > hashtable->cur.size)
+		hashtable_resize(hashtable, size);
+#endif
+
+	uint32_t hashes[HASHTABLE_BATCH_RING];
+	for (uint32_t i = 0; i < n + 2 * HASHTABLE_BATCH_GROUP; i++)
+	{
+		uint32_t j = hashtable_batch_step(hashtable, keys, n, i, hashes);
+		if (j >= n)
+			continue;
+		void* replaced =
+			hashtable_insert_hashed(hashtable, keys[j], HASHTABLE_NO_LENGTH, data[j], hashes[j % HASHTABLE_BATCH_RING]);
+		if (out)
+			out[j] = replaced;
+	}
+}
+
+void hashtable_reserve(hashtable_t* hashtable, uint32_t count)
+{
+	uint32_t size = hashtable_size_for(count);
+
+	if (size > hashtable->min_size)
+		hashtable->min_size = size;
+
+	if (size > hashtable->cur.size)
+	{
+		hashtable_resize(hashtable, size);
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+		// Reserving is done ahead of time, don't leave the migration to later operations
+		hashtable_migrate(hashtable, UINT32_MAX);
+#endif
+	}
+}
+
 uint32_t hashtable_get_count(hashtable_t* hashtable)
 {
 	return hashtable->count;
@@ -365,9 +1351,14 @@ uint32_t hashtable_get_count(hashtable_t* hashtable)
 
 void hashtable_destroy(hashtable_t* hashtable)
 {
-	for (uint32_t i = 0; i < hashtable->size; i++)
+#if defined(HASHTABLE_MEMPOOL) && !defined(HASHTABLE_OPEN_ADDRESSING)
+	// Release the blocks instead of walking the chains
+	mempool_destroy(&hashtable->pool);
+#elif !defined(HASHTABLE_OPEN_ADDRESSING)
+	uint32_t buckets = hashtable_bucket_count(hashtable);
+	for (uint32_t i = 0; i < buckets; i++)
 	{
-		struct hashtable_item* cur = hashtable->items[i];
+		struct hashtable_item* cur = hashtable_bucket(hashtable, i);
 		struct hashtable_item* next = NULL;
 		while (cur)
 		{
@@ -376,75 +1367,102 @@ void hashtable_destroy(hashtable_t* hashtable)
 			cur = next;
 		}
 	}
-	HASHTABLE_FREE(hashtable->items);
+#endif
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	if (hashtable->old.items)
+	{
+		HASHTABLE_FREE(hashtable->old.items);
+	}
+#endif
+	HASHTABLE_FREE(hashtable->cur.items);
 	HASHTABLE_FREE(hashtable);
 }
 
 // Debug function
 void hashtable_print(hashtable_t* hashtable, FILE* fp)
 {
-	for (uint32_t i = 0; i < hashtable->size; i++)
+	uint32_t buckets = hashtable_bucket_count(hashtable);
+	for (uint32_t i = 0; i < buckets; i++)
 	{
-		struct hashtable_item* cur = hashtable->items[i];
+		struct hashtable_item* cur = hashtable_bucket(hashtable, i);
 		if (cur == NULL)
 			fprintf(fp, "[%.4u]: ---------", i);
 		else
 			fprintf(fp, "[%.4u]: ", i);
 
+#ifdef HASHTABLE_OPEN_ADDRESSING
+		if (cur)
+			fprintf(fp, "%p: \"%.10s\"; ", cur->key, (char*)cur->key);
+#else
 		while (cur)
 		{
 			fprintf(fp, "%p: \"%.10s\"; ", cur->key, (char*)cur->key);
 			cur = cur->next;
 		}
+#endif
 		fprintf(fp, "\n");
 	}
 }
 
+// Moves the iterator to the first item in bucket index or later
+static void hashtable_iterator_seek(hashtable_iterator* it, uint32_t index)
+{
+	uint32_t buckets = hashtable_bucket_count(it->table);
+	for (it->index = index; it->index < buckets; it->index++)
+	{
+		it->item = hashtable_bucket(it->table, it->index);
+		if (it->item != NULL)
+			return;
+	}
+	// At end
+	it->item = NULL;
+}
+
+void hashtable_iterator_init(hashtable_iterator* it, hashtable_t* hashtable)
+{
+	it->table = hashtable;
+	// Find first slot/bucket with data
+	hashtable_iterator_seek(it, 0);
+}
+
 // Starts and returns an iterator
 hashtable_iterator* hashtable_iterator_begin(hashtable_t* hashtable)
 {
 	hashtable_iterator* it = HASHTABLE_MALLOC(sizeof(hashtable_iterator));
-	it->table = hashtable;
-	it->item = NULL;
-	// Find first slot/bucket with data
-	for (it->index = 0; it->index < hashtable->size; it->index++)
-	{
-		if (hashtable->items[it->index] != NULL)
-		{
-			it->item = hashtable->items[it->index];
-			break;
-		}
-	}
+	hashtable_iterator_init(it, hashtable);
 	return it;
 }
-// Returns data at location and moves to the next
-void* hashtable_iterator_next(hashtable_iterator* it)
+
+int hashtable_iterator_next_pair(hashtable_iterator* it, const void** key, void** data)
 {
 	// Iterator has reached end
 	if (it->item == NULL)
-		return NULL;
+		return 0;
 
-	struct hashtable_item* prev_data = it->item->data;
+	if (key)
+		*key = it->item->key;
+	if (data)
+		*data = it->item->data;
+#ifndef HASHTABLE_OPEN_ADDRESSING
 	// Move to next in chain
 	if (it->item->next)
 	{
 		it->item = it->item->next;
-		return prev_data;
+		return 1;
 	}
+#endif
 
 	// Look for next slot/bucket
-	hashtable_t* table = it->table;
-	for (++it->index; it->index < table->size; it->index++)
-	{
-		if (table->items[it->index] != NULL)
-		{
-			it->item = table->items[it->index];
-			return prev_data;
-		}
-	}
-	// At end
-	it->item = NULL;
-	return prev_data;
+	hashtable_iterator_seek(it, it->index + 1);
+	return 1;
+}
+
+// Returns data at location and moves to the next
+void* hashtable_iterator_next(hashtable_iterator* it)
+{
+	void* data = NULL;
+	hashtable_iterator_next_pair(it, NULL, &data);
+	return data;
 }
 // Ends and frees an iterator
 void hashtable_iterator_end(hashtable_iterator* iterator)
@@ -452,14 +1470,146 @@ void hashtable_iterator_end(hashtable_iterator* iterator)
 	HASHTABLE_FREE(iterator);
 }
 
+int hashtable_foreach(hashtable_t* hashtable, int (*fn)(const void* key, void* data, void* ctx), void* ctx)
+{
+	int ret = hashtable_array_foreach(&hashtable->cur, fn, ctx);
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	if (ret == 0 && hashtable->old.size)
+		ret = hashtable_array_foreach(&hashtable->old, fn, ctx);
+#endif
+	return ret;
+}
+
+#ifdef HASHTABLE_CONCURRENT
+#include <pthread.h>
+
+#define HASHTABLE_MAX_SHARD_BITS 8
+
+struct hashtable_shard
+{
+	pthread_rwlock_t lock;
+	hashtable_t* table;
+};
+
+// Every shard spans two cache lines so no two locks share a line regardless of the alignment of the array
+union hashtable_shard_padded
+{
+	struct hashtable_shard shard;
+	char pad[128];
+};
+
+struct hashtable_concurrent
+{
+	uint32_t (*hashfunc)(const void*);
+	uint32_t shard_bits;
+	union hashtable_shard_padded* shards;
+};
+
+// Selects the shard from the high bits of the remultiplied hash
+// Taking bits of the hash directly would make them the same for all keys of a shard,
+// which either narrows the control tags or leaves buckets unused once a shard grows large enough
+static struct hashtable_shard* hashtable_concurrent_shard(hashtable_concurrent_t* table, uint32_t hash)
+{
+	uint64_t mixed = (uint32_t)(hash * UINT32_C(0x9E3779B1));
+	return &table->shards[mixed >> (32 - table->shard_bits)].shard;
+}
+
+hashtable_concurrent_t* hashtable_concurrent_create(uint32_t (*hashfunc)(const void*),
+													int32_t (*compfunc)(const void*, const void*), uint32_t shard_count)
+{
+	hashtable_concurrent_t* table = HASHTABLE_MALLOC(sizeof(hashtable_concurrent_t));
+	table->hashfunc = hashfunc;
+	table->shard_bits = 0;
+	while (table->shard_bits < HASHTABLE_MAX_SHARD_BITS && (UINT32_C(1) << table->shard_bits) < shard_count)
+		table->shard_bits++;
+
+	uint32_t count = UINT32_C(1) << table->shard_bits;
+	table->shards = HASHTABLE_MALLOC(count * sizeof(union hashtable_shard_padded));
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pthread_rwlock_init(&table->shards[i].shard.lock, NULL);
+		table->shards[i].shard.table = hashtable_create_internal(hashfunc, compfunc);
+	}
+	return table;
+}
+
+void* hashtable_concurrent_insert(hashtable_concurrent_t* table, const void* key, void* data)
+{
+	uint32_t hash = table->hashfunc(key);
+	struct hashtable_shard* shard = hashtable_concurrent_shard(table, hash);
+	pthread_rwlock_wrlock(&shard->lock);
+	void* retdata = hashtable_insert_hashed(shard->table, key, HASHTABLE_NO_LENGTH, data, hash);
+	pthread_rwlock_unlock(&shard->lock);
+	return retdata;
+}
+
+void* hashtable_concurrent_find(hashtable_concurrent_t* table, const void* key)
+{
+	// Finding never modifies the shard, even while it is resizing incrementally
+	uint32_t hash = table->hashfunc(key);
+	struct hashtable_shard* shard = hashtable_concurrent_shard(table, hash);
+	pthread_rwlock_rdlock(&shard->lock);
+	void* data = hashtable_find_hashed(shard->table, key, HASHTABLE_NO_LENGTH, hash);
+	pthread_rwlock_unlock(&shard->lock);
+	return data;
+}
+
+void* hashtable_concurrent_remove(hashtable_concurrent_t* table, const void* key)
+{
+	uint32_t hash = table->hashfunc(key);
+	struct hashtable_shard* shard = hashtable_concurrent_shard(table, hash);
+	pthread_rwlock_wrlock(&shard->lock);
+	void* data = hashtable_remove_hashed(shard->table, key, HASHTABLE_NO_LENGTH, hash);
+	pthread_rwlock_unlock(&shard->lock);
+	return data;
+}
+
+void* hashtable_concurrent_pop(hashtable_concurrent_t* table)
+{
+	uint32_t count = UINT32_C(1) << table->shard_bits;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		struct hashtable_shard* shard = &table->shards[i].shard;
+		pthread_rwlock_wrlock(&shard->lock);
+		void* data = hashtable_pop(shard->table);
+		pthread_rwlock_unlock(&shard->lock);
+		if (data)
+			return data;
+	}
+	return NULL;
+}
+
+uint32_t hashtable_concurrent_get_count(hashtable_concurrent_t* table)
+{
+	uint32_t count = UINT32_C(1) << table->shard_bits;
+	uint32_t total = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		struct hashtable_shard* shard = &table->shards[i].shard;
+		pthread_rwlock_rdlock(&shard->lock);
+		total += shard->table->count;
+		pthread_rwlock_unlock(&shard->lock);
+	}
+	return total;
+}
+
+void hashtable_concurrent_destroy(hashtable_concurrent_t* table)
+{
+	uint32_t count = UINT32_C(1) << table->shard_bits;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		hashtable_destroy(table->shards[i].shard.table);
+		pthread_rwlock_destroy(&table->shards[i].shard.lock);
+	}
+	HASHTABLE_FREE(table->shards);
+	HASHTABLE_FREE(table);
+}
+#endif
+
 // Common Hash functions
 uint32_t hashtable_hashfunc_uint32(const void* pkey)
 {
-	uint32_t key = *(uint32_t*)pkey;
-	key = ((key >> 16) ^ key) * 0x45d9f3b;
-	key = ((key >> 16) ^ key) * 0x45d9f3b;
-	key = (key >> 16) ^ key;
-	return key;
+	return hashtable_hash_uint32(*(uint32_t*)pkey);
 }
 
 int32_t hashtable_comp_uint32(const void* pkey1, const void* pkey2)
@@ -469,16 +1619,7 @@ int32_t hashtable_comp_uint32(const void* pkey1, const void* pkey2)
 
 uint32_t hashtable_hashfunc_string(const void* pkey)
 {
-	char* key = (char*)pkey;
-	uint64_t value = 0;
-	uint32_t i = 0;
-	uint32_t lkey = strlen(key);
-
-	for (; i < lkey; i++)
-	{
-		value = value * 37 + key[i];
-	}
-	return value;
+	return hashtable_hash_string(pkey);
 }
 
 int32_t hashtable_comp_string(const void* pkey1, const void* pkey2)
@@ -19,6 +19,16 @@
 //
 // JSON_MALLOC, JSON_REALLOC, and JSON_FREE to use your own allocators instead of the standard library
 // JSON_MESSAGE (default fputs(m, stderr)) to set your own message callback.
+// JSON_MEMPOOL to build json_doc_t documents on the arena of mempool.h, which needs to be included before
+// JSON_DOC_BLOCK (default 4096) sets the size of the arena blocks of a document
+// JSON_INDEX_MIN (default 16) sets how many members or elements an object or array needs before lookups build an index
+// JSON_WRITER_BUFFER (default 4096) sets the buffer size of a json_writer_t, it is flushed when full
+// JSON_READER_BUFFER (default 4096) sets the initial buffer size of a json_reader_t, it grows for longer tokens
+// JSON_NO_MMAP to read files with fread instead of mapping them with mmap on unix
+// JSON_THREADS to parse json_load_lines on several threads, requires pthreads
+// JSON_LINES_CHUNK (default 1 MiB) sets how many bytes of lines a thread of json_load_lines claims at a time
+// JSON_NO_SIMD to scan whitespace and strings one character at a time instead of with AVX2, SSE2 or NEON
+// -> The vector scanning is only built with gcc or clang for the instruction sets enabled for the build
 //
 // ## Types
 // The library represents all json types with the JSON structure
@@ -47,6 +57,10 @@
 //
 // To retrieve a member of a certain name, use json_get_member(object), this iterates the linked list until a match is
 // found, and returns NULL if no match is found at end
+// Objects of at least JSON_INDEX_MIN members build a hash index of the names on the first lookup instead, which is kept
+// up to date by json_add_member and json_pop_member. Adding members checks for duplicates with the same lookup
+// Arrays of at least JSON_INDEX_MIN elements likewise build a vector of the elements for json_get_element and the
+// indexed insert and pop functions
 //
 // If you want to loop through the members or elements of a object or array, use json_get_members, or json_get_elements
 // respectively
@@ -82,6 +96,100 @@
 //
 // ### Null
 // Null is a valid json type and has no other use than indicate the absence of a value
+//
+// ## In-situ parsing
+// json_loadfile_insitu, json_loadstring_insitu and json_load_insitu parse without allocating any strings
+// The names and string values point directly into the source buffer, escape sequences are decoded in place since the
+// decoded string is never longer than the source, and the end quotes are overwritten by null terminators
+// This means the source buffer is modified and needs to outlive the parsed json
+// json_loadfile_insitu keeps the file contents in the same allocation as the returned root object, so they are freed
+// together by json_destroy
+// json_loadstring_insitu and json_load_insitu borrow the given string, which needs to be kept alive by the caller
+// Objects popped from an in-situ document keep borrowing the buffer, setting a name or string value replaces the
+// borrowed pointer with an owned copy as usual
+//
+// ## Json lines
+// json_load_lines loads files of newline delimited json, where every line holds a record
+// The file is split into chunks of JSON_LINES_CHUNK bytes, the lines starting in a chunk are parsed by the thread
+// claiming it and every record is passed to the callback with the offset of its line, blank lines are skipped
+// Invalid lines are reported with JSON_MESSAGE and skipped
+// On unix json_loadfile and json_load_lines map the file instead of reading it into a copy
+//
+// ## Lazy parsing
+// json_loadfile_lazy and json_loadstring_lazy only record the structure of the input on a tape, one entry per key and
+// value with the size of the subtree of each object and array. No objects are built and no strings or numbers decoded
+// The members or elements of an object or array are created when they are first accessed, such as by json_get_member,
+// json_get_elements or json_get_count, and strings and numbers are decoded in-situ when first read, so subtrees that are
+// never visited cost only their tape entries and are skipped along with them
+// The structure is checked when loading, invalid strings and numbers are only reported when decoded
+// The source is borrowed like for in-situ parsing, and the tape is owned by the root and freed with it, so objects
+// popped from a lazy root are invalid after it is destroyed
+// Reading a lazy object changes it, so it can not be read from several threads at once
+//
+// Example:
+// ```
+// JSON* root = json_loadfile_lazy("response.json");
+// printf("%s\n", json_get_member_string(json_get_member(root, "user"), "name"));
+// json_destroy(root);
+// ```
+//
+// ## Documents
+// A json_doc_t allocates the source, all objects and all strings from an arena, which requires JSON_MEMPOOL
+// json_doc_loadfile and json_doc_loadstring copy the source into the arena and parse it in-situ
+// json_doc_loadstring_insitu parses the given string in-situ instead, which has to outlive the document
+// json_doc_destroy frees the arena at once instead of walking the tree
+// Objects of a document are changed with the usual functions, names and strings set on them are copied into the arena
+// Objects created with json_doc_create_empty are also allocated from the arena
+// Objects from json_create_* can be added to a document and are destroyed with it, at the cost of walking the tree
+// All objects of a document, and objects popped from it, are invalid after json_doc_destroy
+// json_destroy can be called on the objects of a document, it only frees the parts that are not in the arena
+//
+// Example:
+// ```
+// json_doc_t* doc = json_doc_loadfile("example.json");
+// JSON* root = json_doc_root(doc);
+// json_set_string(json_get_member(root, "name"), "Jacob");
+// json_doc_destroy(doc);
+// ```
+//
+// ## Streaming
+// A json_reader_t reads json incrementally and returns one token at a time from json_reader_next, without building a
+// tree. The memory used is bounded by the nesting depth and the longest token, not by the size of the input
+// Input comes from a FILE* with json_reader_create_file, a file descriptor with json_reader_create_fd, your own read
+// function with json_reader_create, or chunks passed to json_reader_feed when created with a NULL read function
+// When fed, JSON_TOKEN_MORE is returned when the input ends within a token, feed more and call json_reader_next again
+// After the last chunk, json_reader_finish tells the reader that the input has ended
+// Several values may follow each other at the top level, such as one record per line
+// Keys and strings from json_reader_string are decoded and valid until the next call of json_reader_next
+// json_reader_load builds the next value, or member with its name, as a tree, which reads large arrays one element at a
+// time
+//
+// Example:
+// ```
+// json_reader_t* reader = json_reader_create_file(stdin);
+// int token;
+// while ((token = json_reader_next(reader)) > JSON_TOKEN_MORE)
+// {
+//   if (token == JSON_TOKEN_KEY)
+//     printf("%s\n", json_reader_string(reader, NULL));
+// }
+// json_reader_destroy(reader);
+// ```
+
+// ## Writing
+// A json_writer_t writes json through a buffer of JSON_WRITER_BUFFER bytes that is flushed when full, so the output is
+// never held in memory at once. Strings are escaped straight into the buffer
+// Output goes to a FILE* with json_writer_create_file, a file descriptor with json_writer_create_fd or your own write
+// function with json_writer_create. json_writefile writes through a writer and json_tostring uses the same code with a
+// buffer that grows to hold the string
+//
+// Example:
+// ```
+// json_writer_t* writer = json_writer_create_file(stdout);
+// json_writer_write(writer, root, JSON_FORMAT);
+// json_writer_raw(writer, "\n", 1);
+// json_writer_destroy(writer);
+// ```
 
 // LICENSE
 // See the end of the file for license
@@ -90,6 +198,7 @@
 #ifndef LIBJSON_H
 #define LIBJSON_H
 #include <stddef.h>
+#include <stdio.h>
 
 typedef struct JSON JSON;
 
@@ -182,6 +291,10 @@ JSON* json_get_member(JSON* object, const char* name);
 // Returns a linked list of the elements of a json array
 JSON* json_get_elements(JSON* object);
 
+// Returns the element at pos of a json array, or NULL if out of range
+// Constant time for arrays of at least JSON_INDEX_MIN elements
+JSON* json_get_element(JSON* object, int pos);
+
 // Gets the number of members of an object or array
 int json_get_count(JSON* object);
 
@@ -197,24 +310,83 @@ char* json_tostring(JSON* object, int format);
 
 // Writes the json structure to a file
 // Not that the name of the root object, if not NULL, is the file that was read
-// Returns 0 on success
+// Returns 0 on success, -3 if writing failed
 // Overwrites file
 // Creates the directories leading up to it (JSON_USE_POSIX or JSON_USE_WINAPI need to be defined accordingly)
 // If format is JSON_COMPACT (1), resulting string will not contain whitespace
 // If format is JSON_FORMAT (0), resulting string will be pretty formatted
 int json_writefile(JSON* object, const char* filepath, int format);
 
+typedef struct json_writer_t json_writer_t;
+
+// Writes size bytes of buf
+// Returns how many bytes were written, less than size on error
+typedef size_t (*json_write_func)(void* ctx, const char* buf, size_t size);
+
+// Creates a writer buffering output for write, see Writing
+json_writer_t* json_writer_create(json_write_func write, void* ctx);
+
+// Creates a writer of an open file, the file is not closed by the writer
+json_writer_t* json_writer_create_file(FILE* fp);
+
+// Creates a writer of an open file descriptor, the descriptor is not closed by the writer
+json_writer_t* json_writer_create_fd(int fd);
+
+// Writes the json structure after what was written before
+// If format is JSON_COMPACT (0), the output will not contain whitespace
+void json_writer_write(json_writer_t* writer, JSON* object, int format);
+
+// Writes length characters of str as they are, such as a newline between records
+void json_writer_raw(json_writer_t* writer, const char* str, size_t length);
+
+// Passes the buffered output to the write function
+// Returns 0 on success, -1 if any write failed since the writer was created
+int json_writer_flush(json_writer_t* writer);
+
+// Flushes and frees the writer
+// Returns the result of json_writer_flush
+int json_writer_destroy(json_writer_t* writer);
+
 // Loads a json file recusively from a file into memory
 JSON* json_loadfile(const char* filepath);
 
 // Loads a json string recursively
 JSON* json_loadstring(char* str);
 
+// Loads a json file without copying any strings, see In-situ parsing
+// The contents of the file are freed with the returned root
+JSON* json_loadfile_insitu(const char* filepath);
+
+// Called by json_load_lines with each record and the byte offset of its line in the file
+// The record is owned by the callback, which is called from several threads at once with JSON_THREADS
+typedef void (*json_line_func)(JSON* record, size_t offset, void* ctx);
+
+// Loads a file of one json value per line, see Json lines
+// The lines are parsed on nthreads threads including the calling one, in no particular order
+// Returns how many records were passed to callback, or -1 if the file could not be read
+long json_load_lines(const char* filepath, int nthreads, json_line_func callback, void* ctx);
+
+// Loads a json file lazily, see Lazy parsing
+// The contents of the file are freed with the returned root
+JSON* json_loadfile_lazy(const char* filepath);
+
+// Loads a json string lazily, see Lazy parsing
+// str is modified and needs to outlive the returned json
+JSON* json_loadstring_lazy(char* str);
+
+// Loads a json string without copying any strings, see In-situ parsing
+// str is modified and needs to outlive the returned json
+JSON* json_loadstring_insitu(char* str);
+
 // Loads a json object from a string
 // Returns a pointer to the end of the object in the beginning string
 // NOTE : should not be used on an existing object, object needs to be empty or destroyed
 char* json_load(JSON* object, char* str);
 
+// Loads a json object from a string in-situ, see In-situ parsing
+// str is modified and needs to outlive object
+char* json_load_insitu(JSON* object, char* str);
+
 // Destroys a member from the json structure
 void json_destroy_member(JSON* object, const char* name);
 
@@ -248,6 +420,95 @@ void json_add_element(JSON* object, JSON* element);
 // Element should be remove from parent before calling destroy
 void json_destroy(JSON* object);
 
+// An arena owning all the objects and strings of a json tree, see Documents
+typedef struct json_doc_t json_doc_t;
+
+// Creates an empty document, the root has invalid type
+json_doc_t* json_doc_create();
+
+// Loads a document from a file
+// Returns NULL if the file could not be read or is invalid
+json_doc_t* json_doc_loadfile(const char* filepath);
+
+// Loads a document from a copy of str
+// Returns NULL if the string is invalid
+json_doc_t* json_doc_loadstring(const char* str);
+
+// Loads a document from str, which is modified and borrowed by the strings of the document
+// Returns NULL if the string is invalid
+json_doc_t* json_doc_loadstring_insitu(char* str);
+
+// Returns the root object of the document
+JSON* json_doc_root(json_doc_t* doc);
+
+// Creates an empty json with invalid type from the arena of the document
+// Use the setters or json_add_member to give it a value
+JSON* json_doc_create_empty(json_doc_t* doc);
+
+// Frees the document and all its objects
+void json_doc_destroy(json_doc_t* doc);
+
+// Tokens returned by json_reader_next, see Streaming
+#define JSON_TOKEN_ERROR		-1
+#define JSON_TOKEN_END			0
+#define JSON_TOKEN_MORE			1
+#define JSON_TOKEN_BEGIN_OBJECT 2
+#define JSON_TOKEN_END_OBJECT	3
+#define JSON_TOKEN_BEGIN_ARRAY	4
+#define JSON_TOKEN_END_ARRAY	5
+#define JSON_TOKEN_KEY			6
+#define JSON_TOKEN_STRING		7
+#define JSON_TOKEN_NUMBER		8
+#define JSON_TOKEN_BOOL			9
+#define JSON_TOKEN_NULL			10
+
+typedef struct json_reader_t json_reader_t;
+
+// Reads up to size bytes of input into buf
+// Returns how many bytes were read, 0 at the end of input
+typedef size_t (*json_read_func)(void* ctx, char* buf, size_t size);
+
+// Creates a reader pulling input from read, or fed with json_reader_feed if read is NULL
+json_reader_t* json_reader_create(json_read_func read, void* ctx);
+
+// Creates a reader of an open file, the file is not closed by the reader
+json_reader_t* json_reader_create_file(FILE* fp);
+
+// Creates a reader of an open file descriptor, the descriptor is not closed by the reader
+json_reader_t* json_reader_create_fd(int fd);
+
+// Appends a chunk of input to a reader
+void json_reader_feed(json_reader_t* reader, const char* data, size_t size);
+
+// Marks the end of the fed input
+void json_reader_finish(json_reader_t* reader);
+
+// Reads the next token
+// Returns JSON_TOKEN_END at the end of input, JSON_TOKEN_MORE if more needs to be fed
+// and JSON_TOKEN_ERROR for invalid json, after which the reader returns errors
+int json_reader_next(json_reader_t* reader);
+
+// Returns the last token read
+int json_reader_token(json_reader_t* reader);
+
+// Returns the decoded string of the last JSON_TOKEN_KEY or JSON_TOKEN_STRING, otherwise NULL
+// Stores the length in length if not NULL
+const char* json_reader_string(json_reader_t* reader, size_t* length);
+
+// Returns the value of the last JSON_TOKEN_NUMBER, or 1 or 0 for JSON_TOKEN_BOOL
+double json_reader_number(json_reader_t* reader);
+
+// Returns how many objects and arrays are open
+size_t json_reader_depth(json_reader_t* reader);
+
+// Reads the next value and builds it as a tree, or the next member with its name if at a key
+// Returns NULL at the end of an array or object, the end of input or on error, see json_reader_token
+// All of the value needs to be available, JSON_TOKEN_MORE is an error
+JSON* json_reader_load(json_reader_t* reader);
+
+// Frees the reader
+void json_reader_destroy(json_reader_t* reader);
+
 // End of header
 // Implementation
 #ifdef LIBJSON_IMPLEMENTATION
@@ -256,6 +517,8 @@ void json_destroy(JSON* object);
 #include <string.h>
 #include <math.h>
 #include <limits.h>
+#include <stdint.h>
+#include <locale.h>
 
 #ifndef JSON_MALLOC
 #define JSON_MALLOC(s) malloc(s)
@@ -269,13 +532,167 @@ void json_destroy(JSON* object);
 
 #if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
 #include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#ifndef JSON_NO_MMAP
+#include <sys/mman.h>
+#include <fcntl.h>
+#define JSON_MMAP
+#endif
+#endif
+#ifdef JSON_THREADS
+#include <pthread.h>
 #endif
 #if defined(_WIN32) || defined(WIN32)
 #include <windows.h>
+#include <io.h>
+#endif
+
+#ifndef JSON_READER_BUFFER
+#define JSON_READER_BUFFER 4096
+#endif
+
+#ifndef JSON_WRITER_BUFFER
+#define JSON_WRITER_BUFFER 4096
+#endif
+
+#ifndef JSON_LINES_CHUNK
+#define JSON_LINES_CHUNK (1 << 20)
+#endif
+
+#ifndef JSON_INDEX_MIN
+#define JSON_INDEX_MIN 16
+#endif
+
+#ifdef JSON_MEMPOOL
+#ifndef MEMPOOL_H
+#error "JSON_MEMPOOL requires mempool.h to be included before the libjson implementation"
+#endif
+#ifndef JSON_DOC_BLOCK
+#define JSON_DOC_BLOCK 4096
+#endif
 #endif
 
 #define JSON_IS_WHITESPACE(c) (c == ' ' || c == '\n' || c == '\r' || c == '\t')
 
+// Vector scanning of whitespace and strings
+// The loads are aligned to the vector size so they never cross into a page past the terminator, but they can read
+// bytes outside of the buffer, which is hidden from the address and thread sanitizers
+#if !defined(JSON_NO_SIMD) && defined(__GNUC__)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define JSON_SIMD_AVX2
+#define JSON_SIMD_WIDTH 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define JSON_SIMD_SSE2
+#define JSON_SIMD_WIDTH 16
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define JSON_SIMD_NEON
+#define JSON_SIMD_WIDTH 16
+#endif
+#endif
+
+#ifdef JSON_SIMD_WIDTH
+#define JSON_NO_SANITIZE __attribute__((no_sanitize_address, no_sanitize_thread))
+
+#if defined(JSON_SIMD_AVX2)
+typedef __m256i json_vec_t;
+typedef uint32_t json_mask_t;
+#define JSON_VEC_LOAD(p)	 _mm256_load_si256((const __m256i*)(p))
+#define JSON_VEC_EQ(v, c)	 _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+#define JSON_VEC_OR(a, b)	 _mm256_or_si256(a, b)
+// Bytes of at most 0x1F
+#define JSON_VEC_CONTROL(v)	 _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(0x1F)), _mm256_set1_epi8(0x1F))
+#define JSON_VEC_MASK(v)	 ((json_mask_t)_mm256_movemask_epi8(v))
+#define JSON_MASK_INDEX(m)	 __builtin_ctz(m)
+#define JSON_MASK_BEFORE(n)	 ((json_mask_t)((1ULL << (n)) - 1))
+#define JSON_MASK_ALL		 0xFFFFFFFFU
+#elif defined(JSON_SIMD_SSE2)
+typedef __m128i json_vec_t;
+typedef uint32_t json_mask_t;
+#define JSON_VEC_LOAD(p)	_mm_load_si128((const __m128i*)(p))
+#define JSON_VEC_EQ(v, c)	_mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#define JSON_VEC_OR(a, b)	_mm_or_si128(a, b)
+#define JSON_VEC_CONTROL(v) _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1F)), _mm_set1_epi8(0x1F))
+#define JSON_VEC_MASK(v)	((json_mask_t)_mm_movemask_epi8(v))
+#define JSON_MASK_INDEX(m)	__builtin_ctz(m)
+#define JSON_MASK_BEFORE(n) ((json_mask_t)((1U << (n)) - 1))
+#define JSON_MASK_ALL		0xFFFFU
+#elif defined(JSON_SIMD_NEON)
+typedef uint8x16_t json_vec_t;
+// Four bits for every byte, narrowed from the comparison result
+typedef uint64_t json_mask_t;
+#define JSON_VEC_LOAD(p)	vld1q_u8((const uint8_t*)(p))
+#define JSON_VEC_EQ(v, c)	vceqq_u8(v, vdupq_n_u8(c))
+#define JSON_VEC_OR(a, b)	vorrq_u8(a, b)
+#define JSON_VEC_CONTROL(v) vcleq_u8(v, vdupq_n_u8(0x1F))
+#define JSON_VEC_MASK(v)	vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0)
+#define JSON_MASK_INDEX(m)	(__builtin_ctzll(m) >> 2)
+#define JSON_MASK_BEFORE(n) ((json_mask_t)((1ULL << ((n)*4)) - 1))
+#define JSON_MASK_ALL		(~0ULL)
+#endif
+
+// Returns the mask of the bytes that are not whitespace
+static inline json_mask_t json_vec_nonspace(json_vec_t v)
+{
+	json_vec_t ws = JSON_VEC_OR(JSON_VEC_OR(JSON_VEC_EQ(v, ' '), JSON_VEC_EQ(v, '\n')),
+								JSON_VEC_OR(JSON_VEC_EQ(v, '\r'), JSON_VEC_EQ(v, '\t')));
+	return ~JSON_VEC_MASK(ws) & JSON_MASK_ALL;
+}
+
+// Returns the mask of the quotes, backslashes and control characters, including the terminator
+static inline json_mask_t json_vec_special(json_vec_t v)
+{
+	return JSON_VEC_MASK(JSON_VEC_OR(JSON_VEC_OR(JSON_VEC_EQ(v, '"'), JSON_VEC_EQ(v, '\\')), JSON_VEC_CONTROL(v)));
+}
+#else
+#define JSON_NO_SANITIZE
+#endif
+
+// Returns the first character at or after str that is not whitespace
+JSON_NO_SANITIZE static char* json_skip_whitespace(char* str)
+{
+	// Whitespace runs are mostly short, do not load a vector for none
+	if (!JSON_IS_WHITESPACE(*str))
+		return str;
+#ifdef JSON_SIMD_WIDTH
+	char* p = (char*)((uintptr_t)str & ~(uintptr_t)(JSON_SIMD_WIDTH - 1));
+	// Ignore the bytes before str
+	json_mask_t mask = json_vec_nonspace(JSON_VEC_LOAD(p)) & ~JSON_MASK_BEFORE(str - p);
+	while (mask == 0)
+	{
+		p += JSON_SIMD_WIDTH;
+		mask = json_vec_nonspace(JSON_VEC_LOAD(p));
+	}
+	return p + JSON_MASK_INDEX(mask);
+#else
+	while (JSON_IS_WHITESPACE(*str))
+		str++;
+	return str;
+#endif
+}
+
+// Returns the first quote, backslash or control character at or after str, which may be the terminator
+JSON_NO_SANITIZE static char* json_scan_string(char* str)
+{
+#ifdef JSON_SIMD_WIDTH
+	char* p = (char*)((uintptr_t)str & ~(uintptr_t)(JSON_SIMD_WIDTH - 1));
+	json_mask_t mask = json_vec_special(JSON_VEC_LOAD(p)) & ~JSON_MASK_BEFORE(str - p);
+	while (mask == 0)
+	{
+		p += JSON_SIMD_WIDTH;
+		mask = json_vec_special(JSON_VEC_LOAD(p));
+	}
+	return p + JSON_MASK_INDEX(mask);
+#else
+	while (*str != '"' && *str != '\\' && (unsigned char)*str > 0x1F)
+		str++;
+	return str;
+#endif
+}
+
 #ifndef JSON_MESSAGE
 #define JSON_MESSAGE(m) fputs(m, stderr)
 #endif
@@ -290,325 +707,567 @@ char* strduplicate(const char* str)
 	return dup;
 }
 
-struct JSONStringStream
+// Numbers are printed with Grisu2, which finds the shortest digits that read back to the same double in almost all
+// cases, and always digits that read back to the same double
+// A double as significand * 2^e
+struct json_diyfp
 {
-	// The internal string pointer
-	char* str;
-	// The allocated size of the string
-	size_t size;
-	// How much has been written to the string
-	// Does not include the null terminator
-	size_t length;
+	uint64_t f;
+	int e;
 };
 
-#define WRITE_ESCAPE(c)            \
-	escaped_str[escapedi] = '\\';  \
-	escaped_str[escapedi + 1] = c; \
-	escapedi++;
+// The significands and binary exponents of 10^-348, 10^-340 ... 10^340
+static const uint64_t json_cached_powers_f[] = {
+	0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL, 0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL,
+	0xe61acf033d1a45dfULL, 0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL, 0x8dd01fad907ffc3cULL,
+	0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL, 0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+	0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL, 0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL,
+	0xb23867fb2a35b28eULL, 0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL, 0xdbac6c247d62a584ULL,
+	0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL, 0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+	0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL, 0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL,
+	0x8a08f0f8bf0f156bULL, 0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL, 0xaa242499697392d3ULL,
+	0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL, 0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+	0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL, 0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL,
+	0xd5d238a4abe98068ULL, 0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL, 0x83c7088e1aab65dbULL,
+	0xc45d1df942711d9aULL, 0x924d692ca61be758ULL, 0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+	0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL, 0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL,
+	0xa59bc234db398c25ULL, 0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL, 0xcc20ce9bd35c78a5ULL,
+	0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL, 0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+	0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL, 0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL,
+	0x80444b5e7aa7cf85ULL, 0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL, 0x9e19db92b4e31ba9ULL,
+	0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL};
+static const int16_t json_cached_powers_e[] = {
+	-1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927, -901, -874, -847, -821,
+	-794, -768, -741, -715, -688, -661, -635, -608, -582, -555, -529, -502, -475, -449, -422, -396,
+	-369, -343, -316, -289, -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+	56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348, 375, 402, 428, 455,
+	481, 508, 534, 561, 588, 614, 641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+	907, 933, 960, 986, 1013, 1039, 1066};
+// 10^0 to 10^19
+static const uint64_t json_pow10_u64[] = {1ULL,
+										  10ULL,
+										  100ULL,
+										  1000ULL,
+										  10000ULL,
+										  100000ULL,
+										  1000000ULL,
+										  10000000ULL,
+										  100000000ULL,
+										  1000000000ULL,
+										  10000000000ULL,
+										  100000000000ULL,
+										  1000000000000ULL,
+										  10000000000000ULL,
+										  100000000000000ULL,
+										  1000000000000000ULL,
+										  10000000000000000ULL,
+										  100000000000000000ULL,
+										  1000000000000000000ULL,
+										  10000000000000000000ULL};
+
+#define JSON_DP_HIDDEN_BIT 0x0010000000000000ULL
+#define JSON_DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+
+// Returns the upper 64 bits of the product, rounded
+static struct json_diyfp json_diyfp_mul(struct json_diyfp x, struct json_diyfp y)
+{
+	const uint64_t m32 = 0xFFFFFFFFULL;
+	uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+	uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+	uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+	tmp += 1ULL << 31;
+	struct json_diyfp r = {ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64};
+	return r;
+}
 
-// Writes to string stream
-// If escape is 1, control characters will be escaped as two characters
-// Escaping decreases performance
-static void json_ss_write(struct JSONStringStream* ss, const char* str, int escape)
+static struct json_diyfp json_diyfp_normalize(struct json_diyfp x)
 {
-	if (str == NULL)
+	while (!(x.f & (1ULL << 63)))
 	{
-		JSON_MESSAGE("Error writing invalid string");
+		x.f <<= 1;
+		x.e--;
 	}
+	return x;
+}
 
-	size_t lstr = strlen(str);
-	char* escaped_str = NULL;
-	if (escape)
+// Finds the normalized boundaries m- and m+ halfway to the neighbouring doubles of v
+static void json_diyfp_boundaries(struct json_diyfp v, struct json_diyfp* minus, struct json_diyfp* plus)
+{
+	struct json_diyfp pl = {(v.f << 1) + 1, v.e - 1};
+	while (!(pl.f & (JSON_DP_HIDDEN_BIT << 1)))
 	{
-		// Worst case, expect all characters to be escaped and fit \0
-		escaped_str = JSON_MALLOC(2 * lstr + 1);
-
-		// Allocated size
-		// Look for control characters
-		size_t stri = 0, escapedi = 0;
-		for (; stri < lstr; stri++, escapedi++)
-		{
-			switch (str[stri])
-			{
-			case '"':
-				WRITE_ESCAPE('"');
-				break;
-			case '\b':
-				WRITE_ESCAPE('b');
-				break;
-			case '\f':
-				WRITE_ESCAPE('f');
-				break;
-			case '\n':
-				WRITE_ESCAPE('n');
-				break;
-			case '\r':
-				WRITE_ESCAPE('r');
-				break;
-			case '\t':
-				WRITE_ESCAPE('t');
-				break;
-			default:
-				escaped_str[escapedi] = str[stri];
-				break;
-			}
-		}
-		lstr = escapedi;
-		escaped_str[lstr] = '\0';
+		pl.f <<= 1;
+		pl.e--;
 	}
+	// Shift the hidden bit to the top
+	pl.f <<= 10;
+	pl.e -= 10;
+
+	// The lower boundary is closer if v is a power of two
+	struct json_diyfp mi;
+	if (v.f == JSON_DP_HIDDEN_BIT)
+		mi = (struct json_diyfp){(v.f << 2) - 1, v.e - 2};
+	else
+		mi = (struct json_diyfp){(v.f << 1) - 1, v.e - 1};
+	mi.f <<= mi.e - pl.e;
+	mi.e = pl.e;
+	*minus = mi;
+	*plus = pl;
+}
+
+// Returns a cached power of ten c such that the product with a significand of binary exponent e lands in [-60, -32]
+// Stores the negated decimal exponent of c in k
+static struct json_diyfp json_cached_power(int e, int* k)
+{
+	double dk = (-61 - e) * 0.30102999566398114 + 347;
+	int ik = (int)dk;
+	if (dk - ik > 0.0)
+		ik++;
+	unsigned index = (unsigned)((ik >> 3) + 1);
+	*k = -(-348 + (int)(index << 3));
+	struct json_diyfp c = {json_cached_powers_f[index], json_cached_powers_e[index]};
+	return c;
+}
 
-	// Allocate first time
-	if (ss->str == NULL)
+// Moves the last digit closer to w while staying inside the boundaries
+static void json_grisu_round(char* buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+	while (rest < wp_w && delta - rest >= ten_kappa &&
+		   (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
 	{
-		ss->size = 8;
-		ss->str = JSON_MALLOC(8);
+		buf[len - 1]--;
+		rest += ten_kappa;
 	}
+}
 
-	// Resize
-	if (ss->length + lstr + 1 > ss->size)
+// Generates the shortest digits of w inside the boundaries mp - delta and mp
+static void json_grisu_digits(struct json_diyfp w, struct json_diyfp mp, uint64_t delta, char* buf, int* len, int* k)
+{
+	struct json_diyfp one = {1ULL << -mp.e, mp.e};
+	uint64_t wp_w = mp.f - w.f;
+	uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+	uint64_t p2 = mp.f & (one.f - 1);
+
+	int kappa = 1;
+	while (kappa < 10 && p1 >= json_pow10_u64[kappa])
+		kappa++;
+
+	*len = 0;
+	// Integral part
+	while (kappa > 0)
 	{
-
-		ss->size = ss->size << (size_t)log2(lstr + 1);
-		char* tmp = JSON_REALLOC(ss->str, ss->size);
-		if (tmp == NULL)
+		uint32_t div = (uint32_t)json_pow10_u64[kappa - 1];
+		uint32_t d = p1 / div;
+		p1 %= div;
+		if (d || *len)
+			buf[(*len)++] = (char)('0' + d);
+		kappa--;
+		uint64_t tmp = ((uint64_t)p1 << -one.e) + p2;
+		if (tmp <= delta)
 		{
-			JSON_MESSAGE("Failed to allocate memory for string stream");
+			*k += kappa;
+			json_grisu_round(buf, *len, delta, tmp, json_pow10_u64[kappa] << -one.e, wp_w);
 			return;
 		}
-		ss->str = tmp;
 	}
 
-	// Copy data
-	memcpy(ss->str + ss->length, escape ? escaped_str : str, lstr);
-	ss->length += lstr;
-	// Null terminate
-	ss->str[ss->length] = '\0';
-	if (escape)
+	// Fractional part
+	for (;;)
 	{
-		JSON_FREE(escaped_str);
+		p2 *= 10;
+		delta *= 10;
+		char d = (char)(p2 >> -one.e);
+		if (d || *len)
+			buf[(*len)++] = (char)('0' + d);
+		p2 &= one.f - 1;
+		kappa--;
+		if (p2 < delta)
+		{
+			*k += kappa;
+			int index = -kappa;
+			json_grisu_round(buf, *len, delta, p2, one.f, wp_w * (index < 20 ? json_pow10_u64[index] : 0));
+			return;
+		}
 	}
 }
 
-// Converts a double to a string
-// Precision indicates the max digits to include after the comma
-// Prints up to precision digits after the comma, can write less. Can be used to print integers, where the comma is not written
-// Returns how many characters were written
-static int json_ftos(double num, char* buf, int precision)
+// Writes the digits of a positive finite num to buf, num is digits * 10^k
+static int json_grisu2(double num, char* buf, int* k)
 {
-	if (isinf(num))
+	uint64_t u;
+	memcpy(&u, &num, sizeof u);
+	int biased_e = (int)((u >> 52) & 0x7FF);
+	struct json_diyfp v = {u & JSON_DP_SIGNIFICAND_MASK, -1074};
+	if (biased_e != 0)
 	{
-		if (num < 0)
-			*buf++ = '-';
-		*buf++ = 'i';
-		*buf++ = 'n';
-		*buf++ = 'f';
-		*buf++ = '\0';
-		return num < 0 ? 4 : 3;
+		v.f += JSON_DP_HIDDEN_BIT;
+		v.e = biased_e - 1075;
 	}
 
-	// Save the sign and remove it from num
-	int neg = num < 0;
-	if (neg)
-		num *= -1;
-	// Shift decimal to precision places to an int
-	size_t a = num * pow(10, precision + 1);
-
-	// Round initially
-	if (a % 10 >= 5)
-		a += 10;
-	a /= 10;
-
-	size_t dec_pos = precision;
+	struct json_diyfp minus, plus;
+	json_diyfp_boundaries(v, &minus, &plus);
+	struct json_diyfp c = json_cached_power(plus.e, k);
+	struct json_diyfp w = json_diyfp_mul(json_diyfp_normalize(v), c);
+	struct json_diyfp wp = json_diyfp_mul(plus, c);
+	struct json_diyfp wm = json_diyfp_mul(minus, c);
+	// Stay strictly inside the boundaries since the products are inexact
+	wm.f++;
+	wp.f--;
+	int len;
+	json_grisu_digits(w, wp, wp.f - wm.f, buf, &len, k);
+	return len;
+}
 
-	// Carried the one, need to round once more
-	while (a % 10 == 0 && a && a > num)
+// Writes e as the exponent of a number and returns the end
+static char* json_write_exponent(int e, char* buf)
+{
+	*buf++ = 'e';
+	if (e < 0)
 	{
-		if (a % 10 >= 5)
-			a += 10;
-		a /= 10;
-		dec_pos--;
+		*buf++ = '-';
+		e = -e;
 	}
+	if (e >= 100)
+	{
+		*buf++ = (char)('0' + e / 100);
+		e %= 100;
+		*buf++ = (char)('0' + e / 10);
+	}
+	else if (e >= 10)
+		*buf++ = (char)('0' + e / 10);
+	*buf++ = (char)('0' + e % 10);
+	return buf;
+}
 
-	int base = 10;
-	char numerals[17] = {"0123456789ABCDEF"};
-
-	// Return and write one character if float == 0 to precision accuracy
-	if (a == 0)
+// Converts a double to the shortest string that is read back as the same double
+// Integers are written without a fraction, large and small numbers in exponent notation
+// buf needs to hold at least 32 characters
+// Returns how many characters were written
+static int json_ftos(double num, char* buf)
+{
+	char* start = buf;
+	if (isnan(num))
+	{
+		memcpy(buf, "nan", 4);
+		return 3;
+	}
+	if (signbit(num))
+	{
+		*buf++ = '-';
+		num = -num;
+	}
+	if (isinf(num))
+	{
+		memcpy(buf, "inf", 4);
+		return (int)(buf - start) + 3;
+	}
+	if (num == 0)
 	{
 		*buf++ = '0';
 		*buf = '\0';
-		return 1;
+		return (int)(buf - start);
 	}
 
-	size_t digitcount = log10(a) + 1;
-	size_t buf_index = digitcount + neg + (dec_pos >= digitcount ? dec_pos - digitcount + 1 : 0) + (dec_pos ? 1 : 0);
-	int return_value = buf_index;
-
-	buf[buf_index] = '\0';
-	while (buf_index)
+	int k = 0;
+	int len = json_grisu2(num, buf, &k);
+	// The decimal point is after kk digits
+	int kk = len + k;
+	char* end;
+	if (k >= 0 && kk <= 21)
+	{
+		// Integer, 1234e7 -> 12340000000
+		for (int i = len; i < kk; i++)
+			buf[i] = '0';
+		end = buf + kk;
+	}
+	else if (kk > 0 && kk <= 21)
+	{
+		// 1234e-2 -> 12.34
+		memmove(buf + kk + 1, buf + kk, len - kk);
+		buf[kk] = '.';
+		end = buf + len + 1;
+	}
+	else if (kk > -6 && kk <= 0)
+	{
+		// 1234e-6 -> 0.001234
+		int offset = 2 - kk;
+		memmove(buf + offset, buf, len);
+		buf[0] = '0';
+		buf[1] = '.';
+		for (int i = 2; i < offset; i++)
+			buf[i] = '0';
+		end = buf + len + offset;
+	}
+	else if (len == 1)
+	{
+		// 1e30
+		end = json_write_exponent(kk - 1, buf + 1);
+	}
+	else
 	{
-		buf[--buf_index] = numerals[a % base];
-		if (dec_pos == 1)
-			buf[--buf_index] = '.';
-		dec_pos--;
-		a /= base;
+		// 1234e30 -> 1.234e33
+		memmove(buf + 2, buf + 1, len - 1);
+		buf[1] = '.';
+		end = json_write_exponent(kk - 1, buf + len + 1);
 	}
-	if (neg)
-		*buf = '-';
-	return return_value;
+	*end = '\0';
+	return (int)(end - start);
 }
 
+// Powers of ten that are exact doubles
+static const double json_pow10_exact[] = {1e0,	1e1,  1e2,	1e3,  1e4,	1e5,  1e6,	1e7,  1e8,	1e9,  1e10, 1e11,
+										  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
 // Convert a json valid number representation from string to double
+// The digits are read into an integer significand and decimal exponent, which is exact if both fit in a double
+// Other numbers are correctly rounded by strtod on a copy with the decimal point of the locale
+// Returns the end of the number
 static char* json_stof(char* str, double* out)
 {
-	double result = 0;
-	// Signifies if read past period
-	int isfraction = 0;
-	// The value of the digit after period
-	double digitval = 1;
-	// Signifies if optional exponent is being read
-	int isexponent = 0;
-	// Value of exponent
-	int exponent = 0;
-	// The sign of the resulting value
-	int sign = 1;
-	if (*str == '-')
+	char* start = str;
+	int neg = 0;
+	if (*str == '-' || *str == '+')
 	{
-		sign = -1;
+		neg = *str == '-';
 		str++;
 	}
 
-	for (; *str != '\0'; str++)
+	uint64_t significand = 0;
+	// Significant digits in significand, leading zeros are not counted
+	int digits = 0;
+	int exponent = 0;
+	// Set if nonzero digits did not fit in the significand
+	int truncated = 0;
+	for (; *str >= '0' && *str <= '9'; str++)
 	{
-		// Decimal place
-		if (*str == '.')
+		if (digits < 19)
 		{
-			isfraction = 1;
-			continue;
+			significand = significand * 10 + (*str - '0');
+			digits += significand != 0;
 		}
-
-		// Exponent
-		if (*str == 'e' || *str == 'E')
+		else
 		{
-			if (isexponent)
+			truncated |= *str != '0';
+			exponent++;
+		}
+	}
+	if (*str == '.')
+	{
+		for (str++; *str >= '0' && *str <= '9'; str++)
+		{
+			if (digits < 19)
 			{
-				JSON_MESSAGE("Can't have stacked exponents");
-				return 0;
+				significand = significand * 10 + (*str - '0');
+				digits += significand != 0;
+				exponent--;
 			}
-			isexponent = 1;
-			continue;
+			else
+				truncated |= *str != '0';
 		}
-		// End
-		// Keep comma and return
-		if (*str == ',')
+	}
+	if (*str == 'e' || *str == 'E')
+	{
+		char* e = str + 1;
+		int eneg = 0;
+		if (*e == '-' || *e == '+')
 		{
-			break;
+			eneg = *e == '-';
+			e++;
 		}
-
-		// Break when not a valid number
-		// Triggered when next char is end of object or array wihtout comma
-		if (*str < '0' || *str > '9')
+		// An e without digits is not part of the number
+		if (*e >= '0' && *e <= '9')
 		{
-			break;
+			int value = 0;
+			for (; *e >= '0' && *e <= '9'; e++)
+			{
+				// Clamp, the result is zero or infinity long before
+				if (value < 100000)
+					value = value * 10 + (*e - '0');
+			}
+			exponent += eneg ? -value : value;
+			str = e;
 		}
+	}
 
-		int digit = *str - '0';
-		if (isexponent)
-		{
-			exponent *= 10;
-			exponent += digit;
-		}
-		else if (isfraction)
+	// Clinger's fast path, a single correctly rounded operation on exact values
+	if (!truncated && significand <= (1ULL << 53) && exponent >= -22 && exponent <= 22)
+	{
+		double result = (double)significand;
+		result = exponent < 0 ? result / json_pow10_exact[-exponent] : result * json_pow10_exact[exponent];
+		*out = neg ? -result : result;
+		return str;
+	}
+
+	// strtod expects the decimal point of the current locale, which is not always '.'
+	const char* point = localeconv()->decimal_point;
+	size_t point_len = strlen(point);
+	size_t len = str - start;
+	char small[64];
+	char* copy = len + point_len < sizeof small ? small : JSON_MALLOC(len + point_len);
+	char* p = copy;
+	for (char* it = start; it != str; it++)
+	{
+		if (*it == '.')
 		{
-			digitval *= 0.1;
-			result += digit * digitval;
+			memcpy(p, point, point_len);
+			p += point_len;
 		}
-		// Normal digit
 		else
+			*p++ = *it;
+	}
+	*p = '\0';
+	*out = strtod(copy, NULL);
+	if (copy != small)
+		JSON_FREE(copy);
+	return str;
+}
+
+// Returns the character of the escape sequence \\c, or 0 if invalid
+static char json_unescape(char c)
+{
+	switch (c)
+	{
+	case '"':
+		return '"';
+	case '\\':
+		return '\\';
+	case '/':
+		return '/';
+	case 'b':
+		return '\b';
+	case 'f':
+		return '\f';
+	case 'n':
+		return '\n';
+	case 'r':
+		return '\r';
+	case 't':
+		return '\t';
+	default:
+		return 0;
+	}
+}
+
+// Reads the 4 hex digits of a \u escape
+// Returns -1 if they are not hex digits
+static long json_read_hex(const char* str)
+{
+	long value = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		char c = str[i];
+		value <<= 4;
+		if (c >= '0' && c <= '9')
+			value |= c - '0';
+		else if (c >= 'a' && c <= 'f')
+			value |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			value |= c - 'A' + 10;
+		else
+			return -1;
+	}
+	return value;
+}
+
+// Decodes the code point of a \u escape, or a surrogate pair of two, at str after the u as UTF-8 into out
+// UTF-8 is never longer than the escape, so it can be decoded in place
+// Returns the character after the escape, or NULL if it is invalid
+static char* json_unescape_unicode(char* str, char** out)
+{
+	long c = json_read_hex(str);
+	if (c < 0)
+		return NULL;
+	str += 4;
+	if (c >= 0xD800 && c <= 0xDBFF && str[0] == '\\' && str[1] == 'u')
+	{
+		long low = json_read_hex(str + 2);
+		if (low >= 0xDC00 && low <= 0xDFFF)
 		{
-			result *= 10;
-			result += digit;
+			c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+			str += 6;
 		}
 	}
-	result *= sign;
-	if (exponent != 0)
-		*out = result * powf(10, exponent);
+	// Unpaired surrogates are replaced by U+FFFD
+	if (c >= 0xD800 && c <= 0xDFFF)
+		c = 0xFFFD;
+
+	char* p = *out;
+	if (c < 0x80)
+		*p++ = (char)c;
+	else if (c < 0x800)
+	{
+		*p++ = (char)(0xC0 | c >> 6);
+		*p++ = (char)(0x80 | (c & 0x3F));
+	}
+	else if (c < 0x10000)
+	{
+		*p++ = (char)(0xE0 | c >> 12);
+		*p++ = (char)(0x80 | (c >> 6 & 0x3F));
+		*p++ = (char)(0x80 | (c & 0x3F));
+	}
 	else
-		*out = result;
+	{
+		*p++ = (char)(0xF0 | c >> 18);
+		*p++ = (char)(0x80 | (c >> 12 & 0x3F));
+		*p++ = (char)(0x80 | (c >> 6 & 0x3F));
+		*p++ = (char)(0x80 | (c & 0x3F));
+	}
+	*out = p;
 	return str;
 }
 
-// Reads from start quote to end quote and takes escape characters into consideration
-// Allocates memory for output string; need to be freed manually
-static char* json_read_quote(char* str, char** out)
+// Decodes the string after a start quote in place up to the end quote
+// The end quote, or an earlier character if there were escapes, is set to the null terminator
+// Returns the character after the end quote
+static char* json_unquote(char* str)
 {
-	// Skip past start quote
-	while (*str != '"')
-		str++;
-	str++;
-
-	// Iterator for the object stringval
-	size_t lval = 8;
-	*out = JSON_MALLOC(lval);
-	char* result = *out;
-	size_t valit = 0;
-	// Loop to end of quote
-	for (; *str != '\0'; str++)
+	// The decoded string is written behind the read position
+	char* result = str;
+	for (;;)
 	{
-		char c = *str;
+		// Move the run of normal characters
+		char* end = json_scan_string(str);
+		if (result != str)
+			memmove(result, str, end - str);
+		result += end - str;
+		str = end;
 
-		// Allocate more space for string
-		if (valit + 1 >= lval)
+		char c = *str;
+		// End quote
+		if (c == '"')
 		{
-			lval *= 2;
-			char* tmp = JSON_REALLOC(*out, lval);
-			if (tmp == NULL)
-			{
-				JSON_MESSAGE("Failed to allocate memory for string value");
-				return str;
-			}
-			*out = tmp;
-			result = *out;
+			*result = '\0';
+			return str + 1;
 		}
 
 		// Escape sequence
 		if (c == '\\')
 		{
-			switch (str[1])
+			if (str[1] == 'u')
 			{
-			case '"':
-				result[valit++] = '"';
-				break;
-			case '\\':
-				result[valit++] = '\\';
-				break;
-			case '/':
-				result[valit++] = '/';
-				break;
-			case 'b':
-				result[valit++] = '\b';
-				break;
-			case 'f':
-				result[valit++] = '\f';
-				break;
-			case 'n':
-				result[valit++] = '\n';
-				break;
-			case 'r':
-				result[valit++] = '\r';
-				break;
-			case 't':
-				result[valit++] = '\t';
-				break;
-			default:
-				JSON_MESSAGE("Invalid escape sequence");
-				break;
+				char* next = json_unescape_unicode(str + 2, &result);
+				if (next)
+				{
+					str = next;
+					continue;
+				}
 			}
+			char e = json_unescape(str[1]);
+			if (e)
+				*result++ = e;
+			else
+				JSON_MESSAGE("Invalid escape sequence");
 			str++;
+			// Do not step over the terminator of a truncated string
+			if (*str != '\0')
+				str++;
 			continue;
 		}
 
-		if (c == '\\' || c == '\b' || c == '\f' || c == '\n' || c == '\r' || c == '\t')
+		if (c == '\0')
+			break;
+
+		if (c == '\b' || c == '\f' || c == '\n' || c == '\r' || c == '\t')
 		{
 			char msg[512];
 			snprintf(msg, sizeof msg, "Invalid character in string %10s, control characters must be escaped", str);
@@ -616,44 +1275,367 @@ static char* json_read_quote(char* str, char** out)
 			return NULL;
 		}
 
-		// End quote
-		if (c == '"')
-		{
-			result[valit++] = '\0';
-			return str + 1;
-		}
-
-		// Normal character
-		result[valit++] = c;
+		// Other control characters are kept
+		*result++ = c;
+		str++;
 	}
+	*result = '\0';
 	JSON_MESSAGE("Unexpected end of string");
 	return str;
 }
 
+// Reads from start quote to end quote like json_read_quote, but decodes the string in place
+// out points into str, see json_unquote
+static char* json_read_quote_insitu(char* str, char** out)
+{
+	// Skip past start quote
+	while (*str != '"')
+		str++;
+	str++;
+
+	*out = str;
+	return json_unquote(str);
+}
+
+// Reads from start quote to end quote and takes escape characters into consideration
+// Allocates memory for output string; need to be freed manually
+static char* json_read_quote(char* str, char** out)
+{
+	// Skip past start quote
+	while (*str != '"')
+		str++;
+	str++;
+
+	// Find the end quote, the decoded string is never longer
+	char* end = str;
+	for (;;)
+	{
+		end = json_scan_string(end);
+		if (*end == '\\' && end[1] != '\0')
+			end += 2;
+		else if (*end == '"' || *end == '\0')
+			break;
+		else
+			end++;
+	}
+
+	// Decode a copy of the quote in place
+	size_t len = end - str + (*end == '"');
+	char* copy = JSON_MALLOC(len + 1);
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	char* tmp = json_unquote(copy);
+	if (tmp == NULL)
+	{
+		JSON_FREE(copy);
+		*out = NULL;
+		return NULL;
+	}
+	*out = copy;
+	return str + (tmp - copy);
+}
+
+// The name or string value points into an in-situ source buffer or a document arena and is not freed
+#define JSON_FBORROWED_NAME	  1
+#define JSON_FBORROWED_STRING 2
+// The object itself is allocated from a document arena
+#define JSON_FARENA 4
+// The children or value are not built yet, see Lazy parsing
+#define JSON_FLAZY 8
+// The object owns the tape it points to
+#define JSON_FTAPE 16
+
 struct JSON
 {
 	int type;
+	// JSON_FBORROWED, JSON_FARENA, JSON_FLAZY and JSON_FTAPE flags
+	int flags;
+#ifdef JSON_MEMPOOL
+	// The document owning the object, or NULL
+	struct json_doc_t* doc;
+#endif
 
 	char* name;
 	char* stringval;
 	double numval;
 	struct JSON* members;
 	int count;
+	// Built for large objects and arrays by the first lookup, or NULL
+	struct json_index* index;
+	// The structure of a lazy object, or NULL
+	struct json_tape* tape;
 	// Linked list to the other members
-	// First elements are more recent
+	// The prev of the first member points to the last
 	struct JSON *prev, *next;
 };
 
+// Lookup of the members of a large object or the elements of a large array
+struct json_index
+{
+	// Objects are open addressed by the hash of the name, empty slots are NULL
+	// Arrays store the elements in order
+	JSON** items;
+	// The hash of the name in each slot of an object
+	size_t* hashes;
+	// Allocated slots, a power of two for objects
+	size_t size;
+};
+
+// Inserts value as a member with its current name, which is not copied
+static void json_link_member(JSON* object, JSON* value);
+
+// The structure of a value of lazily parsed json
+struct json_tape
+{
+	// Where the value or key starts in the source
+	char* src;
+	// How many entries the value spans including itself, 1 for keys and scalars
+	size_t size;
+};
+
+// Builds the children of a lazy object or array, or decodes a lazy string or number
+static void json_expand(JSON* object);
+#define JSON_EXPAND(object) ((object)->flags & JSON_FLAZY ? json_expand(object) : (void)0)
+
+#ifdef JSON_MEMPOOL
+struct json_doc_t
+{
+	mempool_arena_t arena;
+	JSON* root;
+	// Set if objects not in the arena were added, which requires walking the tree on destroy
+	int foreign;
+};
+#define JSON_DOC(object) ((object)->doc)
+#else
+#define JSON_DOC(object) ((json_doc_t*)NULL)
+#endif
+
+// Returns a new empty object from doc, or from JSON_MALLOC if doc is NULL
+static JSON* json_alloc(json_doc_t* doc);
+
+// Copies str into the arena of doc, or with strduplicate if doc is NULL
+static char* json_doc_strdup(json_doc_t* doc, const char* str);
+
+// Records that a child not from the arena of object was added to the document of object
+static void json_adopt(JSON* object, JSON* child);
+
+static size_t json_hash_name(const char* name)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (; *name; name++)
+	{
+		hash ^= (unsigned char)*name;
+		hash *= 0x100000001b3ULL;
+	}
+	return (size_t)hash;
+}
+
+static void json_index_free(JSON* object)
+{
+	struct json_index* index = object->index;
+	if (index == NULL)
+		return;
+	JSON_FREE(index->items);
+	if (index->hashes)
+	{
+		JSON_FREE(index->hashes);
+	}
+	JSON_FREE(index);
+	object->index = NULL;
+}
+
+// Replaces the index of object with an empty one of size slots
+static struct json_index* json_index_alloc(JSON* object, size_t size, int hashed)
+{
+	json_index_free(object);
+	struct json_index* index = JSON_MALLOC(sizeof(struct json_index));
+	index->size = size;
+	index->items = JSON_MALLOC(size * sizeof(JSON*));
+	index->hashes = NULL;
+	if (hashed)
+	{
+		index->hashes = JSON_MALLOC(size * sizeof(size_t));
+		memset(index->items, 0, size * sizeof(JSON*));
+	}
+#ifdef JSON_MEMPOOL
+	// The index is not in the arena, the document needs to be walked to free it
+	if (object->doc)
+		object->doc->foreign = 1;
+#endif
+	object->index = index;
+	return index;
+}
+
+// Puts a member with the hash of its name in the first free slot
+static void json_index_place(struct json_index* index, size_t hash, JSON* member)
+{
+	size_t mask = index->size - 1;
+	size_t i = hash & mask;
+	while (index->items[i])
+		i = (i + 1) & mask;
+	index->items[i] = member;
+	index->hashes[i] = hash;
+}
+
+// Builds the name index of an object, at most half full
+static void json_index_members(JSON* object)
+{
+	size_t size = 2 * JSON_INDEX_MIN;
+	while (size < 2 * (size_t)object->count + 2)
+		size *= 2;
+	struct json_index* index = json_index_alloc(object, size, 1);
+	for (JSON* cur = object->members; cur; cur = cur->next)
+		json_index_place(index, json_hash_name(cur->name), cur);
+}
+
+// Returns the slot of the member named name, or the size of the index if none
+static size_t json_index_find(struct json_index* index, size_t hash, const char* name)
+{
+	size_t mask = index->size - 1;
+	for (size_t i = hash & mask; index->items[i]; i = (i + 1) & mask)
+	{
+		if (index->hashes[i] == hash && strcmp(index->items[i]->name, name) == 0)
+			return i;
+	}
+	return index->size;
+}
+
+// Empties a slot and moves the following members of the probe sequence back
+static void json_index_remove(struct json_index* index, size_t slot)
+{
+	size_t mask = index->size - 1;
+	size_t i = slot;
+	size_t j = slot;
+	index->items[i] = NULL;
+	for (;;)
+	{
+		j = (j + 1) & mask;
+		if (index->items[j] == NULL)
+			return;
+		// The member in j can fill the hole if its home slot is not between the hole and j
+		size_t home = index->hashes[j] & mask;
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+		index->items[i] = index->items[j];
+		index->hashes[i] = index->hashes[j];
+		index->items[j] = NULL;
+		i = j;
+	}
+}
+
+// Builds the element vector of an array with room to grow
+static void json_index_elements(JSON* object)
+{
+	size_t size = 2 * JSON_INDEX_MIN;
+	while (size < 2 * (size_t)object->count)
+		size *= 2;
+	struct json_index* index = json_index_alloc(object, size, 0);
+	size_t i = 0;
+	for (JSON* cur = object->members; cur; cur = cur->next)
+		index->items[i++] = cur;
+}
+
+// Inserts element at pos of the element vector, the count includes the element
+static void json_index_insert(JSON* object, size_t pos, JSON* element)
+{
+	struct json_index* index = object->index;
+	if ((size_t)object->count > index->size)
+	{
+		index->size *= 2;
+		index->items = JSON_REALLOC(index->items, index->size * sizeof(JSON*));
+	}
+	memmove(index->items + pos + 1, index->items + pos, (object->count - 1 - pos) * sizeof(JSON*));
+	index->items[pos] = element;
+}
+
+// Inserts value before cur, or at the tail if cur is NULL
+static void json_list_insert(JSON* object, JSON* cur, JSON* value)
+{
+	object->count++;
+	// Empty list, the tail of the first is itself
+	if (object->members == NULL)
+	{
+		object->members = value;
+		value->prev = value;
+		value->next = NULL;
+		return;
+	}
+	// Tail
+	if (cur == NULL)
+	{
+		JSON* tail = object->members->prev;
+		tail->next = value;
+		value->prev = tail;
+		value->next = NULL;
+		object->members->prev = value;
+		return;
+	}
+	value->next = cur;
+	value->prev = cur->prev;
+	// Beginning
+	if (cur == object->members)
+		object->members = value;
+	else
+		cur->prev->next = value;
+	cur->prev = value;
+}
+
+// Removes cur from the list of object
+static void json_list_unlink(JSON* object, JSON* cur)
+{
+	object->count--;
+	if (cur == object->members)
+	{
+		object->members = cur->next;
+		// The new first takes over the pointer to the tail
+		if (object->members)
+			object->members->prev = cur->prev;
+	}
+	else
+	{
+		cur->prev->next = cur->next;
+		if (cur->next)
+			cur->next->prev = cur->prev;
+		// Update the tail pointer of the first
+		else
+			object->members->prev = cur->prev;
+	}
+	cur->next = NULL;
+	cur->prev = NULL;
+}
+
+// Returns the element at pos, or NULL if out of range
+static JSON* json_element_at(JSON* object, int pos)
+{
+	if (pos < 0 || pos >= object->count)
+		return NULL;
+	if (object->index == NULL && object->count >= JSON_INDEX_MIN)
+		json_index_elements(object);
+	if (object->index)
+		return object->index->items[pos];
+	JSON* cur = object->members;
+	while (pos--)
+		cur = cur->next;
+	return cur;
+}
+
 // Constructors
 JSON* json_create_empty()
 {
 	JSON* object = JSON_MALLOC(sizeof(JSON));
 	object->type = JSON_TINVALID;
+	object->flags = 0;
+#ifdef JSON_MEMPOOL
+	object->doc = NULL;
+#endif
 	object->name = NULL;
 	object->stringval = NULL;
 	object->numval = 0;
 	object->members = NULL;
 	object->count = 0;
+	object->index = NULL;
+	object->tape = NULL;
 	object->prev = NULL;
 	object->next = NULL;
 	return object;
@@ -710,10 +1692,13 @@ void json_set_invalid(JSON* object)
 	}
 	object->count = 0;
 	object->members = NULL;
-	if (object->stringval)
+	json_index_free(object);
+	if (object->stringval && !(object->flags & JSON_FBORROWED_STRING))
 	{
 		JSON_FREE(object->stringval);
 	}
+	object->stringval = NULL;
+	object->flags &= ~(JSON_FBORROWED_STRING | JSON_FLAZY);
 	object->type = JSON_TINVALID;
 	object->numval = 0;
 }
@@ -723,7 +1708,9 @@ void json_set_string(JSON* object, const char* str)
 {
 	json_set_invalid(object);
 	object->type = JSON_TSTRING;
-	object->stringval = strduplicate(str);
+	object->stringval = json_doc_strdup(JSON_DOC(object), str);
+	if (JSON_DOC(object))
+		object->flags |= JSON_FBORROWED_STRING;
 }
 
 void json_set_number(JSON* object, double num)
@@ -758,11 +1745,13 @@ int json_get_type(JSON* object)
 
 char* json_get_string(JSON* object)
 {
+	JSON_EXPAND(object);
 	return object->stringval;
 }
 
 double json_get_number(JSON* object)
 {
+	JSON_EXPAND(object);
 	return object->numval;
 }
 
@@ -776,7 +1765,7 @@ char* json_get_member_string(JSON* object, const char* name)
 	JSON* tmp = json_get_member(object, name);
 	if (tmp == NULL)
 		return NULL;
-	return tmp->stringval;
+	return json_get_string(tmp);
 }
 
 // Gets a member of an object and returns its number value
@@ -785,7 +1774,7 @@ double json_get_member_number(JSON* object, const char* name)
 	JSON* tmp = json_get_member(object, name);
 	if (tmp == NULL)
 		return 0;
-	return tmp->numval;
+	return json_get_number(tmp);
 }
 
 // Gets a member of an object and returns its bool value
@@ -794,13 +1783,14 @@ int json_get_member_bool(JSON* object, const char* name)
 	JSON* tmp = json_get_member(object, name);
 	if (tmp == NULL)
 		return 0;
-	return tmp->numval;
+	return json_get_number(tmp);
 }
 
 JSON* json_get_members(JSON* object)
 {
 	if (object->type != JSON_TOBJECT)
 		return NULL;
+	JSON_EXPAND(object);
 	return object->members;
 }
 
@@ -808,6 +1798,15 @@ JSON* json_get_member(JSON* object, const char* name)
 {
 	if (object->type != JSON_TOBJECT)
 		return NULL;
+	JSON_EXPAND(object);
+	if (object->index == NULL && object->count >= JSON_INDEX_MIN)
+		json_index_members(object);
+	if (object->index)
+	{
+		struct json_index* index = object->index;
+		size_t slot = json_index_find(index, json_hash_name(name), name);
+		return slot < index->size ? index->items[slot] : NULL;
+	}
 	JSON* cur = object->members;
 	while (cur)
 	{
@@ -823,11 +1822,21 @@ JSON* json_get_elements(JSON* object)
 {
 	if (object->type != JSON_TARRAY)
 		return NULL;
+	JSON_EXPAND(object);
 	return object->members;
 }
 
+JSON* json_get_element(JSON* object, int pos)
+{
+	if (object->type != JSON_TARRAY)
+		return NULL;
+	JSON_EXPAND(object);
+	return json_element_at(object, pos);
+}
+
 int json_get_count(JSON* object)
 {
+	JSON_EXPAND(object);
 	return object->count;
 }
 
@@ -837,82 +1846,258 @@ JSON* json_get_next(JSON* element)
 	return element->next;
 }
 
-#define WRITE_NAME                                     \
-	if (ss->str && object->name)                       \
-	{                                                  \
-		json_ss_write(ss, "\"", 0);                    \
-		json_ss_write(ss, object->name, 1);            \
-		json_ss_write(ss, format ? "\": " : "\":", 0); \
+struct json_writer_t
+{
+	json_write_func write;
+	void* ctx;
+	// The output not yet passed to write, not null terminated
+	char* buf;
+	size_t length;
+	size_t size;
+	// Set when write failed, the rest of the output is dropped
+	int error;
+};
+
+// The escape character of each character, u for \u00XX and 0 for none
+static const char json_escapes[256] = {
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	['"'] = '"',
+	['\\'] = '\\',
+};
+
+// A newline followed by tabs for indentation
+static const char json_newline[] = "\n\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+
+static size_t json_writer_write_file(void* ctx, const char* buf, size_t size)
+{
+	return fwrite(buf, 1, size, (FILE*)ctx);
+}
+
+static size_t json_writer_write_fd(void* ctx, const char* buf, size_t size)
+{
+	size_t written = 0;
+	while (written < size)
+	{
+#if defined(_WIN32) || defined(WIN32)
+		int n = _write((int)(intptr_t)ctx, buf + written,
+					   (unsigned)(size - written > INT_MAX ? INT_MAX : size - written));
+#else
+		ssize_t n = write((int)(intptr_t)ctx, buf + written, size - written);
+		// Retry if interrupted by a signal
+		if (n < 0 && errno == EINTR)
+			continue;
+#endif
+		if (n <= 0)
+			break;
+		written += n;
+	}
+	return written;
+}
+
+// Without a write function the output is kept in buf, which grows as needed
+static void json_writer_init(json_writer_t* writer, json_write_func write, void* ctx)
+{
+	writer->write = write;
+	writer->ctx = ctx;
+	writer->size = JSON_WRITER_BUFFER;
+	writer->buf = JSON_MALLOC(writer->size + 1);
+	writer->length = 0;
+	writer->error = 0;
+}
+
+// Passes the buffered output to the write function
+static void json_writer_drain(json_writer_t* writer)
+{
+	if (writer->length && !writer->error && writer->write(writer->ctx, writer->buf, writer->length) != writer->length)
+		writer->error = 1;
+	writer->length = 0;
+}
+
+// Makes room for size more bytes in the buffer
+static void json_writer_reserve(json_writer_t* writer, size_t size)
+{
+	if (writer->length + size <= writer->size)
+		return;
+	if (writer->write)
+		json_writer_drain(writer);
+	if (writer->length + size > writer->size)
+	{
+		while (writer->length + size > writer->size)
+			writer->size *= 2;
+		writer->buf = JSON_REALLOC(writer->buf, writer->size + 1);
+	}
+}
+
+static void json_writer_put(json_writer_t* writer, const char* str, size_t length)
+{
+	// Fill and drain the buffer instead of growing it for long strings
+	while (writer->write && writer->length + length > writer->size)
+	{
+		size_t n = writer->size - writer->length;
+		memcpy(writer->buf + writer->length, str, n);
+		writer->length += n;
+		str += n;
+		length -= n;
+		json_writer_drain(writer);
 	}
+	json_writer_reserve(writer, length);
+	memcpy(writer->buf + writer->length, str, length);
+	writer->length += length;
+}
 
-void json_tostring_internal(JSON* object, struct JSONStringStream* ss, int format, size_t depth)
+// Writes a newline and indents with depth tabs
+static void json_writer_newline(json_writer_t* writer, size_t depth)
 {
-	if (object->type == JSON_TOBJECT || object->type == JSON_TARRAY)
+	const size_t tabs = sizeof json_newline - 2;
+	size_t n = depth < tabs ? depth : tabs;
+	json_writer_put(writer, json_newline, n + 1);
+	// Deeper than the tabs of json_newline
+	for (depth -= n; depth; depth -= n)
+	{
+		n = depth < tabs ? depth : tabs;
+		json_writer_put(writer, json_newline + 1, n);
+	}
+}
+
+// Writes str quoted and escaped
+static void json_writer_string(json_writer_t* writer, const char* str)
+{
+	if (str == NULL)
+	{
+		JSON_MESSAGE("Error writing invalid string");
+		str = "";
+	}
+
+	json_writer_put(writer, "\"", 1);
+	for (;;)
 	{
-		WRITE_NAME;
-		json_ss_write(ss, (object->type == JSON_TOBJECT ? "{" : "["), 0);
-		if (format)
-			json_ss_write(ss, "\n", 0);
+		// Copy the run of characters that are not escaped
+		const char* run = str;
+		while (json_escapes[(unsigned char)*str] == 0)
+			str++;
+		json_writer_put(writer, run, str - run);
+		if (*str == '\0')
+			break;
+
+		unsigned char c = *str++;
+		char e = json_escapes[c];
+		json_writer_reserve(writer, 6);
+		char* out = writer->buf + writer->length;
+		out[0] = '\\';
+		out[1] = e;
+		if (e == 'u')
+		{
+			out[2] = '0';
+			out[3] = '0';
+			out[4] = "0123456789abcdef"[c >> 4];
+			out[5] = "0123456789abcdef"[c & 15];
+			writer->length += 6;
+		}
+		else
+			writer->length += 2;
+	}
+	json_writer_put(writer, "\"", 1);
+}
 
+static void json_writer_value(json_writer_t* writer, JSON* object, int format, size_t depth)
+{
+	JSON_EXPAND(object);
+	// The name of the root is the file that was read
+	if (depth && object->name)
+	{
+		json_writer_string(writer, object->name);
+		json_writer_put(writer, ": ", format ? 2 : 1);
+	}
+
+	if (object->type == JSON_TOBJECT || object->type == JSON_TARRAY)
+	{
+		json_writer_put(writer, object->type == JSON_TOBJECT ? "{" : "[", 1);
 		JSON* cur = object->members;
 		while (cur)
 		{
-			// Format with tabs
 			if (format)
-			{
-				for (size_t i = 0; i < depth + 1; i++)
-				{
-					json_ss_write(ss, "\t", 0);
-				}
-			}
-			json_tostring_internal(cur, ss, format, depth + 1);
+				json_writer_newline(writer, depth + 1);
+			json_writer_value(writer, cur, format, depth + 1);
 			cur = cur->next;
 			if (cur)
-				json_ss_write(ss, (format ? ",\n" : ","), 0);
-		}
-		if (format)
-		{
-			json_ss_write(ss, "\n", 0);
-			for (size_t i = 0; i < depth; i++)
-			{
-				json_ss_write(ss, "\t", 0);
-			}
+				json_writer_put(writer, ",", 1);
 		}
-		json_ss_write(ss, (object->type == JSON_TOBJECT ? "}" : "]"), 0);
+		if (format && object->members)
+			json_writer_newline(writer, depth);
+		json_writer_put(writer, object->type == JSON_TOBJECT ? "}" : "]", 1);
 	}
 	else if (object->type == JSON_TSTRING)
 	{
-		WRITE_NAME;
-		json_ss_write(ss, "\"", 0);
-
-		json_ss_write(ss, object->stringval, 1);
-		json_ss_write(ss, "\"", 0);
+		json_writer_string(writer, object->stringval);
 	}
 	else if (object->type == JSON_TNUMBER)
 	{
-		WRITE_NAME;
-		char buf[128];
-		json_ftos(object->numval, buf, 5);
-		json_ss_write(ss, buf, 0);
+		json_writer_reserve(writer, 32);
+		writer->length += json_ftos(object->numval, writer->buf + writer->length);
 	}
 	else if (object->type == JSON_TBOOL)
 	{
-		WRITE_NAME;
-		json_ss_write(ss, object->numval ? "true" : "false", 0);
+		if (object->numval)
+			json_writer_put(writer, "true", 4);
+		else
+			json_writer_put(writer, "false", 5);
 	}
 	else if (object->type == JSON_TNULL)
 	{
-		WRITE_NAME;
-		json_ss_write(ss, "null", 0);
+		json_writer_put(writer, "null", 4);
 	}
 }
 
-char* json_tostring(JSON* object, int format)
+json_writer_t* json_writer_create(json_write_func write, void* ctx)
+{
+	json_writer_t* writer = JSON_MALLOC(sizeof(json_writer_t));
+	json_writer_init(writer, write, ctx);
+	return writer;
+}
+
+json_writer_t* json_writer_create_file(FILE* fp)
+{
+	return json_writer_create(json_writer_write_file, fp);
+}
+
+json_writer_t* json_writer_create_fd(int fd)
+{
+	return json_writer_create(json_writer_write_fd, (void*)(intptr_t)fd);
+}
+
+void json_writer_write(json_writer_t* writer, JSON* object, int format)
+{
+	json_writer_value(writer, object, format, 0);
+}
+
+void json_writer_raw(json_writer_t* writer, const char* str, size_t length)
+{
+	json_writer_put(writer, str, length);
+}
+
+int json_writer_flush(json_writer_t* writer)
 {
-	struct JSONStringStream ss = {0};
+	json_writer_drain(writer);
+	return writer->error ? -1 : 0;
+}
+
+int json_writer_destroy(json_writer_t* writer)
+{
+	int result = json_writer_flush(writer);
+	JSON_FREE(writer->buf);
+	JSON_FREE(writer);
+	return result;
+}
 
-	json_tostring_internal(object, &ss, format, 0);
-	return ss.str;
+char* json_tostring(JSON* object, int format)
+{
+	// The buffer grows to hold the whole string and is returned
+	json_writer_t writer;
+	json_writer_init(&writer, NULL, NULL);
+	json_writer_value(&writer, object, format, 0);
+	writer.buf[writer.length] = '\0';
+	return writer.buf;
 }
 
 int json_writefile(JSON* object, const char* filepath, int format)
@@ -972,18 +2157,27 @@ int json_writefile(JSON* object, const char* filepath, int format)
 		JSON_MESSAGE(msg);
 		return -2;
 	}
-	struct JSONStringStream ss = {0};
-	json_tostring_internal(object, &ss, format, 0);
-	fwrite(ss.str, 1, ss.length, fp);
+	json_writer_t writer;
+	json_writer_init(&writer, json_writer_write_file, fp);
+	json_writer_value(&writer, object, format, 0);
+	int result = json_writer_flush(&writer);
+	JSON_FREE(writer.buf);
 
-	// Exit
-	JSON_FREE(ss.str);
-	fclose(fp);
+	if (fclose(fp) || result)
+	{
+		char msg[512];
+		snprintf(msg, sizeof msg, "Failed to write file %s", filepath);
+		JSON_MESSAGE(msg);
+		return -3;
+	}
 	return 0;
 }
 
-JSON* json_loadfile(const char* filepath)
+// Opens a file for reading and stores its size
+// Returns NULL if the file could not be opened
+static FILE* json_open(const char* filepath, size_t* size)
 {
+	*size = 0;
 	FILE* fp;
 	fp = fopen(filepath, "r");
 	if (fp == NULL)
@@ -993,29 +2187,99 @@ JSON* json_loadfile(const char* filepath)
 		JSON_MESSAGE(msg);
 		return NULL;
 	}
-
-	// Read the file into a string
-	char* buf = NULL;
-	size_t size;
 	fseek(fp, 0L, SEEK_END);
-	size = ftell(fp);
-	buf = JSON_MALLOC(size);
+	*size = ftell(fp);
 	fseek(fp, 0L, SEEK_SET);
-	fread(buf, 1, size, fp);
+	return fp;
+}
+
+// Reads the rest of the file into buf, which holds at least size + 1 bytes, and closes it
+static void json_read_file(FILE* fp, char* buf, size_t size)
+{
+	// Less may be read than the size in text mode
+	size = fread(buf, 1, size, fp);
+	buf[size] = '\0';
 	fclose(fp);
+}
 
-	JSON* root = json_create_empty();
-	if (json_load(root, buf) == NULL)
+// Maps a file read only, or reads it if it can not be mapped, followed by a null terminator
+// Stores the size and whether it was mapped for json_unmap_file
+// Returns NULL if the file could not be opened
+static char* json_map_file(const char* filepath, size_t* size, int* mapped)
+{
+	*mapped = 0;
+#ifdef JSON_MMAP
+	int fd = open(filepath, O_RDONLY);
+	struct stat st;
+	if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
 	{
-		char msg[512];
-		snprintf(msg, sizeof msg, "File %s contains none or invalid json data", filepath);
-		JSON_MESSAGE(msg);
-		JSON_FREE(root);
-		JSON_FREE(buf);
+		// The end of the last page of a mapped file reads as zero, reserve another zero page if the file ends at a page
+		size_t page = sysconf(_SC_PAGESIZE);
+		size_t length = (st.st_size / page + 1) * page;
+		char* buf = mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buf != MAP_FAILED && mmap(buf, st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+		{
+			munmap(buf, length);
+			buf = MAP_FAILED;
+		}
+		if (buf != MAP_FAILED)
+		{
+#ifdef MADV_SEQUENTIAL
+			madvise(buf, st.st_size, MADV_SEQUENTIAL);
+#endif
+			close(fd);
+			*size = st.st_size;
+			*mapped = 1;
+			return buf;
+		}
+	}
+	if (fd >= 0)
+		close(fd);
+#endif
+	FILE* fp = json_open(filepath, size);
+	if (fp == NULL)
 		return NULL;
+	char* buf = JSON_MALLOC(*size + 1);
+	json_read_file(fp, buf, *size);
+	return buf;
+}
+
+static void json_unmap_file(char* buf, size_t size, int mapped)
+{
+#ifdef JSON_MMAP
+	if (mapped)
+	{
+		size_t page = sysconf(_SC_PAGESIZE);
+		munmap(buf, (size / page + 1) * page);
+		return;
 	}
-	root->name = strduplicate(filepath);
+#endif
+	(void)size;
+	(void)mapped;
 	JSON_FREE(buf);
+}
+
+JSON* json_loadfile(const char* filepath)
+{
+	// Map the file as a string, strings are copied out by the parser
+	size_t size;
+	int mapped;
+	char* buf = json_map_file(filepath, &size, &mapped);
+	if (buf == NULL)
+		return NULL;
+
+	JSON* root = json_create_empty();
+	if (json_load(root, buf) == NULL)
+	{
+		char msg[512];
+		snprintf(msg, sizeof msg, "File %s contains none or invalid json data", filepath);
+		JSON_MESSAGE(msg);
+		json_destroy(root);
+		json_unmap_file(buf, size, mapped);
+		return NULL;
+	}
+	root->name = strduplicate(filepath);
+	json_unmap_file(buf, size, mapped);
 	return root;
 }
 JSON* json_loadstring(char* str)
@@ -1024,21 +2288,204 @@ JSON* json_loadstring(char* str)
 	if (json_load(root, str) == NULL)
 	{
 		JSON_MESSAGE("String contains none or invalid json data");
-		JSON_FREE(root);
+		json_destroy(root);
 		return NULL;
 	}
 	return root;
 }
 
-char* json_load(JSON* object, char* str)
+JSON* json_loadfile_insitu(const char* filepath)
+{
+	size_t size;
+	FILE* fp = json_open(filepath, &size);
+	if (fp == NULL)
+		return NULL;
+
+	// Read the file behind the root object so that they are freed together
+	JSON* root = JSON_MALLOC(sizeof(JSON) + size + 1);
+	char* buf = (char*)(root + 1);
+	json_read_file(fp, buf, size);
+
+	root->flags = 0;
+	root->prev = NULL;
+#ifdef JSON_MEMPOOL
+	root->doc = NULL;
+#endif
+	if (json_load_insitu(root, buf) == NULL)
+	{
+		char msg[512];
+		snprintf(msg, sizeof msg, "File %s contains none or invalid json data", filepath);
+		JSON_MESSAGE(msg);
+		json_destroy(root);
+		return NULL;
+	}
+	root->name = strduplicate(filepath);
+	return root;
+}
+
+JSON* json_loadstring_insitu(char* str)
+{
+	JSON* root = json_create_empty();
+	if (json_load_insitu(root, str) == NULL)
+	{
+		JSON_MESSAGE("String contains none or invalid json data");
+		json_destroy(root);
+		return NULL;
+	}
+	return root;
+}
+
+struct json_lines
+{
+	const char* buf;
+	size_t size;
+	json_line_func callback;
+	void* ctx;
+	// The start of the next chunk to parse
+	size_t next;
+#ifdef JSON_THREADS
+	pthread_mutex_t lock;
+#endif
+};
+
+struct json_lines_worker
+{
+	struct json_lines* lines;
+	// How many records were passed to the callback
+	size_t count;
+#ifdef JSON_THREADS
+	pthread_t thread;
+#endif
+};
+
+// Parses the lines starting in each claimed chunk, a line may end in the next chunk
+static void* json_lines_work(void* arg)
+{
+	struct json_lines_worker* worker = arg;
+	struct json_lines* lines = worker->lines;
+	const char* buf = lines->buf;
+	for (;;)
+	{
+#ifdef JSON_THREADS
+		pthread_mutex_lock(&lines->lock);
+#endif
+		size_t start = lines->next;
+		if (start < lines->size)
+			lines->next += JSON_LINES_CHUNK;
+#ifdef JSON_THREADS
+		pthread_mutex_unlock(&lines->lock);
+#endif
+		if (start >= lines->size)
+			break;
+		size_t end = start + JSON_LINES_CHUNK < lines->size ? start + JSON_LINES_CHUNK : lines->size;
+
+		// The line the chunk starts within belongs to the previous chunk
+		const char* line = buf + start;
+		if (start > 0 && buf[start - 1] != '\n')
+		{
+			line = memchr(line, '\n', lines->size - start);
+			line = line ? line + 1 : buf + lines->size;
+		}
+		while (line < buf + end)
+		{
+			const char* line_end = memchr(line, '\n', buf + lines->size - line);
+			if (line_end == NULL)
+				line_end = buf + lines->size;
+
+			// Skip blank lines
+			char* str = json_skip_whitespace((char*)line);
+			if (str < line_end)
+			{
+				JSON* record = json_create_empty();
+				// The input is mapped read only, which the parser does not write to without insitu
+				char* tmp = json_load(record, str);
+				// Nothing but whitespace may follow the record on its line
+				if (tmp == NULL || tmp > line_end || json_skip_whitespace(tmp) < line_end)
+				{
+					char msg[512];
+					snprintf(msg, sizeof msg, "Line at %zu contains none or invalid json data", (size_t)(line - buf));
+					JSON_MESSAGE(msg);
+					json_destroy(record);
+				}
+				else
+				{
+					lines->callback(record, line - buf, lines->ctx);
+					worker->count++;
+				}
+			}
+			line = line_end + 1;
+		}
+	}
+	return NULL;
+}
+
+long json_load_lines(const char* filepath, int nthreads, json_line_func callback, void* ctx)
+{
+	struct json_lines lines;
+	int mapped;
+	char* buf = json_map_file(filepath, &lines.size, &mapped);
+	if (buf == NULL)
+		return -1;
+	lines.buf = buf;
+	lines.callback = callback;
+	lines.ctx = ctx;
+	lines.next = 0;
+
+	// No more threads than chunks
+	size_t chunks = lines.size / JSON_LINES_CHUNK + 1;
+	size_t count = nthreads < 1 ? 1 : (size_t)nthreads < chunks ? (size_t)nthreads : chunks;
+#ifndef JSON_THREADS
+	count = 1;
+#endif
+	struct json_lines_worker* workers = JSON_MALLOC(count * sizeof(struct json_lines_worker));
+	for (size_t i = 0; i < count; i++)
+	{
+		workers[i].lines = &lines;
+		workers[i].count = 0;
+	}
+
+	// The calling thread is the first worker
+#ifdef JSON_THREADS
+	pthread_mutex_init(&lines.lock, NULL);
+	for (size_t i = 1; i < count; i++)
+	{
+		if (pthread_create(&workers[i].thread, NULL, json_lines_work, &workers[i]))
+		{
+			JSON_MESSAGE("Failed to create thread for json_load_lines");
+			count = i;
+		}
+	}
+#endif
+	json_lines_work(&workers[0]);
+
+	long total = workers[0].count;
+#ifdef JSON_THREADS
+	for (size_t i = 1; i < count; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].count;
+	}
+	pthread_mutex_destroy(&lines.lock);
+#endif
+	JSON_FREE(workers);
+	json_unmap_file(buf, lines.size, mapped);
+	return total;
+}
+
+// Loads object from str, with the strings pointing into str if insitu is 1
+// The members are allocated from doc if not NULL
+static char* json_load_internal(JSON* object, char* str, int insitu, json_doc_t* doc)
 {
 	object->type = JSON_TINVALID;
 
+	object->flags &= JSON_FARENA;
 	object->name = NULL;
 	object->stringval = NULL;
 	object->numval = 0;
 	object->members = NULL;
 	object->count = 0;
+	object->index = NULL;
+	object->tape = NULL;
 	object->next = NULL;
 
 	// Object
@@ -1051,15 +2498,18 @@ char* json_load(JSON* object, char* str)
 		for (; *str != '\0'; str++)
 		{
 			// Skip whitespace
-			if (JSON_IS_WHITESPACE(*str))
-			{
-				continue;
-			}
+			str = json_skip_whitespace(str);
+			if (*str == '\0')
+				break;
+
+			// Empty object
+			if (*str == '}' && object->members == NULL)
+				return str + 1;
 
 			// Read the name
 			if (*str == '"')
 			{
-				char* tmp = json_read_quote(str, &tmp_name);
+				char* tmp = insitu ? json_read_quote_insitu(str, &tmp_name) : json_read_quote(str, &tmp_name);
 				if (tmp == NULL)
 				{
 					char msg[512];
@@ -1067,24 +2517,21 @@ char* json_load(JSON* object, char* str)
 					JSON_MESSAGE(msg);
 					break;
 				}
-				str = tmp;
+				str = json_skip_whitespace(tmp);
 			}
 
 			// Next side of key value pair
 			// After reading the key, recursively load the value
-			if (*str == ':')
+			if (*str == ':' && tmp_name)
 			{
-				// Jump over ':'
-				str++;
-				// Skip all whitespace after ':'
-				while (*str == ' ' || *str == '\t' || *str == '\n')
-					str++;
+				// Jump over ':' and all whitespace after it
+				str = json_skip_whitespace(str + 1);
 
 				// Load the json with what is after the ':'
-				JSON* new_object = json_create_empty();
+				JSON* new_object = json_alloc(doc);
 
 				// Load the child element from the string and skip over that string
-				char* tmp_buf = json_load(new_object, str);
+				char* tmp_buf = json_load_internal(new_object, str, insitu, doc);
 
 				if (tmp_buf == NULL || new_object->type == JSON_TINVALID)
 				{
@@ -1092,25 +2539,36 @@ char* json_load(JSON* object, char* str)
 					snprintf(msg, sizeof msg, "Invalid json %.15s", str);
 					JSON_MESSAGE(msg);
 					json_destroy(new_object);
+					// The name is not linked yet and is only owned when copied
+					if (!insitu)
+						JSON_FREE(tmp_name);
+					return NULL;
+				}
+				str = tmp_buf;
+
+				// Insert member
+				if (insitu)
+				{
+					new_object->name = tmp_name;
+					new_object->flags |= JSON_FBORROWED_NAME;
+					json_link_member(object, new_object);
 				}
 				else
 				{
-					str = tmp_buf;
+					json_add_member(object, tmp_name, new_object);
+					JSON_FREE(tmp_name);
 				}
-
-				// Insert member
-				json_add_member(object, tmp_name, new_object);
-				JSON_FREE(tmp_name);
+				// The next member needs its own key
+				tmp_name = NULL;
 
 				// Skip to next comma or quit
 				for (; *str != '\0'; str++)
 				{
-					if (*str == ',')
+					str = json_skip_whitespace(str);
+					if (*str == ',' || *str == '\0')
 						break;
 					if (*str == '}')
 						return str + 1;
-					if (JSON_IS_WHITESPACE(*str))
-						continue;
 					char msg[512];
 					snprintf(msg, sizeof msg, "Unexpected character before comma %.15s", str);
 					JSON_MESSAGE(msg);
@@ -1124,10 +2582,12 @@ char* json_load(JSON* object, char* str)
 				continue;
 			}
 
+			if (!insitu)
+				JSON_FREE(tmp_name);
 			char msg[512];
 			snprintf(msg, sizeof msg, "Expected property before \"%.15s\"", str);
 			JSON_MESSAGE(msg);
-			return str;
+			return NULL;
 		}
 	}
 
@@ -1140,8 +2600,9 @@ char* json_load(JSON* object, char* str)
 		for (; *str != '\0'; str++)
 		{
 			// Skip whitespace
-			if (JSON_IS_WHITESPACE(*str))
-				continue;
+			str = json_skip_whitespace(str);
+			if (*str == '\0')
+				break;
 
 			// The end of the array
 			if (*str == ']')
@@ -1150,19 +2611,17 @@ char* json_load(JSON* object, char* str)
 			// Read elements of array
 
 			{
-				JSON* new_object = json_create_empty();
+				JSON* new_object = json_alloc(doc);
 
 				// Load the element from the string
-				char* tmp_buf = json_load(new_object, str);
+				char* tmp_buf = json_load_internal(new_object, str, insitu, doc);
 				if (tmp_buf == NULL)
 				{
 					JSON_MESSAGE("Invalid json");
 					json_destroy(new_object);
+					return NULL;
 				}
-				else
-				{
-					str = tmp_buf;
-				}
+				str = tmp_buf;
 
 				// Insert element at end
 				json_add_element(object, new_object);
@@ -1170,17 +2629,21 @@ char* json_load(JSON* object, char* str)
 				// Skip to next comma or quit
 				for (; *str != '\0'; str++)
 				{
-					if (*str == ',')
+					str = json_skip_whitespace(str);
+					if (*str == ',' || *str == '\0')
 						break;
 					if (*str == ']')
 						return str + 1;
-					if (JSON_IS_WHITESPACE(*str))
-						continue;
 					char msg[512];
 					snprintf(msg, sizeof msg, "Unexpected character before comma \"%.15s\"\n", str);
 					JSON_MESSAGE(msg);
 					return str;
 				}
+				if (*str == '\0')
+				{
+					JSON_MESSAGE("Expected comma before end of string");
+					return NULL;
+				}
 			}
 
 			// The end of the array
@@ -1195,6 +2658,11 @@ char* json_load(JSON* object, char* str)
 	else if (str[0] == '"')
 	{
 		object->type = JSON_TSTRING;
+		if (insitu)
+		{
+			object->flags |= JSON_FBORROWED_STRING;
+			return json_read_quote_insitu(str, &object->stringval);
+		}
 		return json_read_quote(str, &object->stringval);
 	}
 	// Number
@@ -1229,267 +2697,1000 @@ char* json_load(JSON* object, char* str)
 	return NULL;
 }
 
-void json_destroy_member(JSON* object, const char* name)
+char* json_load(JSON* object, char* str)
 {
-	JSON* member = json_pop_member(object, name);
-	if (member)
-		json_destroy(member);
+	return json_load_internal(object, str, 0, NULL);
 }
 
-void json_destroy_element(JSON* object, int pos)
+char* json_load_insitu(JSON* object, char* str)
 {
-	JSON* element = json_pop_element(object, pos);
-	if (element)
-		json_destroy(element);
+	return json_load_internal(object, str, 1, NULL);
 }
 
-// Removes and returns a member from the json structure
-JSON* json_pop_member(JSON* object, const char* name)
+// Returns the character after the end quote of the string at str, or NULL if it is not terminated
+// Escapes and control characters are checked when the string is decoded
+static char* json_tape_string(char* str)
 {
-	if (object->type != JSON_TOBJECT)
-		return NULL;
-	JSON* cur = object->members;
-	JSON* prev = NULL;
-	while (cur && strcmp(cur->name, name) != 0)
-	{
-		prev = cur;
-		cur = cur->next;
-	}
-	// Name was not found
-	if (cur == NULL)
+	str++;
+	for (;;)
 	{
-		return NULL;
+		str = json_scan_string(str);
+		if (*str == '"')
+			return str + 1;
+		if (*str == '\0' || (*str == '\\' && str[1] == '\0'))
+			return NULL;
+		str += *str == '\\' ? 2 : 1;
 	}
+}
 
-	object->count--;
-	// Handle first item
-	// Set to the following item or NULL
-	if (prev == NULL)
-	{
-		object->members = cur->next;
-		// The previous item of the first item points to the tail and list isn't empty
-		if (object->members)
-			object->members->prev = cur->prev;
-		cur->next = NULL;
-		cur->prev = NULL;
-		return cur;
-	}
-	// End
-	if (cur->next == NULL)
+// Returns the character after the number, bool or null at str, or NULL if it is none
+// Numbers are checked when decoded
+static char* json_tape_scalar(char* str)
+{
+	if ((*str >= '0' && *str <= '9') || *str == '-' || *str == '+')
 	{
-		prev->next = NULL;
-		// Update first element's prev point to tail
-		object->members->prev = prev;
-		cur->next = NULL;
-		cur->prev = NULL;
-		return cur;
+		while ((*str >= '0' && *str <= '9') || *str == '-' || *str == '+' || *str == '.' || *str == 'e' || *str == 'E')
+			str++;
+		return str;
 	}
-
-	// Middle
-	prev->next = cur->next;
-	cur->next->prev = cur->prev;
-	cur->next = NULL;
-	cur->prev = NULL;
-	return cur;
+	if (strncmp(str, "true", 4) == 0 || strncmp(str, "null", 4) == 0)
+		return str + 4;
+	if (strncmp(str, "false", 5) == 0)
+		return str + 5;
+	return NULL;
 }
 
-// Removes and returns an element from the json structure
-JSON* json_pop_element(JSON* object, int pos)
+// Records the structure of the value at str on a tape, matching every bracket on the way
+// Returns the character after the value, or NULL if the structure is invalid
+static char* json_tape_build(char* str, struct json_tape** out)
 {
-	if (object->type != JSON_TARRAY)
-		return NULL;
-
-	// Special tail case
-	if (pos < 0)
+	struct json_tape* tape = NULL;
+	size_t size = 0, allocated = 0;
+	// The tape entries of the open objects and arrays
+	size_t* stack = NULL;
+	size_t depth = 0, stack_size = 0;
+	while (str)
 	{
-		JSON* tail = object->members->prev;
-		object->members->prev = tail->prev;
-		tail->prev = NULL;
-		return tail;
-	}
+		str = json_skip_whitespace(str);
+		if (size + 2 > allocated)
+		{
+			allocated = allocated ? allocated * 2 : 64;
+			tape = JSON_REALLOC(tape, allocated * sizeof(struct json_tape));
+		}
 
-	JSON* cur = object->members;
-	JSON* prev = NULL;
-	int idx = 0;
-	// Loop to either index or end of list
-	while (cur != NULL && idx != pos)
-	{
-		++idx;
-		prev = cur;
-		cur = cur->next;
+		// The key of a member
+		if (depth && *tape[stack[depth - 1]].src == '{')
+		{
+			tape[size].src = str;
+			tape[size++].size = 1;
+			str = *str == '"' ? json_tape_string(str) : NULL;
+			if (str)
+				str = json_skip_whitespace(str);
+			if (str == NULL || *str != ':')
+			{
+				str = NULL;
+				break;
+			}
+			str = json_skip_whitespace(str + 1);
+		}
+
+		tape[size].src = str;
+		tape[size].size = 1;
+		if (*str == '{' || *str == '[')
+		{
+			if (depth == stack_size)
+			{
+				stack_size = stack_size ? stack_size * 2 : 16;
+				stack = JSON_REALLOC(stack, stack_size * sizeof(size_t));
+			}
+			stack[depth++] = size++;
+			char* next = json_skip_whitespace(str + 1);
+			// Not empty, read the first child
+			if (*next != (*str == '{' ? '}' : ']'))
+			{
+				str = next;
+				continue;
+			}
+			str = next;
+		}
+		else
+		{
+			str = *str == '"' ? json_tape_string(str) : json_tape_scalar(str);
+			size++;
+		}
+
+		// Close the finished objects and arrays, or continue after a comma
+		while (str && depth)
+		{
+			str = json_skip_whitespace(str);
+			size_t open = stack[depth - 1];
+			if (*str == ',' && size > open + 1)
+			{
+				str++;
+				break;
+			}
+			if (*str != (*tape[open].src == '{' ? '}' : ']'))
+			{
+				str = NULL;
+				break;
+			}
+			tape[open].size = size - open;
+			depth--;
+			str++;
+		}
+		if (depth == 0)
+			break;
 	}
 
-	// Index was not found
-	if (cur == NULL)
+	JSON_FREE(stack);
+	if (str == NULL)
 	{
+		JSON_FREE(tape);
 		return NULL;
 	}
-	object->count--;
-	// Handle first item
-	// Set to the following item or NULL
-	if (prev == NULL)
-	{
-		object->members = cur->next;
-		// Set tail pointer
-		// List isn't empty
-		if (object->members)
-			object->members->prev = cur->prev;
-		cur->next = NULL;
-		cur->prev = NULL;
-		return cur;
-	}
+	*out = tape;
+	return str;
+}
 
-	// End
-	if (cur->next == NULL)
+// Initializes object as the lazy object of a value on the tape
+static void json_tape_init(JSON* object, struct json_tape* entry)
+{
+	object->type = JSON_TINVALID;
+	object->flags = JSON_FLAZY;
+#ifdef JSON_MEMPOOL
+	object->doc = NULL;
+#endif
+	object->name = NULL;
+	object->stringval = NULL;
+	object->numval = 0;
+	object->members = NULL;
+	object->count = 0;
+	object->index = NULL;
+	object->tape = entry;
+	object->prev = NULL;
+	object->next = NULL;
+	switch (*entry->src)
 	{
-		cur->prev->next = NULL;
-		// Update first element's prev point to tail
-		object->members->prev = cur->prev;
-		cur->next = NULL;
-		cur->prev = NULL;
-		return cur;
+	case '{':
+		object->type = JSON_TOBJECT;
+		break;
+	case '[':
+		object->type = JSON_TARRAY;
+		break;
+	case '"':
+		object->type = JSON_TSTRING;
+		break;
+	case 't':
+	case 'f':
+		object->type = JSON_TBOOL;
+		object->numval = *entry->src == 't';
+		object->flags = 0;
+		break;
+	case 'n':
+		object->type = JSON_TNULL;
+		object->flags = 0;
+		break;
+	default:
+		object->type = JSON_TNUMBER;
+		break;
 	}
+}
 
-	// Middle
-	prev->next = cur->next;
-	cur->next->prev = cur->prev;
-	cur->next = NULL;
-	cur->prev = NULL;
-	return cur;
+static JSON* json_tape_object(struct json_tape* entry)
+{
+	JSON* object = JSON_MALLOC(sizeof(JSON));
+	json_tape_init(object, entry);
+	return object;
 }
 
-void json_add_member(JSON* object, const char* name, JSON* value)
+static void json_expand(JSON* object)
 {
-	value->next = NULL;
-	value->prev = NULL;
-	if (object->type != JSON_TOBJECT)
+	object->flags &= ~JSON_FLAZY;
+	struct json_tape* entry = object->tape;
+	if (object->type == JSON_TSTRING)
 	{
-		json_set_invalid(object);
+		object->flags |= JSON_FBORROWED_STRING;
+		if (json_read_quote_insitu(entry->src, &object->stringval) == NULL)
+			object->stringval = NULL;
+		return;
 	}
-	object->type = JSON_TOBJECT;
+	if (object->type == JSON_TNUMBER)
+	{
+		json_stof(entry->src, &object->numval);
+		return;
+	}
+	if (object->type != JSON_TOBJECT && object->type != JSON_TARRAY)
+		return;
 
-	value->name = strduplicate(name);
+	// The children are created lazy in turn, their subtrees are skipped by the size of their entries
+	struct json_tape* end = entry + entry->size;
+	for (struct json_tape* cur = entry + 1; cur < end; cur += cur->size)
+	{
+		if (object->type == JSON_TARRAY)
+		{
+			json_list_insert(object, NULL, json_tape_object(cur));
+			continue;
+		}
+		char* name;
+		char* tmp = json_read_quote_insitu(cur->src, &name);
+		cur++;
+		if (tmp == NULL)
+			continue;
+		JSON* member = json_tape_object(cur);
+		member->name = name;
+		member->flags |= JSON_FBORROWED_NAME;
+		json_link_member(object, member);
+	}
+}
 
-	// If list is empty
-	if (object->members == NULL)
+JSON* json_loadstring_lazy(char* str)
+{
+	struct json_tape* tape;
+	if (json_tape_build(str, &tape) == NULL)
 	{
-		object->members = value;
-		return;
+		JSON_MESSAGE("String contains none or invalid json data");
+		return NULL;
 	}
+	JSON* root = json_tape_object(tape);
+	root->flags |= JSON_FTAPE;
+	return root;
+}
 
-	// Traverse to end of array and look for duplicate
-	JSON* cur = object->members;
-	while (cur->next && strcmp(cur->name, name) != 0)
+JSON* json_loadfile_lazy(const char* filepath)
+{
+	size_t size;
+	FILE* fp = json_open(filepath, &size);
+	if (fp == NULL)
+		return NULL;
+
+	// Read the file behind the root object so that they are freed together
+	JSON* root = JSON_MALLOC(sizeof(JSON) + size + 1);
+	char* buf = (char*)(root + 1);
+	json_read_file(fp, buf, size);
+	struct json_tape* tape;
+	if (json_tape_build(buf, &tape) == NULL)
 	{
-		cur = cur->next;
+		char msg[512];
+		snprintf(msg, sizeof msg, "File %s contains none or invalid json data", filepath);
+		JSON_MESSAGE(msg);
+		JSON_FREE(root);
+		return NULL;
 	}
+	json_tape_init(root, tape);
+	root->flags |= JSON_FTAPE;
+	root->name = strduplicate(filepath);
+	return root;
+}
 
-	// No duplicate, insert at tail
-	if (cur->next == NULL)
+static JSON* json_alloc(json_doc_t* doc)
+{
+#ifdef JSON_MEMPOOL
+	if (doc)
 	{
-		object->count++;
-		cur->next = value;
-		value->prev = cur;
-		// Update first element's prev point to new tail
-		object->members->prev = value;
-		return;
+		JSON* object = mempool_arena_alloc(&doc->arena, sizeof(JSON), sizeof(double));
+		object->type = JSON_TINVALID;
+		object->flags = JSON_FARENA;
+		object->doc = doc;
+		object->name = NULL;
+		object->stringval = NULL;
+		object->numval = 0;
+		object->members = NULL;
+		object->count = 0;
+		object->index = NULL;
+		object->tape = NULL;
+		object->prev = NULL;
+		object->next = NULL;
+		return object;
 	}
+#endif
+	(void)doc;
+	return json_create_empty();
+}
 
-	// Duplicate, replace
-	value->next = cur->next;
-	value->prev = cur->prev;
+static char* json_doc_strdup(json_doc_t* doc, const char* str)
+{
+#ifdef JSON_MEMPOOL
+	if (doc)
+	{
+		const size_t lstr = strlen(str);
+		char* dup = mempool_arena_alloc(&doc->arena, lstr + 1, 1);
+		memcpy(dup, str, lstr + 1);
+		return dup;
+	}
+#endif
+	(void)doc;
+	return strduplicate(str);
+}
+
+static void json_adopt(JSON* object, JSON* child)
+{
+#ifdef JSON_MEMPOOL
+	if (object->doc && !(child->flags & JSON_FARENA))
+		object->doc->foreign = 1;
+#endif
+	(void)object;
+	(void)child;
+}
 
-	// Handle end
-	// Update tail
-	if (cur->next == NULL)
+#ifdef JSON_MEMPOOL
+json_doc_t* json_doc_create()
+{
+	json_doc_t* doc = JSON_MALLOC(sizeof(json_doc_t));
+	doc->arena = MEMPOOL_ARENA_INIT(JSON_DOC_BLOCK);
+	doc->foreign = 0;
+	doc->root = json_alloc(doc);
+	return doc;
+}
+
+// Parses the source of doc in-situ, destroys doc if invalid
+static json_doc_t* json_doc_parse(json_doc_t* doc, char* buf)
+{
+	if (json_load_internal(doc->root, buf, 1, doc) == NULL)
 	{
-		object->members->prev = value;
+		json_doc_destroy(doc);
+		return NULL;
 	}
-	// Update the prev item's next pointer
-	// Not beginning of list
-	if (cur->prev->next)
+	return doc;
+}
+
+json_doc_t* json_doc_loadfile(const char* filepath)
+{
+	size_t size;
+	FILE* fp = json_open(filepath, &size);
+	if (fp == NULL)
+		return NULL;
+
+	json_doc_t* doc = json_doc_create();
+	char* buf = mempool_arena_alloc(&doc->arena, size + 1, 1);
+	json_read_file(fp, buf, size);
+	if (json_doc_parse(doc, buf) == NULL)
 	{
-		cur->prev->next = value;
+		char msg[512];
+		snprintf(msg, sizeof msg, "File %s contains none or invalid json data", filepath);
+		JSON_MESSAGE(msg);
+		return NULL;
 	}
-	// Handle beginning of empty list
-	else
+	doc->root->name = json_doc_strdup(doc, filepath);
+	doc->root->flags |= JSON_FBORROWED_NAME;
+	return doc;
+}
+
+json_doc_t* json_doc_loadstring(const char* str)
+{
+	json_doc_t* doc = json_doc_create();
+	if (json_doc_parse(doc, json_doc_strdup(doc, str)) == NULL)
 	{
-		object->members = value;
-		// Link pointer to tail to itself
-		value->prev = value;
+		JSON_MESSAGE("String contains none or invalid json data");
+		return NULL;
 	}
-	json_destroy(cur);
-	return;
+	return doc;
 }
 
-void json_insert_element(JSON* object, int pos, JSON* element)
+json_doc_t* json_doc_loadstring_insitu(char* str)
 {
-	element->next = NULL;
-	element->prev = NULL;
-	if (object->type != JSON_TARRAY)
+	json_doc_t* doc = json_doc_create();
+	if (json_doc_parse(doc, str) == NULL)
 	{
-		json_set_invalid(object);
+		JSON_MESSAGE("String contains none or invalid json data");
+		return NULL;
 	}
-	object->type = JSON_TARRAY;
-	object->count++;
+	return doc;
+}
 
-	// List is empty
-	if (object->members == NULL)
+JSON* json_doc_root(json_doc_t* doc)
+{
+	return doc->root;
+}
+
+JSON* json_doc_create_empty(json_doc_t* doc)
+{
+	return json_alloc(doc);
+}
+
+void json_doc_destroy(json_doc_t* doc)
+{
+	// Only the objects not from the arena need to be found
+	if (doc->foreign)
+		json_destroy(doc->root);
+	mempool_arena_destroy(&doc->arena);
+	JSON_FREE(doc);
+}
+#endif
+
+// States of the reader, what is expected next
+// A value, at the top level also the end of input
+#define JSON_RS_VALUE 0
+// A value or the end of an empty array
+#define JSON_RS_ELEMENT 1
+// A key or the end of an empty object
+#define JSON_RS_MEMBER 2
+// A key after a comma
+#define JSON_RS_KEY 3
+#define JSON_RS_COLON 4
+// A comma or the end of the container after a value
+#define JSON_RS_NEXT 5
+
+struct json_reader_t
+{
+	json_read_func read;
+	void* ctx;
+	// The buffered input from pos to end is not consumed, buf[end] is always the null terminator
+	char* buf;
+	size_t pos;
+	size_t end;
+	// The allocated size of buf without the terminator
+	size_t size;
+	// Set when read returned 0 or by json_reader_finish
+	int eof;
+	// How much input was dropped from the beginning of buf
+	size_t offset;
+	// The characters of an unfinished string that have already been scanned
+	size_t scanned;
+
+	int state;
+	// The open containers, 1 for an object and 0 for an array
+	char* stack;
+	size_t depth;
+	size_t stack_size;
+
+	// The last token and its value
+	int token;
+	char* string;
+	size_t length;
+	double number;
+};
+
+static size_t json_reader_read_file(void* ctx, char* buf, size_t size)
+{
+	return fread(buf, 1, size, (FILE*)ctx);
+}
+
+static size_t json_reader_read_fd(void* ctx, char* buf, size_t size)
+{
+#if defined(_WIN32) || defined(WIN32)
+	int n = _read((int)(intptr_t)ctx, buf, (unsigned)(size > INT_MAX ? INT_MAX : size));
+#else
+	ssize_t n;
+	// Retry if interrupted by a signal
+	do
 	{
-		object->members = element;
-		// Tail points to itself
-		element->prev = element;
-		element->next = NULL;
-		return;
+		n = read((int)(intptr_t)ctx, buf, size);
+	} while (n < 0 && errno == EINTR);
+#endif
+	return n < 0 ? 0 : (size_t)n;
+}
+
+json_reader_t* json_reader_create(json_read_func read, void* ctx)
+{
+	json_reader_t* reader = JSON_MALLOC(sizeof(json_reader_t));
+	reader->read = read;
+	reader->ctx = ctx;
+	reader->size = JSON_READER_BUFFER;
+	reader->buf = JSON_MALLOC(reader->size + 1);
+	reader->buf[0] = '\0';
+	reader->pos = 0;
+	reader->end = 0;
+	reader->eof = 0;
+	reader->offset = 0;
+	reader->scanned = 0;
+	reader->state = JSON_RS_VALUE;
+	reader->stack = NULL;
+	reader->depth = 0;
+	reader->stack_size = 0;
+	reader->token = JSON_TOKEN_END;
+	reader->string = NULL;
+	reader->length = 0;
+	reader->number = 0;
+	return reader;
+}
+
+json_reader_t* json_reader_create_file(FILE* fp)
+{
+	return json_reader_create(json_reader_read_file, fp);
+}
+
+json_reader_t* json_reader_create_fd(int fd)
+{
+	return json_reader_create(json_reader_read_fd, (void*)(intptr_t)fd);
+}
+
+// Moves the unconsumed input to the beginning of the buffer and makes room for at least size more bytes
+static void json_reader_reserve(json_reader_t* reader, size_t size)
+{
+	if (reader->pos)
+	{
+		memmove(reader->buf, reader->buf + reader->pos, reader->end - reader->pos);
+		reader->offset += reader->pos;
+		reader->end -= reader->pos;
+		reader->pos = 0;
 	}
+	if (reader->end + size > reader->size)
+	{
+		while (reader->end + size > reader->size)
+			reader->size *= 2;
+		reader->buf = JSON_REALLOC(reader->buf, reader->size + 1);
+	}
+	reader->buf[reader->end] = '\0';
+}
 
-	// Quick tail insertion
-	if (pos < 0)
+// Reads more input from the read function
+// Returns 0 if there is no more input for now
+static int json_reader_fill(json_reader_t* reader)
+{
+	if (reader->eof || reader->read == NULL)
+		return 0;
+	// Grows when an unfinished token fills most of the buffer
+	json_reader_reserve(reader, (JSON_READER_BUFFER + 1) / 2);
+	size_t n = reader->read(reader->ctx, reader->buf + reader->end, reader->size - reader->end);
+	if (n == 0)
 	{
-		JSON* tail = object->members->prev;
-		tail->next = element;
-		element->prev = tail;
-		object->members->prev = element;
-		return;
+		reader->eof = 1;
+		return 0;
 	}
+	reader->end += n;
+	reader->buf[reader->end] = '\0';
+	return 1;
+}
 
-	JSON* cur = object->members;
-	JSON* prev = NULL;
-	int idx = 0;
-	// Jump to index or end of array
-	while (cur != NULL && idx != pos)
+void json_reader_feed(json_reader_t* reader, const char* data, size_t size)
+{
+	json_reader_reserve(reader, size);
+	memcpy(reader->buf + reader->end, data, size);
+	reader->end += size;
+	reader->buf[reader->end] = '\0';
+}
+
+void json_reader_finish(json_reader_t* reader)
+{
+	reader->eof = 1;
+}
+
+static int json_reader_error(json_reader_t* reader, const char* what)
+{
+	char msg[512];
+	snprintf(msg, sizeof msg, "%s at offset %zu \"%.15s\"", what, reader->offset + reader->pos,
+			 reader->buf + reader->pos);
+	JSON_MESSAGE(msg);
+	reader->token = JSON_TOKEN_ERROR;
+	return JSON_TOKEN_ERROR;
+}
+
+// Returns JSON_TOKEN_MORE if the input ended in a token but more can be fed, otherwise an error
+static int json_reader_incomplete(json_reader_t* reader)
+{
+	if (reader->eof)
+		return json_reader_error(reader, "Unexpected end of input");
+	reader->token = JSON_TOKEN_MORE;
+	return JSON_TOKEN_MORE;
+}
+
+// Sets the state after a complete value and returns token
+static int json_reader_value(json_reader_t* reader, int token)
+{
+	reader->state = reader->depth ? JSON_RS_NEXT : JSON_RS_VALUE;
+	reader->token = token;
+	return token;
+}
+
+static int json_reader_push(json_reader_t* reader, char object)
+{
+	if (reader->depth == reader->stack_size)
 	{
-		idx++;
-		prev = cur;
-		cur = cur->next;
+		reader->stack_size = reader->stack_size ? reader->stack_size * 2 : 16;
+		reader->stack = JSON_REALLOC(reader->stack, reader->stack_size);
 	}
+	reader->stack[reader->depth++] = object;
+	reader->pos++;
+	reader->state = object ? JSON_RS_MEMBER : JSON_RS_ELEMENT;
+	reader->token = object ? JSON_TOKEN_BEGIN_OBJECT : JSON_TOKEN_BEGIN_ARRAY;
+	return reader->token;
+}
 
-	// Insert
-	// Beginning
-	if (prev == NULL)
+static int json_reader_pop(json_reader_t* reader)
+{
+	reader->pos++;
+	return json_reader_value(reader, reader->stack[--reader->depth] ? JSON_TOKEN_END_OBJECT : JSON_TOKEN_END_ARRAY);
+}
+
+// Reads the string at pos
+// Returns 1 when read, 0 if more input is needed and -1 on error
+static int json_reader_quote(json_reader_t* reader)
+{
+	for (;;)
 	{
-		object->members = element;
-		element->next = cur;
-		element->prev = cur->prev;
-		cur->prev = element;
-		return;
+		char* start = reader->buf + reader->pos + 1;
+		char* end = reader->buf + reader->end;
+		char* p = start + reader->scanned;
+		for (;;)
+		{
+			p = json_scan_string(p);
+			if (*p == '"')
+			{
+				reader->scanned = 0;
+				char* next = json_unquote(start);
+				if (next == NULL)
+					return -1;
+				reader->string = start;
+				reader->length = strlen(start);
+				reader->pos = next - reader->buf;
+				return 1;
+			}
+			// Resume before an escape that is cut off
+			if (p == end || (*p == '\\' && p + 1 == end))
+				break;
+			if (*p == '\0')
+				return -1;
+			p += *p == '\\' ? 2 : 1;
+		}
+		reader->scanned = p - start;
+		if (!json_reader_fill(reader))
+			return 0;
+	}
+}
+
+// Reads a number, true, false or null at pos
+// Returns 1 when read, 0 if more input is needed and -1 on error
+static int json_reader_scalar(json_reader_t* reader)
+{
+	for (;;)
+	{
+		char* p = reader->buf + reader->pos;
+		char* end = reader->buf + reader->end;
+		if ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+')
+		{
+			char* it = p;
+			while (it < end && ((*it >= '0' && *it <= '9') || *it == '-' || *it == '+' || *it == '.' || *it == 'e' ||
+								*it == 'E'))
+				it++;
+			// The number may continue in the next input
+			if (it < end || reader->eof)
+			{
+				reader->pos = json_stof(p, &reader->number) - reader->buf;
+				reader->token = JSON_TOKEN_NUMBER;
+				return 1;
+			}
+		}
+		else
+		{
+			static const char* literals[] = {"true", "false", "null"};
+			static const int tokens[] = {JSON_TOKEN_BOOL, JSON_TOKEN_BOOL, JSON_TOKEN_NULL};
+			// Set if the input ends in the middle of a literal
+			int partial = 0;
+			for (int i = 0; i < 3; i++)
+			{
+				size_t len = strlen(literals[i]);
+				size_t avail = end - p;
+				if (strncmp(p, literals[i], avail < len ? avail : len) != 0)
+					continue;
+				if (avail >= len)
+				{
+					reader->pos += len;
+					reader->number = i == 0;
+					reader->token = tokens[i];
+					return 1;
+				}
+				partial = 1;
+			}
+			if (!partial || reader->eof)
+				return -1;
+		}
+		// Parse again with the end of input known if nothing more was read
+		if (!json_reader_fill(reader) && !reader->eof)
+			return 0;
+	}
+}
+
+int json_reader_next(json_reader_t* reader)
+{
+	// Errors are not recovered from
+	if (reader->token == JSON_TOKEN_ERROR)
+		return JSON_TOKEN_ERROR;
+	for (;;)
+	{
+		reader->pos = json_skip_whitespace(reader->buf + reader->pos) - reader->buf;
+		if (reader->pos == reader->end)
+		{
+			// Drop the consumed input so that the buffer does not grow
+			reader->offset += reader->pos;
+			reader->pos = 0;
+			reader->end = 0;
+			reader->buf[0] = '\0';
+			if (json_reader_fill(reader))
+				continue;
+			if (reader->eof && reader->depth == 0 && reader->state == JSON_RS_VALUE)
+			{
+				reader->token = JSON_TOKEN_END;
+				return JSON_TOKEN_END;
+			}
+			return json_reader_incomplete(reader);
+		}
+
+		char c = reader->buf[reader->pos];
+		switch (reader->state)
+		{
+		case JSON_RS_ELEMENT:
+			if (c == ']')
+				return json_reader_pop(reader);
+			break;
+		case JSON_RS_MEMBER:
+			if (c == '}')
+				return json_reader_pop(reader);
+			// fall through
+		case JSON_RS_KEY:
+		{
+			if (c != '"')
+				return json_reader_error(reader, "Expected key");
+			int r = json_reader_quote(reader);
+			if (r <= 0)
+				return r ? json_reader_error(reader, "Invalid string") : json_reader_incomplete(reader);
+			reader->state = JSON_RS_COLON;
+			reader->token = JSON_TOKEN_KEY;
+			return JSON_TOKEN_KEY;
+		}
+		case JSON_RS_COLON:
+			if (c != ':')
+				return json_reader_error(reader, "Expected ':'");
+			reader->pos++;
+			reader->state = JSON_RS_VALUE;
+			continue;
+		case JSON_RS_NEXT:
+		{
+			char object = reader->stack[reader->depth - 1];
+			if (c == ',')
+			{
+				reader->pos++;
+				reader->state = object ? JSON_RS_KEY : JSON_RS_VALUE;
+				continue;
+			}
+			if (c == (object ? '}' : ']'))
+				return json_reader_pop(reader);
+			return json_reader_error(reader, "Expected ',' or end of container");
+		}
+		}
+
+		// A value
+		if (c == '{' || c == '[')
+			return json_reader_push(reader, c == '{');
+		if (c == '"')
+		{
+			int r = json_reader_quote(reader);
+			if (r <= 0)
+				return r ? json_reader_error(reader, "Invalid string") : json_reader_incomplete(reader);
+			return json_reader_value(reader, JSON_TOKEN_STRING);
+		}
+		int r = json_reader_scalar(reader);
+		if (r <= 0)
+			return r ? json_reader_error(reader, "Invalid value") : json_reader_incomplete(reader);
+		return json_reader_value(reader, reader->token);
+	}
+}
+
+int json_reader_token(json_reader_t* reader)
+{
+	return reader->token;
+}
+
+const char* json_reader_string(json_reader_t* reader, size_t* length)
+{
+	if (reader->token != JSON_TOKEN_KEY && reader->token != JSON_TOKEN_STRING)
+		return NULL;
+	if (length)
+		*length = reader->length;
+	return reader->string;
+}
+
+double json_reader_number(json_reader_t* reader)
+{
+	return reader->number;
+}
+
+size_t json_reader_depth(json_reader_t* reader)
+{
+	return reader->depth;
+}
+
+// Builds the value starting with token
+static JSON* json_reader_tree(json_reader_t* reader, int token)
+{
+	JSON* object = NULL;
+	switch (token)
+	{
+	case JSON_TOKEN_STRING:
+		return json_create_string(reader->string);
+	case JSON_TOKEN_NUMBER:
+		return json_create_number(reader->number);
+	case JSON_TOKEN_BOOL:
+		object = json_create_empty();
+		json_set_bool(object, reader->number != 0);
+		return object;
+	case JSON_TOKEN_NULL:
+		return json_create_null();
+	case JSON_TOKEN_BEGIN_OBJECT:
+		object = json_create_object();
+		while ((token = json_reader_next(reader)) == JSON_TOKEN_KEY)
+		{
+			// The key is only valid until the next token
+			char* name = strduplicate(reader->string);
+			JSON* member = json_reader_tree(reader, json_reader_next(reader));
+			if (member == NULL)
+			{
+				JSON_FREE(name);
+				break;
+			}
+			member->name = name;
+			json_link_member(object, member);
+		}
+		if (token == JSON_TOKEN_END_OBJECT)
+			return object;
+		json_destroy(object);
+		return NULL;
+	case JSON_TOKEN_BEGIN_ARRAY:
+		object = json_create_array();
+		while ((token = json_reader_next(reader)) != JSON_TOKEN_END_ARRAY)
+		{
+			JSON* element = json_reader_tree(reader, token);
+			if (element == NULL)
+			{
+				json_destroy(object);
+				return NULL;
+			}
+			json_add_element(object, element);
+		}
+		return object;
+	default:
+		return NULL;
+	}
+}
+
+JSON* json_reader_load(json_reader_t* reader)
+{
+	int token = json_reader_next(reader);
+	if (token != JSON_TOKEN_KEY)
+		return json_reader_tree(reader, token);
+
+	char* name = strduplicate(reader->string);
+	JSON* member = json_reader_tree(reader, json_reader_next(reader));
+	if (member == NULL)
+	{
+		JSON_FREE(name);
+		return NULL;
+	}
+	member->name = name;
+	return member;
+}
+
+void json_reader_destroy(json_reader_t* reader)
+{
+	JSON_FREE(reader->buf);
+	if (reader->stack)
+	{
+		JSON_FREE(reader->stack);
 	}
+	JSON_FREE(reader);
+}
+
+void json_destroy_member(JSON* object, const char* name)
+{
+	JSON* member = json_pop_member(object, name);
+	if (member)
+		json_destroy(member);
+}
+
+void json_destroy_element(JSON* object, int pos)
+{
+	JSON* element = json_pop_element(object, pos);
+	if (element)
+		json_destroy(element);
+}
 
-	// End
+// Removes and returns a member from the json structure
+JSON* json_pop_member(JSON* object, const char* name)
+{
+	JSON* cur = json_get_member(object, name);
+	// Name was not found
 	if (cur == NULL)
+		return NULL;
+	if (object->index)
+		json_index_remove(object->index, json_index_find(object->index, json_hash_name(name), name));
+	json_list_unlink(object, cur);
+	return cur;
+}
+
+// Removes and returns an element from the json structure
+JSON* json_pop_element(JSON* object, int pos)
+{
+	if (object->type != JSON_TARRAY)
+		return NULL;
+	JSON_EXPAND(object);
+	if (object->count == 0)
+		return NULL;
+
+	// Special tail case
+	if (pos < 0)
+		pos = object->count - 1;
+	JSON* cur = json_element_at(object, pos);
+	// Index was not found
+	if (cur == NULL)
+		return NULL;
+	if (object->index)
 	{
-		prev->next = element;
-		element->prev = prev;
-		element->prev = cur;
-		// Update first element's prev point to new tail
-		object->members->prev = element;
+		struct json_index* index = object->index;
+		memmove(index->items + pos, index->items + pos + 1, (object->count - 1 - pos) * sizeof(JSON*));
+	}
+	json_list_unlink(object, cur);
+	return cur;
+}
+
+static void json_link_member(JSON* object, JSON* value)
+{
+	value->next = NULL;
+	value->prev = NULL;
+	if (object->type != JSON_TOBJECT)
+	{
+		json_set_invalid(object);
+	}
+	object->type = JSON_TOBJECT;
+	JSON_EXPAND(object);
+	json_adopt(object, value);
+
+	// Duplicate, replace in the same place
+	JSON* cur = json_get_member(object, value->name);
+	size_t hash = object->index ? json_hash_name(value->name) : 0;
+	if (cur)
+	{
+		if (object->index)
+			object->index->items[json_index_find(object->index, hash, value->name)] = value;
+		json_list_insert(object, cur, value);
+		json_list_unlink(object, cur);
+		json_destroy(cur);
 		return;
 	}
-	// Middle
-	prev->next = element;
-	element->prev = prev;
-	element->next = cur;
-	cur->prev = element;
+
+	// No duplicate, insert at tail
+	json_list_insert(object, NULL, value);
+	if (object->index)
+	{
+		// Keep the index at most half full
+		if (2 * (size_t)object->count > object->index->size)
+			json_index_members(object);
+		else
+			json_index_place(object->index, hash, value);
+	}
+}
+
+void json_add_member(JSON* object, const char* name, JSON* value)
+{
+	if (value->name && !(value->flags & JSON_FBORROWED_NAME))
+	{
+		JSON_FREE(value->name);
+	}
+	// The name belongs to the document of the parent
+	value->name = json_doc_strdup(JSON_DOC(object), name);
+	if (JSON_DOC(object))
+		value->flags |= JSON_FBORROWED_NAME;
+	else
+		value->flags &= ~JSON_FBORROWED_NAME;
+	json_link_member(object, value);
+}
+
+void json_insert_element(JSON* object, int pos, JSON* element)
+{
+	element->next = NULL;
+	element->prev = NULL;
+	if (object->type != JSON_TARRAY)
+	{
+		json_set_invalid(object);
+	}
+	object->type = JSON_TARRAY;
+	JSON_EXPAND(object);
+	json_adopt(object, element);
+
+	// Quick tail insertion
+	if (pos < 0 || pos > object->count)
+		pos = object->count;
+	json_list_insert(object, json_element_at(object, pos), element);
+	if (object->index)
+		json_index_insert(object, pos, element);
 }
 
 void json_add_element(JSON* object, JSON* element)
@@ -1507,21 +3708,30 @@ void json_destroy(JSON* object)
 		cur = next;
 	}
 
-	if (object->name)
+	if (object->name && !(object->flags & JSON_FBORROWED_NAME))
 	{
 		JSON_FREE(object->name);
-		object->name = NULL;
 	}
-	if (object->stringval)
+	object->name = NULL;
+	if (object->stringval && !(object->flags & JSON_FBORROWED_STRING))
 	{
 		JSON_FREE(object->stringval);
-		object->stringval = NULL;
+	}
+	object->stringval = NULL;
+	json_index_free(object);
+	if (object->flags & JSON_FTAPE)
+	{
+		JSON_FREE(object->tape);
 	}
 
 	object->numval = 0;
 	object->type = JSON_TINVALID;
 
-	JSON_FREE(object);
+	// Objects of a document are freed with its arena
+	if (!(object->flags & JSON_FARENA))
+	{
+		JSON_FREE(object);
+	}
 }
 #endif
 #endif
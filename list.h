@@ -1,48 +1,316 @@
-/*#ifndef LIST_H
+// See end of file for license
+#ifndef LIST_H
 #define LIST_H
+#include <stddef.h>
 #include <stdint.h>
 
-// List is a dynamic array
-// Creating a list
-// list_t mylist = list_create(sizeof (myobject));
-
+// List is a dynamic array storing elements of one size contiguously
 // To build the library do
 // #define LIST_IMPLEMENTATION in ONE C file to create the function implementations before including the header
-// defined LIST_IMPLEMENTATION
+// list can be safely included several times, but only one C file can define LIST_IMPLEMENTATION
+
+// CONFIGURATION
+// LIST_MALLOC, LIST_REALLOC, and LIST_FREE to define your own allocators
+// LIST_DEFAULT_SIZE (default 8) sets how many elements are allocated when an empty list first grows
+// -> The capacity doubles every time the list is full
+// LIST_INLINE_SIZE (default 0) sets how many bytes of elements are stored inside the list_t before allocating
+// -> Lists of elements that fit never touch the heap
+// -> Changes the layout of list_t, so it needs to be the same in every file including list.h
 
 // Creating and using a list
-// list_t mylist = list_create(sizeof (myobject));
-// list_push(&mylist, object);
+// list_t mylist = list_create(sizeof(MyType));
+// MyType* p = list_push(&mylist, &object);
 // list_destroy(&mylist);
 
+// The elements are reached through list_get, which checks the index, or list_at, which does not
+// MyType* p = list_get(&mylist, 3);
+// list_at(&mylist, MyType, 3).value = 5;
+// Pointers to elements are invalidated by anything adding elements to the list or list_shrink
+
+// Removing
+// list_remove keeps the order and moves the elements after it
+// list_swap_remove moves the last element into the removed slot, which takes constant time
+// list_pop removes the last element and returns it, valid until something is added to the list
+
 typedef struct list_t list_t;
 typedef struct list_t List;
 
+#if defined(LIST_INLINE_SIZE) && LIST_INLINE_SIZE > 0
+#define LIST_HAS_INLINE 1
+#else
+#define LIST_HAS_INLINE 0
+#endif
+
 struct list_t
 {
+	// The allocated elements, or NULL if the elements are stored inline
 	void* data;
 	uint32_t count;
+	// The capacity of the list in elements
 	uint32_t size;
 	uint32_t element_size;
+#if LIST_HAS_INLINE
+	// Storage used before the list outgrows it
+	union {
+		char bytes[LIST_INLINE_SIZE];
+		max_align_t align;
+	} storage;
+#endif
 };
 
-#ifndef list_create
-#define list_create(s) list_create_internal(s);
+#if LIST_HAS_INLINE
+#define LIST_STORAGE(list) ((void*)(list)->storage.bytes)
+#define LIST_INLINE_COUNT(element_size) (LIST_INLINE_SIZE / (element_size))
+#else
+#define LIST_STORAGE(list) NULL
+#define LIST_INLINE_COUNT(element_size) 0
 #endif
 
+// Returns a pointer to the first element
+#define list_data(list) ((list)->data ? (list)->data : LIST_STORAGE(list))
+
+// Accesses the element at index as type without checking the index
+#define list_at(list, type, index) (((type*)list_data(list))[index])
+
+// Creates an empty list of elements of element_size bytes
+// Nothing is allocated until the list outgrows its inline storage
+list_t list_create(uint32_t element_size);
+
+// Makes room for at least count elements
+void list_reserve(list_t* list, uint32_t count);
+
+// Copies element to the end of the list, element can not point into the list
+// If element is NULL, the new element is left uninitialized
+// Returns a pointer to the new element
+void* list_push(list_t* list, const void* element);
+
+// Copies n contiguous elements to the end of the list, growing at most once
+// If elements is NULL, the new elements are left uninitialized
+// Returns a pointer to the first new element
+void* list_push_n(list_t* list, const void* elements, uint32_t n);
+
+// Copies element into the list at index, moving the elements after it
+// If index is greater than the count, element is inserted at the end
+// Returns a pointer to the new element
+void* list_insert(list_t* list, uint32_t index, const void* element);
+
+// Returns a pointer to the element at index, or NULL if out of range
+void* list_get(list_t* list, uint32_t index);
+
+// Removes the last element and returns a pointer to it
+// The pointer is valid until something is added to the list
+// Returns NULL if the list is empty
+void* list_pop(list_t* list);
+
+// Removes the element at index and moves the elements after it down
+void list_remove(list_t* list, uint32_t index);
+
+// Removes the element at index by moving the last element into its place
+void list_swap_remove(list_t* list, uint32_t index);
+
+// Removes all elements without freeing
+void list_clear(list_t* list);
+
+// Reduces the allocation to the count, moving the elements back inline if they fit
+void list_shrink(list_t* list);
+
+// Frees the elements, the list can be used again
+void list_destroy(list_t* list);
 
 #ifdef LIST_IMPLEMENTATION
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef LIST_MALLOC
+#define LIST_MALLOC(s) malloc(s)
+#endif
+#ifndef LIST_REALLOC
+#define LIST_REALLOC(p, s) realloc(p, s)
+#endif
+#ifndef LIST_FREE
+#define LIST_FREE(p) free(p)
+#endif
 
+#ifndef LIST_DEFAULT_SIZE
+#define LIST_DEFAULT_SIZE 8
+#endif
 
+list_t list_create(uint32_t element_size)
+{
+	list_t list;
+	list.data = NULL;
+	list.count = 0;
+	list.size = LIST_INLINE_COUNT(element_size);
+	list.element_size = element_size;
+	return list;
+}
 
-list_t* list_create()
+// Moves the elements to an allocation of size elements
+static void list_resize(list_t* list, uint32_t size)
 {
+	if (list->data)
+	{
+		list->data = LIST_REALLOC(list->data, (size_t)size * list->element_size);
+	}
+	else
+	{
+		// Leave the inline storage
+		void* data = LIST_MALLOC((size_t)size * list->element_size);
+#if LIST_HAS_INLINE
+		if (list->count)
+			memcpy(data, LIST_STORAGE(list), (size_t)list->count * list->element_size);
+#endif
+		list->data = data;
+	}
+	list->size = size;
+}
 
+// Grows geometrically to hold at least count elements
+static void list_grow(list_t* list, uint32_t count)
+{
+	uint32_t size = list->size ? list->size * 2 : LIST_DEFAULT_SIZE;
+	while (size < count)
+		size *= 2;
+	list_resize(list, size);
 }
 
-void list_push(list_t* list, void* element)
+void list_reserve(list_t* list, uint32_t count)
 {
+	if (count > list->size)
+		list_resize(list, count);
+}
 
+void* list_push(list_t* list, const void* element)
+{
+	if (list->count == list->size)
+		list_grow(list, list->count + 1);
+	char* dst = (char*)list_data(list) + (size_t)list->count * list->element_size;
+	if (element)
+		memcpy(dst, element, list->element_size);
+	list->count++;
+	return dst;
 }
+
+void* list_push_n(list_t* list, const void* elements, uint32_t n)
+{
+	if (list->count + n > list->size)
+		list_grow(list, list->count + n);
+	char* dst = (char*)list_data(list) + (size_t)list->count * list->element_size;
+	if (elements && n)
+		memcpy(dst, elements, (size_t)n * list->element_size);
+	list->count += n;
+	return dst;
+}
+
+void* list_insert(list_t* list, uint32_t index, const void* element)
+{
+	if (index >= list->count)
+		return list_push(list, element);
+	if (list->count == list->size)
+		list_grow(list, list->count + 1);
+	char* dst = (char*)list_data(list) + (size_t)index * list->element_size;
+	memmove(dst + list->element_size, dst, (size_t)(list->count - index) * list->element_size);
+	if (element)
+		memcpy(dst, element, list->element_size);
+	list->count++;
+	return dst;
+}
+
+void* list_get(list_t* list, uint32_t index)
+{
+	if (index >= list->count)
+		return NULL;
+	return (char*)list_data(list) + (size_t)index * list->element_size;
+}
+
+void* list_pop(list_t* list)
+{
+	if (list->count == 0)
+		return NULL;
+	list->count--;
+	return (char*)list_data(list) + (size_t)list->count * list->element_size;
+}
+
+void list_remove(list_t* list, uint32_t index)
+{
+	if (index >= list->count)
+		return;
+	char* dst = (char*)list_data(list) + (size_t)index * list->element_size;
+	memmove(dst, dst + list->element_size, (size_t)(list->count - index - 1) * list->element_size);
+	list->count--;
+}
+
+void list_swap_remove(list_t* list, uint32_t index)
+{
+	if (index >= list->count)
+		return;
+	list->count--;
+	// The last element was removed
+	if (index == list->count)
+		return;
+	char* data = (char*)list_data(list);
+	memcpy(data + (size_t)index * list->element_size, data + (size_t)list->count * list->element_size,
+		   list->element_size);
+}
+
+void list_clear(list_t* list)
+{
+	list->count = 0;
+}
+
+void list_shrink(list_t* list)
+{
+	if (list->data == NULL || list->count == list->size)
+		return;
+	uint32_t inline_count = LIST_INLINE_COUNT(list->element_size);
+	if (list->count > inline_count)
+	{
+		list_resize(list, list->count);
+		return;
+	}
+	// Move back inline
+#if LIST_HAS_INLINE
+	if (list->count)
+		memcpy(LIST_STORAGE(list), list->data, (size_t)list->count * list->element_size);
 #endif
-#endif*/
\ No newline at end of file
+	LIST_FREE(list->data);
+	list->data = NULL;
+	list->size = inline_count;
+}
+
+void list_destroy(list_t* list)
+{
+	if (list->data)
+	{
+		LIST_FREE(list->data);
+	}
+	list->data = NULL;
+	list->count = 0;
+	list->size = LIST_INLINE_COUNT(list->element_size);
+}
+
+#endif
+#endif
+
+// ========LICENSE========
+// MIT License
+//
+// Copyright (c) 2020 Tim Roberts
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
@@ -1,5 +1,5 @@
 // Magpie is a small and low overhead library for keeping track of allocations and detecting memory leaks
-// Stores all allocations from the program in a hashtable
+// Stores all allocations from the program in a hashtable, or in a list reached from their header with MP_HEADER_LOOKUP
 // Stores where allocations came from and how many allocations have been done in the same place
 // Checks for buffer overflows and double free
 // Checks for leaked memory blocks at the end of the program with mp_terminate
@@ -36,6 +36,41 @@
 // MP_WARN_NULL to warn when freeing NULL pointer. This is allowed in the specifications of free, but may be a bug of a value that never got initialized
 
 // MP_CHECK_FULL to define MP_REPLACE_STD, MP_CHECK_OVERFLOW, MP_FILL_ON_FREE
+// MP_SAMPLE to only track about one allocation every MP_SAMPLE bytes, e.g #define MP_SAMPLE (512 * 1024)
+// -> The distance in bytes between sampled allocations is random with a mean of MP_SAMPLE
+// -> Allocations that are not sampled go straight to malloc and free without a header or hashtable entry
+// -> Locations, leaks and mp_get_size are estimated by scaling up the sampled allocations
+// -> mp_get_count and the total count and size are still exact
+// -> Overflow, double free and invalid pointer checks only apply to sampled allocations
+// -> Double frees are caught while the block is one of the last MP_SAMPLE_FREED sampled blocks freed in its shard
+// -> Validating a pointer that was not sampled succeeds, since it can not be checked
+// MP_SAMPLE_FREED (default 16) sets how many freed sampled blocks every shard keeps to catch double frees
+// -> The blocks stay allocated so their address is not reused until they are retired
+// -> Reallocating keeps an allocation sampled or untracked, the growth of untracked allocations is not estimated
+// -> Use in RELEASE builds to find leaks and heap heavy code for little overhead
+// MP_THREADSAFE to allow allocating and freeing from several threads at once, requires pthreads and C11 atomics
+// -> Tracked pointers are split over 1 << MP_SHARD_BITS shards that have their own lock, table and counters
+// -> The counters are atomic and summed over the shards when read
+// -> Locations are found without locking and inserted with compare and swap
+// MP_SHARD_BITS (default 6) sets how many shards MP_THREADSAFE uses
+// MP_LOCATION_BUCKETS (default 1024) sets the number of buckets of the location table, needs to be a power of two
+// MP_BACKTRACE to also tell allocation sites apart by their call stack, requires execinfo.h of glibc
+// -> The stack is stored with the site and written by mp_export, which then has the full call stacks
+// -> Capturing is slow, combine with MP_SAMPLE to only capture for sampled allocations
+// MP_BACKTRACE_DEPTH (default 16) sets the most frames captured for a site
+// MP_HEADER_LOOKUP to find blocks from the header in front of the pointer instead of the pointer hashtable
+// -> Free, realloc and validate are constant time, the header has a magic word telling if it is a live block
+// -> Live blocks are kept in a doubly linked list per shard for the leak report of mp_terminate
+// -> Pointers that were never allocated by magpie are read in front of, which may crash instead of being reported
+// -> Can not be used with MP_SAMPLE, since allocations that are not sampled have no header
+
+// Heap profiles
+// mp_snapshot_t before = mp_snapshot();
+// ...
+// mp_snapshot_t after = mp_snapshot();
+// mp_snapshot_t growth = mp_snapshot_diff(&before, &after);
+// mp_export(&growth, "growth.folded", MP_EXPORT_COLLAPSED);
+// Snapshots are freed with mp_snapshot_free and are valid until mp_terminate
 
 // Use mp_bind to associate a pointer with another file and line.
 // Useful if you have a function allocating and you want to store what called the function instead
@@ -71,6 +106,37 @@
 #define MP_VALIDATE_INVALID	 -1
 #define MP_VALIDATE_OVERFLOW -2
 
+// Collapsed stacks as read by flamegraph.pl and most flame graph tools, weighted by live bytes
+#define MP_EXPORT_COLLAPSED 0
+// The legacy text heap profile of gperftools, read by pprof, requires MP_BACKTRACE
+#define MP_EXPORT_PPROF 1
+
+// The state of one allocation site when a snapshot was taken
+// With MP_SAMPLE the counts are estimated
+typedef struct mp_site_t
+{
+	// Identifies the site between snapshots
+	const void* id;
+	const char* file;
+	uint32_t line;
+	// The call stack of the site with MP_BACKTRACE, innermost frame first
+	uint32_t depth;
+	void* const* frames;
+	// Allocations made at the site, does not decrement on free
+	int64_t alloc_count;
+	int64_t alloc_size;
+	// Blocks and bytes allocated at the site that have not been freed
+	int64_t live_count;
+	int64_t live_size;
+} mp_site_t;
+
+typedef struct mp_snapshot_t
+{
+	// Sorted by id
+	mp_site_t* sites;
+	size_t count;
+} mp_snapshot_t;
+
 // Returns the total number of allocations made
 size_t mp_get_total_count();
 
@@ -83,9 +149,24 @@ size_t mp_get_count();
 // Returns the current number of bytes allocated
 size_t mp_get_size();
 
-// Prints the locations of all [c,a,re]allocs and how many allocations was performed there
+// Prints the locations of all [c,a,re]allocs, how many allocations was performed there and how much of it is live
+// Locations are sorted by the number of allocations
 void mp_print_locations();
 
+// Captures the counts of every allocation site
+// The snapshot is empty if it could not be allocated
+mp_snapshot_t mp_snapshot();
+
+// Returns the growth from before to after, after - before for every site that changed
+mp_snapshot_t mp_snapshot_diff(const mp_snapshot_t* before, const mp_snapshot_t* after);
+
+// Frees the sites of a snapshot
+void mp_snapshot_free(mp_snapshot_t* snapshot);
+
+// Writes a snapshot to path as MP_EXPORT_COLLAPSED or MP_EXPORT_PPROF
+// Returns 0 on success or -1 if the file could not be written or the format is not available
+int mp_export(const mp_snapshot_t* snapshot, const char* path, int format);
+
 // Checks if any blocks remain to be freed
 // Should only be run at the end of the program execution
 // Uses the msg
@@ -124,6 +205,17 @@ void* mp_bind_internal(void* ptr, const char* file, uint32_t line);
 #include <string.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <stddef.h>
+#ifdef MP_SAMPLE
+#include <math.h>
+#endif
+#ifdef MP_THREADSAFE
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+#ifdef MP_BACKTRACE
+#include <execinfo.h>
+#endif
 #ifndef MP_MSG_LEN
 #define MP_MSG_LEN 512
 #endif
@@ -139,24 +231,74 @@ void* mp_bind_internal(void* ptr, const char* file, uint32_t line);
 #define MP_MESSAGE(m) puts(m)
 #endif
 
-// The total number of allocations for the program
-static size_t mp_total_alloc_count = 0;
-// The total size of all allocation for the program
-static size_t mp_total_alloc_size = 0;
-// The current number of allocated blocks of memory
-static size_t mp_alloc_count = 0;
-// The number of bytes allocated
-static size_t mp_alloc_size = 0;
+#ifdef MP_BACKTRACE
+#ifndef MP_BACKTRACE_DEPTH
+#define MP_BACKTRACE_DEPTH 16
+#endif
+// The functions capturing stacks need a frame of their own to be skipped
+#define MP_NOINLINE __attribute__((noinline))
+#else
+#define MP_NOINLINE
+#endif
+
+#ifdef MP_THREADSAFE
+#ifndef MP_SHARD_BITS
+#define MP_SHARD_BITS 6
+#endif
+typedef atomic_size_t mp_counter_t;
+#define MP_COUNTER_ADD(c, n) atomic_fetch_add_explicit(&(c), (n), memory_order_relaxed)
+#define MP_COUNTER_FETCH_ADD MP_COUNTER_ADD
+#define MP_COUNTER_SUB(c, n) atomic_fetch_sub_explicit(&(c), (n), memory_order_relaxed)
+#define MP_COUNTER_LOAD(c)	 atomic_load_explicit(&(c), memory_order_relaxed)
+#define MP_LOCK(lock)		 pthread_mutex_lock(lock)
+#define MP_UNLOCK(lock)		 pthread_mutex_unlock(lock)
+#define MP_THREAD_LOCAL		 _Thread_local
+#define MP_ATOMIC(type)		 _Atomic(type)
+#define MP_LOAD_ACQUIRE(p)	 atomic_load_explicit(&(p), memory_order_acquire)
+// Sets p to desired if it still is expected, otherwise updates expected
+#define MP_CAS(p, expected, desired) \
+	atomic_compare_exchange_weak_explicit(&(p), &(expected), desired, memory_order_release, memory_order_acquire)
+#else
+#undef MP_SHARD_BITS
+#define MP_SHARD_BITS 0
+typedef size_t mp_counter_t;
+#define MP_COUNTER_ADD(c, n) ((c) += (n))
+// Returns the previous value like atomic_fetch_add
+#define MP_COUNTER_FETCH_ADD(c, n) (((c) += (n)) - (n))
+#define MP_COUNTER_SUB(c, n)	   ((c) -= (n))
+#define MP_COUNTER_LOAD(c)	 (c)
+#define MP_LOCK(lock)
+#define MP_UNLOCK(lock)
+#define MP_THREAD_LOCAL
+#define MP_ATOMIC(type)				 type
+#define MP_LOAD_ACQUIRE(p)			 (p)
+#define MP_CAS(p, expected, desired) ((p) = (desired), 1)
+#endif
+
+#define MP_SHARDS (1 << MP_SHARD_BITS)
 
 #ifndef MP_DISABLE
+#ifdef MP_HEADER_LOOKUP
+#ifdef MP_SAMPLE
+#error "MP_HEADER_LOOKUP can not be used with MP_SAMPLE since allocations that are not sampled have no header"
+#endif
+// Stored in the header of live blocks xored with the address of the header
+#define MP_MAGIC 0x6d61677069650a1fULL
+#endif
+
 // A memory block stored based on line of initial allocation in a binary tree
 struct MemBlock
 {
 	size_t size;
-	const char* file;
-	uint32_t line;
+	// Where the block was allocated or bound to
+	struct MPAllocLocation* location;
 	uint32_t count;
 	struct MemBlock* next;
+#ifdef MP_HEADER_LOOKUP
+	struct MemBlock* prev;
+	// Directly in front of the bytes, so it is the first to be overwritten by an underflow
+	uint64_t magic;
+#endif
 	char bytes[1];
 };
 
@@ -171,18 +313,231 @@ struct MPHashTable
 
 // Describes the location of a malloc
 // Used to track where allocations come from and how many has been allocated from the same place in the code
+// Locations are stored in a hash table by file pointer and line and are only freed by mp_terminate
 struct MPAllocLocation
 {
 	const char* file;
 	uint32_t line;
 	// How many allocations have been done at file:line
 	// Does not decrement on free
-	uint32_t count;
-	struct MPAllocLocation *prev, *next;
+	mp_counter_t count;
+	// The allocations and bytes that count represents, the same as count without MP_SAMPLE
+	mp_counter_t alloc_count;
+	mp_counter_t alloc_size;
+	// The blocks and bytes allocated here that have not been freed
+	// With MP_SAMPLE they are estimated
+	mp_counter_t live_count;
+	mp_counter_t live_size;
+	// The next location in the same bucket
+	struct MPAllocLocation* next;
+#ifdef MP_BACKTRACE
+	uint32_t depth;
+	void* frames[MP_BACKTRACE_DEPTH];
+#endif
 };
 
-static struct MPHashTable mp_hashtable = {0};
-static struct MPAllocLocation* mp_locations = NULL;
+// The call stack of an allocation, empty without MP_BACKTRACE
+struct MPStack
+{
+	uint32_t depth;
+#ifdef MP_BACKTRACE
+	void* frames[MP_BACKTRACE_DEPTH];
+#endif
+};
+
+#ifndef MP_LOCATION_BUCKETS
+#define MP_LOCATION_BUCKETS 1024
+#endif
+
+#if defined(MP_SAMPLE) && !defined(MP_SAMPLE_FREED)
+#define MP_SAMPLE_FREED 16
+#endif
+
+// The buckets never move, so finding a location does not lock
+// New locations are pushed to the front of their bucket
+static MP_ATOMIC(struct MPAllocLocation*) mp_locations[MP_LOCATION_BUCKETS];
+#endif
+
+// The counters of a shard, they are summed when read
+struct MPCounters
+{
+	// The total number of allocations
+	mp_counter_t total_count;
+	// The total size of all allocations
+	mp_counter_t total_size;
+	// The current number of allocated blocks of memory
+	mp_counter_t count;
+	// The number of bytes allocated
+	mp_counter_t size;
+};
+
+// The pointers are split by their hash into shards with their own lock, table and counters
+// A pointer is always counted in the same shard, so allocations on different threads rarely share a lock
+struct MPShard
+{
+	struct MPCounters counters;
+#if defined(MP_HEADER_LOOKUP) && !defined(MP_DISABLE)
+	// The live blocks of the shard
+	struct MemBlock* blocks;
+#elif !defined(MP_DISABLE)
+	struct MPHashTable table;
+#endif
+#if defined(MP_SAMPLE) && !defined(MP_DISABLE)
+	// The last freed sampled blocks, a ring retired from freed_next
+	struct MemBlock* freed[MP_SAMPLE_FREED];
+	uint32_t freed_next;
+#endif
+#ifdef MP_THREADSAFE
+	pthread_mutex_t lock;
+#endif
+};
+
+// Shards are padded to not share cache lines
+static union
+{
+	struct MPShard shard;
+	char pad[(sizeof(struct MPShard) + 63) / 64 * 64];
+} mp_shards[MP_SHARDS];
+
+#if defined(MP_THREADSAFE) && !defined(MP_DISABLE)
+static pthread_once_t mp_shards_once = PTHREAD_ONCE_INIT;
+
+static void mp_shards_init()
+{
+	for (size_t i = 0; i < MP_SHARDS; i++)
+		pthread_mutex_init(&mp_shards[i].shard.lock, NULL);
+}
+#endif
+
+// Returns the shard the pointer belongs to
+static struct MPShard* mp_shard(void* ptr)
+{
+#if defined(MP_THREADSAFE) && !defined(MP_DISABLE)
+	pthread_once(&mp_shards_once, mp_shards_init);
+#endif
+#if MP_SHARD_BITS == 0
+	(void)ptr;
+	return &mp_shards[0].shard;
+#else
+	// The top bits of a multiplicative hash, the table uses the low bits of another hash
+	uint64_t key = (uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15;
+	return &mp_shards[key >> (64 - MP_SHARD_BITS)].shard;
+#endif
+}
+
+// Sums a counter over all shards
+static size_t mp_counter_sum(size_t offset)
+{
+	size_t sum = 0;
+	for (size_t i = 0; i < MP_SHARDS; i++)
+	{
+		mp_counter_t* counter = (mp_counter_t*)((char*)&mp_shards[i].shard.counters + offset);
+		sum += MP_COUNTER_LOAD(*counter);
+	}
+	return sum;
+}
+
+#ifndef MP_DISABLE
+// Counts a new allocation of size bytes
+static void mp_count_alloc(struct MPShard* shard, size_t size)
+{
+	MP_COUNTER_ADD(shard->counters.total_count, 1);
+	MP_COUNTER_ADD(shard->counters.total_size, size);
+	MP_COUNTER_ADD(shard->counters.count, 1);
+	MP_COUNTER_ADD(shard->counters.size, size);
+}
+
+#ifdef MP_SAMPLE
+// Bytes left to allocate until the next sampled allocation of the thread
+static MP_THREAD_LOCAL int64_t mp_sample_left = 0;
+static MP_THREAD_LOCAL uint64_t mp_sample_state = 0;
+// The estimated number of bytes allocated, from the sampled blocks
+static mp_counter_t mp_sample_size = 0;
+
+// Draws the distance to the next sample from an exponential distribution with a mean of MP_SAMPLE
+// Sampling is then a Poisson process over allocated bytes and every byte has the same chance of being sampled
+static int64_t mp_sample_interval()
+{
+	if (mp_sample_state == 0)
+		mp_sample_state = (uint64_t)(uintptr_t)&mp_sample_state ^ 0x9E3779B97F4A7C15;
+	// xorshift64*
+	mp_sample_state ^= mp_sample_state >> 12;
+	mp_sample_state ^= mp_sample_state << 25;
+	mp_sample_state ^= mp_sample_state >> 27;
+	uint64_t r = mp_sample_state * 0x2545F4914F6CDD1D;
+	// Uniform in (0, 1]
+	double u = ((r >> 11) + 1) * (1.0 / 9007199254740992.0);
+	return (int64_t)(-log(u) * (MP_SAMPLE)) + 1;
+}
+
+// Returns 1 if an allocation of size bytes should be tracked
+static int mp_sample(size_t size)
+{
+	if (mp_sample_left == 0)
+		mp_sample_left = mp_sample_interval();
+	mp_sample_left -= (int64_t)size;
+	if (mp_sample_left > 0)
+		return 0;
+	mp_sample_left = mp_sample_interval();
+	return 1;
+}
+
+// Returns 1 if ptr is a sampled block that was freed and is still kept by the shard
+// Pointers that are not in the table are otherwise taken to not be sampled
+// Needs the lock of the shard
+static int mp_sample_freed(struct MPShard* shard, void* ptr)
+{
+	for (uint32_t i = 0; i < MP_SAMPLE_FREED; i++)
+		if (shard->freed[i] && shard->freed[i]->bytes == ptr)
+			return 1;
+	return 0;
+}
+
+// Keeps a freed sampled block and frees the oldest one kept
+// The block stays allocated, so malloc can not return the same pointer while it is kept
+static void mp_sample_retire(struct MPShard* shard, struct MemBlock* block)
+{
+	MP_LOCK(&shard->lock);
+	struct MemBlock* retired = shard->freed[shard->freed_next];
+	shard->freed[shard->freed_next] = block;
+	shard->freed_next = (shard->freed_next + 1) % MP_SAMPLE_FREED;
+	MP_UNLOCK(&shard->lock);
+	free(retired);
+}
+
+// The number of allocations of size bytes a sampled one represents
+// An allocation of size bytes is sampled with the probability 1 - e^(-size / MP_SAMPLE)
+static double mp_sample_weight(size_t size)
+{
+	if (size == 0)
+		size = 1;
+	return 1.0 / (1.0 - exp(-(double)size / (MP_SAMPLE)));
+}
+
+// The estimated number of bytes a sampled allocation of size bytes represents
+static size_t mp_sample_bytes(size_t size)
+{
+	return (size_t)(size * mp_sample_weight(size));
+}
+
+// Counts an allocation that is not tracked
+static void* mp_untracked(void* ptr, size_t size, const char* file, uint32_t line)
+{
+	if (ptr == NULL)
+	{
+		char msg[MP_MSG_LEN];
+		snprintf(msg, sizeof msg, "%s:%u Failed to allocate memory for %zu bytes", file, line, size);
+		MP_MESSAGE(msg);
+		return NULL;
+	}
+	// Untracked blocks have no size to subtract on free
+	struct MPShard* shard = mp_shard(ptr);
+	MP_COUNTER_ADD(shard->counters.total_count, 1);
+	MP_COUNTER_ADD(shard->counters.total_size, size);
+	MP_COUNTER_ADD(shard->counters.count, 1);
+	return ptr;
+}
+#endif
 
 // Hash functions from https://gist.github.com/badboy/6267743
 #if SIZE_MAX == 0xffffffff // 32 bit
@@ -208,46 +563,67 @@ size_t mp_hash_ptr(void* ptr)
 	key = (key + (key << 2)) + (key << 4); // key * 21
 	key = key ^ (key >> 28);
 	key = key + (key << 31);
-
-	// Fit to table
-	// Since size is a power of two, it is faster than modulo
-	return key & (mp_hashtable.size - 1);
+	return key;
 }
 #endif
 
+// Adds a block to the live blocks of the shard of its pointer
+// Note: the lock of the shard needs to be held by all three
+static void mp_shard_insert(struct MPShard* shard, struct MemBlock* block);
+
+// Returns the live block of ptr, or NULL if ptr is invalid or freed
+static struct MemBlock* mp_shard_search(struct MPShard* shard, void* ptr);
+
+// Removes and returns the live block of ptr, or NULL if ptr is invalid or freed
+static struct MemBlock* mp_shard_remove(struct MPShard* shard, void* ptr);
+
+#ifndef MP_HEADER_LOOKUP
 // Inserts block and correctly resizes the hashtable
-// Counts and increases how many allocations have come from the same file and line
-void mp_insert(struct MemBlock* block, const char* file, uint32_t line);
+void mp_insert(struct MPHashTable* table, struct MemBlock* block);
+#endif
+
+// Counts and increases how many allocations have come from the same file, line and stack
+// Adds the block to the live blocks of the location
+void mp_locate(struct MemBlock* block, const char* file, uint32_t line, const struct MPStack* stack);
+
+// Removes the block from the live blocks of its location
+void mp_unlocate(struct MemBlock* block);
 
+#ifndef MP_HEADER_LOOKUP
 // Resizes the list either up (1) or down (-1), does nothing if incorrect value
-void mp_resize(int direction);
+void mp_resize(struct MPHashTable* table, int direction);
 
 // Searches for the pointer in the tree
-struct MemBlock* mp_search(void* ptr);
+struct MemBlock* mp_search(struct MPHashTable* table, void* ptr);
 
 // Searches and removes a memblock storing the ptr from the hashmap
 // Returns the memblock, or NULL if failed
-struct MemBlock* mp_remove(void* ptr);
+struct MemBlock* mp_remove(struct MPHashTable* table, void* ptr);
+#endif
 #endif
 
 size_t mp_get_total_count()
 {
-	return mp_total_alloc_count;
+	return mp_counter_sum(offsetof(struct MPCounters, total_count));
 }
 
 size_t mp_get_total_size()
 {
-	return mp_total_alloc_size;
+	return mp_counter_sum(offsetof(struct MPCounters, total_size));
 }
 
 size_t mp_get_count()
 {
-	return mp_alloc_count;
+	return mp_counter_sum(offsetof(struct MPCounters, count));
 }
 
 size_t mp_get_size()
 {
-	return mp_alloc_size;
+#if defined(MP_SAMPLE) && !defined(MP_DISABLE)
+	return MP_COUNTER_LOAD(mp_sample_size);
+#else
+	return mp_counter_sum(offsetof(struct MPCounters, size));
+#endif
 }
 
 // Remove print locations
@@ -261,6 +637,27 @@ void mp_print_locations()
 	MP_MESSAGE("Failed to fetch locations since magpie is disabled in build");
 }
 
+mp_snapshot_t mp_snapshot()
+{
+	MP_MESSAGE("Failed to take snapshot since magpie is disabled in build");
+	return (mp_snapshot_t){0};
+}
+
+mp_snapshot_t mp_snapshot_diff(__attribute__((unused)) const mp_snapshot_t* before, __attribute__((unused)) const mp_snapshot_t* after)
+{
+	return (mp_snapshot_t){0};
+}
+
+void mp_snapshot_free(__attribute__((unused)) mp_snapshot_t* snapshot)
+{
+}
+
+int mp_export(__attribute__((unused)) const mp_snapshot_t* snapshot, __attribute__((unused)) const char* path, __attribute__((unused)) int format)
+{
+	MP_MESSAGE("Failed to export heap profile since magpie is disabled in build");
+	return -1;
+}
+
 size_t mp_terminate()
 {
 	MP_MESSAGE("Failed to fetch remaining blocks since magpie is disabled in build");
@@ -283,9 +680,10 @@ void* mp_malloc_internal(size_t size, const char* file, uint32_t line)
 		MP_MESSAGE(msg);
 		return NULL;
 	}
-	mp_total_alloc_count++;
-	mp_total_alloc_size += size;
-	mp_alloc_count++;
+	struct MPShard* shard = mp_shard(ptr);
+	MP_COUNTER_ADD(shard->counters.total_count, 1);
+	MP_COUNTER_ADD(shard->counters.total_size, size);
+	MP_COUNTER_ADD(shard->counters.count, 1);
 	return ptr;
 }
 
@@ -299,13 +697,38 @@ void* mp_calloc_internal(size_t num, size_t size, const char* file, uint32_t lin
 		MP_MESSAGE(msg);
 		return NULL;
 	}
-	mp_total_alloc_count++;
-	mp_total_alloc_size += num * size;
-	mp_alloc_count++;
+	struct MPShard* shard = mp_shard(ptr);
+	MP_COUNTER_ADD(shard->counters.total_count, 1);
+	MP_COUNTER_ADD(shard->counters.total_size, num * size);
+	MP_COUNTER_ADD(shard->counters.count, 1);
 	return ptr;
 }
 
-void* mp_realloc_internal(void* ptr, size_t size, const char* file, uint32_t line);
+void* mp_realloc_internal(void* ptr, size_t size, const char* file, uint32_t line)
+{
+	if (ptr == NULL)
+		return mp_malloc_internal(size, file, line);
+	if (size == 0)
+	{
+		mp_free_internal(ptr, file, line);
+		return NULL;
+	}
+	// The block is counted in the shard of its new pointer
+	struct MPShard* shard = mp_shard(ptr);
+	void* new_ptr = realloc(ptr, size);
+	if (new_ptr == NULL)
+	{
+		char msg[MP_MSG_LEN];
+		snprintf(msg, sizeof msg, "%s:%u Failed to reallocate memory to %zu bytes", file, line, size);
+		MP_MESSAGE(msg);
+		return NULL;
+	}
+	MP_COUNTER_SUB(shard->counters.count, 1);
+	shard = mp_shard(new_ptr);
+	MP_COUNTER_ADD(shard->counters.count, 1);
+	MP_COUNTER_ADD(shard->counters.total_size, size);
+	return new_ptr;
+}
 
 void mp_free_internal(void* ptr, __attribute__((unused)) const char* file, __attribute__((unused)) uint32_t line)
 {
@@ -318,7 +741,7 @@ void mp_free_internal(void* ptr, __attribute__((unused)) const char* file, __att
 		return;
 	}
 #endif
-	mp_alloc_count--;
+	MP_COUNTER_SUB(mp_shard(ptr)->counters.count, 1);
 	free(ptr);
 }
 
@@ -328,16 +751,305 @@ void* mp_bind_internal(void* ptr, __attribute__((unused)) const char* file, __at
 }
 
 #else
+// The file and line a block was allocated at
+static const char* mp_block_file(struct MemBlock* block)
+{
+	return block->location ? block->location->file : "unknown";
+}
+
+static uint32_t mp_block_line(struct MemBlock* block)
+{
+	return block->location ? block->location->line : 0;
+}
+
+// Sorts locations by most allocations first
+static int mp_location_cmp(const void* a, const void* b)
+{
+	size_t ca = MP_COUNTER_LOAD((*(struct MPAllocLocation* const*)a)->count);
+	size_t cb = MP_COUNTER_LOAD((*(struct MPAllocLocation* const*)b)->count);
+	return (ca < cb) - (ca > cb);
+}
+
 void mp_print_locations()
 {
-	struct MPAllocLocation* it = mp_locations;
-	while (it)
+	size_t count = 0;
+	for (size_t i = 0; i < MP_LOCATION_BUCKETS; i++)
+		for (struct MPAllocLocation* it = MP_LOAD_ACQUIRE(mp_locations[i]); it; it = it->next)
+			count++;
+	if (count == 0)
+		return;
+
+	struct MPAllocLocation** sorted = malloc(count * sizeof(*sorted));
+	if (sorted == NULL)
 	{
+		MP_MESSAGE("Failed to allocate memory for sorting the allocation locations");
+		return;
+	}
+	// Locations inserted by other threads after counting are left out
+	size_t n = 0;
+	for (size_t i = 0; i < MP_LOCATION_BUCKETS; i++)
+		for (struct MPAllocLocation* it = MP_LOAD_ACQUIRE(mp_locations[i]); it && n < count; it = it->next)
+			sorted[n++] = it;
+	qsort(sorted, n, sizeof(*sorted), mp_location_cmp);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		struct MPAllocLocation* it = sorted[i];
 		char msg[MP_MSG_LEN];
-		snprintf(msg, sizeof msg, "Allocator at %s:%u made %u allocations", it->file, it->line, it->count);
+#ifdef MP_SAMPLE
+		snprintf(msg, sizeof msg,
+				 "Allocator at %s:%u made %zu sampled allocations, an estimated %zu allocations of %zu bytes, an "
+				 "estimated %zu blocks of %zu bytes are live",
+				 it->file, it->line, MP_COUNTER_LOAD(it->count), MP_COUNTER_LOAD(it->alloc_count),
+				 MP_COUNTER_LOAD(it->alloc_size), MP_COUNTER_LOAD(it->live_count),
+				 MP_COUNTER_LOAD(it->live_size));
+#else
+		snprintf(msg, sizeof msg, "Allocator at %s:%u made %zu allocations, %zu blocks of %zu bytes are live",
+				 it->file, it->line, MP_COUNTER_LOAD(it->count), MP_COUNTER_LOAD(it->live_count),
+				 MP_COUNTER_LOAD(it->live_size));
+#endif
 		MP_MESSAGE(msg);
-		it = it->next;
 	}
+	free(sorted);
+}
+
+// Sorts sites by id so snapshots can be merged
+static int mp_site_cmp(const void* a, const void* b)
+{
+	uintptr_t ia = (uintptr_t)((const mp_site_t*)a)->id;
+	uintptr_t ib = (uintptr_t)((const mp_site_t*)b)->id;
+	return (ia > ib) - (ia < ib);
+}
+
+mp_snapshot_t mp_snapshot()
+{
+	mp_snapshot_t snapshot = {0};
+	size_t count = 0;
+	for (size_t i = 0; i < MP_LOCATION_BUCKETS; i++)
+		for (struct MPAllocLocation* it = MP_LOAD_ACQUIRE(mp_locations[i]); it; it = it->next)
+			count++;
+	if (count == 0)
+		return snapshot;
+
+	snapshot.sites = malloc(count * sizeof(*snapshot.sites));
+	if (snapshot.sites == NULL)
+	{
+		MP_MESSAGE("Failed to allocate memory for snapshot");
+		return snapshot;
+	}
+	// Locations inserted by other threads after counting are left out
+	for (size_t i = 0; i < MP_LOCATION_BUCKETS; i++)
+	{
+		for (struct MPAllocLocation* it = MP_LOAD_ACQUIRE(mp_locations[i]); it && snapshot.count < count;
+			 it = it->next)
+		{
+			mp_site_t* site = &snapshot.sites[snapshot.count++];
+			site->id = it;
+			site->file = it->file;
+			site->line = it->line;
+#ifdef MP_BACKTRACE
+			site->depth = it->depth;
+			site->frames = it->frames;
+#else
+			site->depth = 0;
+			site->frames = NULL;
+#endif
+			site->alloc_count = MP_COUNTER_LOAD(it->alloc_count);
+			site->alloc_size = MP_COUNTER_LOAD(it->alloc_size);
+			site->live_count = MP_COUNTER_LOAD(it->live_count);
+			site->live_size = MP_COUNTER_LOAD(it->live_size);
+		}
+	}
+	qsort(snapshot.sites, snapshot.count, sizeof(*snapshot.sites), mp_site_cmp);
+	return snapshot;
+}
+
+mp_snapshot_t mp_snapshot_diff(const mp_snapshot_t* before, const mp_snapshot_t* after)
+{
+	mp_snapshot_t diff = {0};
+	if (before->count + after->count == 0)
+		return diff;
+	diff.sites = malloc((before->count + after->count) * sizeof(*diff.sites));
+	if (diff.sites == NULL)
+	{
+		MP_MESSAGE("Failed to allocate memory for snapshot");
+		return diff;
+	}
+
+	// Both are sorted by id, a site missing from one of them counts as 0 there
+	size_t b = 0, a = 0;
+	while (b < before->count || a < after->count)
+	{
+		int cmp = b == before->count  ? 1
+				  : a == after->count ? -1
+									  : mp_site_cmp(&before->sites[b], &after->sites[a]);
+		mp_site_t site;
+		if (cmp > 0)
+		{
+			site = after->sites[a++];
+		}
+		else
+		{
+			const mp_site_t* old = &before->sites[b++];
+			site = cmp == 0 ? after->sites[a++] : *old;
+			if (cmp < 0)
+				site.alloc_count = site.alloc_size = site.live_count = site.live_size = 0;
+			site.alloc_count -= old->alloc_count;
+			site.alloc_size -= old->alloc_size;
+			site.live_count -= old->live_count;
+			site.live_size -= old->live_size;
+		}
+		if (site.alloc_count || site.alloc_size || site.live_count || site.live_size)
+			diff.sites[diff.count++] = site;
+	}
+	return diff;
+}
+
+void mp_snapshot_free(mp_snapshot_t* snapshot)
+{
+	free(snapshot->sites);
+	snapshot->sites = NULL;
+	snapshot->count = 0;
+}
+
+#ifdef MP_BACKTRACE
+// Writes the function name of a symbol from backtrace_symbols, "module(function+offset) [address]"
+// Falls back to the module and offset when the function is not known
+static void mp_write_frame(FILE* fp, const char* symbol)
+{
+	const char* begin = strchr(symbol, '(');
+	const char* end = begin ? strpbrk(begin, "+)") : NULL;
+	if (begin && end && end > begin + 1)
+	{
+		fprintf(fp, "%.*s", (int)(end - begin - 1), begin + 1);
+		return;
+	}
+	// Collapsed stacks can not have spaces or semicolons in frames
+	for (; *symbol && *symbol != ' '; symbol++)
+		fputc(*symbol == ';' ? '_' : *symbol, fp);
+}
+#endif
+
+// Writes the stack of a site from the outermost frame, followed by the site itself
+static void mp_write_collapsed(FILE* fp, const mp_site_t* site)
+{
+#ifdef MP_BACKTRACE
+	char** symbols = site->depth ? backtrace_symbols(site->frames, site->depth) : NULL;
+	for (uint32_t i = site->depth; symbols && i > 0; i--)
+	{
+		mp_write_frame(fp, symbols[i - 1]);
+		fputc(';', fp);
+	}
+	free(symbols);
+#endif
+	fprintf(fp, "%s:%u %lld\n", site->file, site->line, (long long)site->live_size);
+}
+
+#ifdef MP_BACKTRACE
+// Sites with growth below zero in a diff are written as 0
+static long long mp_positive(int64_t value)
+{
+	return value > 0 ? value : 0;
+}
+
+static void mp_write_pprof(FILE* fp, const mp_snapshot_t* snapshot)
+{
+	mp_site_t total = {0};
+	for (size_t i = 0; i < snapshot->count; i++)
+	{
+		total.live_count += mp_positive(snapshot->sites[i].live_count);
+		total.live_size += mp_positive(snapshot->sites[i].live_size);
+		total.alloc_count += mp_positive(snapshot->sites[i].alloc_count);
+		total.alloc_size += mp_positive(snapshot->sites[i].alloc_size);
+	}
+	fprintf(fp, "heap profile: %lld: %lld [%lld: %lld] @ heapprofile\n", (long long)total.live_count,
+			(long long)total.live_size, (long long)total.alloc_count, (long long)total.alloc_size);
+	for (size_t i = 0; i < snapshot->count; i++)
+	{
+		const mp_site_t* site = &snapshot->sites[i];
+		if (site->live_size <= 0 && site->alloc_size <= 0)
+			continue;
+		fprintf(fp, "%lld: %lld [%lld: %lld] @", mp_positive(site->live_count), mp_positive(site->live_size),
+				mp_positive(site->alloc_count), mp_positive(site->alloc_size));
+		for (uint32_t f = 0; f < site->depth; f++)
+			fprintf(fp, " %p", site->frames[f]);
+		fputc('\n', fp);
+	}
+
+	// pprof maps the addresses to the binaries with the mappings of the process
+	FILE* maps = fopen("/proc/self/maps", "r");
+	if (maps)
+	{
+		fputs("\nMAPPED_LIBRARIES:\n", fp);
+		char buf[4096];
+		size_t n = 0;
+		while ((n = fread(buf, 1, sizeof buf, maps)) > 0)
+			fwrite(buf, 1, n, fp);
+		fclose(maps);
+	}
+}
+#endif
+
+int mp_export(const mp_snapshot_t* snapshot, const char* path, int format)
+{
+#ifndef MP_BACKTRACE
+	if (format == MP_EXPORT_PPROF)
+	{
+		MP_MESSAGE("Failed to export heap profile since pprof needs MP_BACKTRACE");
+		return -1;
+	}
+#endif
+	FILE* fp = fopen(path, "w");
+	if (fp == NULL)
+	{
+		char msg[MP_MSG_LEN];
+		snprintf(msg, sizeof msg, "Failed to open %s for exporting heap profile", path);
+		MP_MESSAGE(msg);
+		return -1;
+	}
+	if (format == MP_EXPORT_COLLAPSED)
+	{
+		for (size_t i = 0; i < snapshot->count; i++)
+		{
+			if (snapshot->sites[i].live_size > 0)
+				mp_write_collapsed(fp, &snapshot->sites[i]);
+		}
+	}
+#ifdef MP_BACKTRACE
+	else
+	{
+		mp_write_pprof(fp, snapshot);
+	}
+#endif
+	return fclose(fp) == 0 ? 0 : -1;
+}
+
+// Reports a block that has not been freed
+// Returns MP_VALIDATE_OVERFLOW if the padding of the block was overwritten, otherwise 0
+static int mp_report_leak(struct MemBlock* it)
+{
+	char msg[MP_MSG_LEN];
+	snprintf(msg, sizeof msg,
+			 "Memory block allocated at %s:%u with a size of %zu bytes has not been freed. Block was "
+			 "allocation num %u",
+			 mp_block_file(it), mp_block_line(it), it->size, it->count);
+	MP_MESSAGE(msg);
+#ifdef MP_CHECK_OVERFLOW
+	// Validate directly
+	// Check integrity of buffer padding to detect overflows/overruns
+	char* p = it->bytes + it->size;
+	for (size_t i = 0; i < MP_BUFFER_PAD_LEN; i++, p++)
+	{
+		if (*p != MP_BUFFER_PAD_VAL)
+		{
+			snprintf(msg, sizeof msg, "Buffer overflow after %zu bytes on pointer %p allocated at %s:%u", it->size,
+					 it->bytes, mp_block_file(it), mp_block_line(it));
+			MP_MESSAGE(msg);
+			return MP_VALIDATE_OVERFLOW;
+		}
+	}
+#endif
+	return 0;
 }
 
 size_t mp_terminate()
@@ -346,67 +1058,99 @@ size_t mp_terminate()
 	size_t remaining_blocks = 0;
 
 	// Free remaining blocks
-	for (size_t i = 0; i < mp_hashtable.size; i++)
+	for (size_t s = 0; s < MP_SHARDS; s++)
 	{
-		struct MemBlock* it = mp_hashtable.items[i];
-		struct MemBlock* next = NULL;
-		while (it)
+		struct MPShard* shard = &mp_shards[s].shard;
+		MP_LOCK(&shard->lock);
+#ifdef MP_HEADER_LOOKUP
+		for (struct MemBlock* it = shard->blocks; it; it = it->next)
 		{
 			remaining_blocks++;
-			next = it->next;
-			snprintf(msg, sizeof msg,
-					 "Memory block allocated at %s:%u with a size of %zu bytes has not been freed. Block was "
-					 "allocation num %u",
-					 it->file, it->line, it->size, it->count);
-			MP_MESSAGE(msg);
-			// Validate directly
-			// Check integrity of buffer padding to detect overflows/overruns
-			size_t i = 0;
-			char* p = it->bytes + it->size;
-			for (i = 0; i < MP_BUFFER_PAD_LEN; i++, p++)
+			if (mp_report_leak(it))
 			{
-				if (*p != MP_BUFFER_PAD_VAL)
+				MP_UNLOCK(&shard->lock);
+				return MP_VALIDATE_OVERFLOW;
+			}
+			// The locations are freed below, the block can still be freed or reported again later
+			it->location = NULL;
+		}
+#else
+		for (size_t i = 0; i < shard->table.size; i++)
+		{
+			for (struct MemBlock* it = shard->table.items[i]; it; it = it->next)
+			{
+				remaining_blocks++;
+				if (mp_report_leak(it))
 				{
-					char msg[MP_MSG_LEN];
-					snprintf(msg, sizeof msg, "Buffer overflow after %zu bytes on pointer %p allocated at %s:%u",
-							 it->size, it->bytes, it->file, it->line);
-					MP_MESSAGE(msg);
+					MP_UNLOCK(&shard->lock);
 					return MP_VALIDATE_OVERFLOW;
 				}
 			}
-			//free(it);
-			it = next;
 		}
+		if (shard->table.items)
+		{
+			free(shard->table.items);
+			shard->table.items = NULL;
+			shard->table.count = 0;
+			shard->table.size = 0;
+		}
+#endif
+#ifdef MP_SAMPLE
+		for (uint32_t i = 0; i < MP_SAMPLE_FREED; i++)
+		{
+			free(shard->freed[i]);
+			shard->freed[i] = NULL;
+		}
+		shard->freed_next = 0;
+#endif
+		MP_UNLOCK(&shard->lock);
 	}
+#ifdef MP_SAMPLE
+	// Only the sampled blocks are known, the count of all blocks is exact
+	snprintf(msg, sizeof msg,
+			 "A total of %zu memory blocks remain to be freed after program execution, %zu of them sampled, an "
+			 "estimated %zu bytes",
+			 mp_get_count(), remaining_blocks, mp_get_size());
+	MP_MESSAGE(msg);
+	remaining_blocks = mp_get_count();
+#else
 	snprintf(msg, sizeof msg, "A total of %zu memory blocks remain to be freed after program execution",
 			 remaining_blocks);
 	MP_MESSAGE(msg);
-	if (mp_hashtable.items)
-	{
-		free(mp_hashtable.items);
-		mp_hashtable.items = NULL;
-		mp_hashtable.count = 0;
-		mp_hashtable.size = 0;
-	}
+#endif
 
-	// Free the location list
-	struct MPAllocLocation* it = mp_locations;
-	struct MPAllocLocation* next = NULL;
-	while (it)
+	// Free the locations, no other thread may allocate during termination
+	for (size_t i = 0; i < MP_LOCATION_BUCKETS; i++)
 	{
-		next = it->next;
-		free(it);
-		it = next;
+		struct MPAllocLocation* it = MP_LOAD_ACQUIRE(mp_locations[i]);
+		struct MPAllocLocation* next = NULL;
+		while (it)
+		{
+			next = it->next;
+			free(it);
+			it = next;
+		}
+		mp_locations[i] = NULL;
 	}
-	mp_locations = NULL;
 	return remaining_blocks;
 }
 
 int mp_validate_internal(void* ptr, const char* file, uint32_t line)
 {
-	struct MemBlock* block = mp_search(ptr);
+	struct MPShard* shard = mp_shard(ptr);
+	MP_LOCK(&shard->lock);
+	struct MemBlock* block = mp_shard_search(shard, ptr);
+#ifdef MP_SAMPLE
+	// Allocations that were not sampled can not be checked
+	if (block == NULL && !mp_sample_freed(shard, ptr))
+	{
+		MP_UNLOCK(&shard->lock);
+		return MP_VALIDATE_OK;
+	}
+#endif
 	if (block == NULL)
 	{
+		MP_UNLOCK(&shard->lock);
 		char msg[MP_MSG_LEN];
 		snprintf(msg, sizeof msg, "%s:%u Validation of invalid or already freed pointer with adress %p", file, line,
 				 ptr);
@@ -423,24 +1167,52 @@ int mp_validate_internal(void* ptr, const char* file, uint32_t line)
 		{
 			char msg[MP_MSG_LEN];
 			snprintf(msg, sizeof msg, "Buffer overflow after %zu bytes on pointer %p allocated at %s:%u", block->size,
-					 ptr, block->file, block->line);
+					 ptr, mp_block_file(block), mp_block_line(block));
 			MP_MESSAGE(msg);
+			MP_UNLOCK(&shard->lock);
 			return MP_VALIDATE_OVERFLOW;
 		}
 	}
 #endif
+	MP_UNLOCK(&shard->lock);
 	return MP_VALIDATE_OK;
 }
 
-void* mp_malloc_internal(size_t size, const char* file, uint32_t line)
+// Captures the call stack of the caller of the magpie function calling this
+static MP_NOINLINE void mp_capture(struct MPStack* stack)
 {
-	// Allocate size for the block info and the buffer requested
-	struct MemBlock* new_block = malloc(sizeof(struct MemBlock) + size - 1 + MP_BUFFER_PAD_LEN);
+#ifdef MP_BACKTRACE
+	void* frames[MP_BACKTRACE_DEPTH + 2];
+	int depth = backtrace(frames, MP_BACKTRACE_DEPTH + 2);
+	// Skip this function and the magpie function
+	stack->depth = depth > 2 ? depth - 2 : 0;
+	memcpy(stack->frames, frames + 2, stack->depth * sizeof(*frames));
+#else
+	stack->depth = 0;
+#endif
+}
 
-// Fill the padding with MP_BUFFER_PAD_VAL
-#ifdef MP_CHECK_OVERFLOW
-	memset(new_block->bytes + size, MP_BUFFER_PAD_VAL, MP_BUFFER_PAD_LEN);
+// Counts and inserts a new block into the shard of its pointer
+static void mp_track(struct MemBlock* block, const char* file, uint32_t line, const struct MPStack* stack)
+{
+	struct MPShard* shard = mp_shard(block->bytes);
+	MP_LOCK(&shard->lock);
+	mp_count_alloc(shard, block->size);
+	mp_shard_insert(shard, block);
+	MP_UNLOCK(&shard->lock);
+	mp_locate(block, file, line, stack);
+}
+
+MP_NOINLINE void* mp_malloc_internal(size_t size, const char* file, uint32_t line)
+{
+#ifdef MP_SAMPLE
+	if (!mp_sample(size))
+		return mp_untracked(malloc(size), size, file, line);
 #endif
+	struct MPStack stack;
+	mp_capture(&stack);
+	// Allocate size for the block info and the buffer requested
+	struct MemBlock* new_block = malloc(sizeof(struct MemBlock) + size - 1 + MP_BUFFER_PAD_LEN);
 
 	// Allocate request
 	if (new_block == NULL)
@@ -450,30 +1222,30 @@ void* mp_malloc_internal(size_t size, const char* file, uint32_t line)
 		MP_MESSAGE(msg);
 		return NULL;
 	}
-	mp_total_alloc_count++;
-	mp_total_alloc_size += size;
-	mp_alloc_count++;
-	mp_alloc_size += size;
+
+// Fill the padding with MP_BUFFER_PAD_VAL
+#ifdef MP_CHECK_OVERFLOW
+	memset(new_block->bytes + size, MP_BUFFER_PAD_VAL, MP_BUFFER_PAD_LEN);
+#endif
 	new_block->size = size;
-	new_block->file = file;
-	new_block->line = line;
 	new_block->next = NULL;
 
 	// Insert
-	mp_insert(new_block, file, line);
+	mp_track(new_block, file, line, &stack);
 
 	return new_block->bytes;
 }
-void* mp_calloc_internal(size_t num, size_t size, const char* file, uint32_t line)
+MP_NOINLINE void* mp_calloc_internal(size_t num, size_t size, const char* file, uint32_t line)
 {
+#ifdef MP_SAMPLE
+	if (!mp_sample(num * size))
+		return mp_untracked(calloc(num, size), num * size, file, line);
+#endif
+	struct MPStack stack;
+	mp_capture(&stack);
 	// Allocate size for the block info and the buffer requested
 	struct MemBlock* new_block = calloc(1, sizeof(struct MemBlock) + num * size - 1 + MP_BUFFER_PAD_LEN);
 
-	// Fill the padding with MP_BUFFER_PAD_VAL
-#ifdef MP_CHECK_OVERFLOW
-	memset(new_block->bytes + num * size, MP_BUFFER_PAD_VAL, MP_BUFFER_PAD_LEN);
-#endif
-
 	// Allocate request
 
 	if (new_block == NULL)
@@ -483,20 +1255,19 @@ void* mp_calloc_internal(size_t num, size_t size, const char* file, uint32_t lin
 		MP_MESSAGE(msg);
 		return NULL;
 	}
-	mp_total_alloc_count++;
-	mp_total_alloc_size += num * size;
-	mp_alloc_count++;
-	mp_alloc_size += num * size;
+
+	// Fill the padding with MP_BUFFER_PAD_VAL
+#ifdef MP_CHECK_OVERFLOW
+	memset(new_block->bytes + num * size, MP_BUFFER_PAD_VAL, MP_BUFFER_PAD_LEN);
+#endif
 	new_block->size = num * size;
-	new_block->file = file;
-	new_block->line = line;
 	new_block->next = NULL;
 	// Insert
-	mp_insert(new_block, file, line);
+	mp_track(new_block, file, line, &stack);
 
 	return new_block->bytes;
 }
-void* mp_realloc_internal(void* ptr, size_t size, const char* file, uint32_t line)
+MP_NOINLINE void* mp_realloc_internal(void* ptr, size_t size, const char* file, uint32_t line)
 {
 	// Allocate if ptr is NULL
 	if (ptr == NULL)
@@ -508,17 +1279,44 @@ void* mp_realloc_internal(void* ptr, size_t size, const char* file, uint32_t lin
 		mp_free_internal(ptr, file, line);
 		return NULL;
 	}
-	struct MemBlock* block = mp_remove(ptr);
+	struct MPShard* shard = mp_shard(ptr);
+	MP_LOCK(&shard->lock);
+	struct MemBlock* block = mp_shard_remove(shard, ptr);
+#ifdef MP_SAMPLE
+	// Allocations that were not sampled stay untracked
+	if (block == NULL && !mp_sample_freed(shard, ptr))
+	{
+		MP_UNLOCK(&shard->lock);
+		void* new_ptr = realloc(ptr, size);
+		if (new_ptr == NULL)
+		{
+			char msg[MP_MSG_LEN];
+			snprintf(msg, sizeof msg, "%s:%u Failed to reallocate memory to %zu bytes", file, line, size);
+			MP_MESSAGE(msg);
+			return NULL;
+		}
+		// The block may move to another shard
+		MP_COUNTER_SUB(shard->counters.count, 1);
+		shard = mp_shard(new_ptr);
+		MP_COUNTER_ADD(shard->counters.count, 1);
+		MP_COUNTER_ADD(shard->counters.total_size, size);
+		return new_ptr;
+	}
+#endif
 	if (block == NULL)
 	{
+		MP_UNLOCK(&shard->lock);
 		char msg[MP_MSG_LEN];
 		snprintf(msg, sizeof msg, "%s:%u Reallocating invalid or already freed pointer with adress %p", file, line,
 				 ptr);
 		MP_MESSAGE(msg);
 		return NULL;
 	}
-	mp_total_alloc_size -= block->size;
-	mp_alloc_size -= block->size;
+	MP_COUNTER_SUB(shard->counters.total_size, block->size);
+	MP_COUNTER_SUB(shard->counters.size, block->size);
+	MP_COUNTER_SUB(shard->counters.count, 1);
+	MP_UNLOCK(&shard->lock);
+	mp_unlocate(block);
 	struct MemBlock* new_block = realloc(block, sizeof(struct MemBlock) + size - 1 + MP_BUFFER_PAD_LEN);
 	if (new_block == NULL)
 	{
@@ -529,10 +1327,18 @@ void* mp_realloc_internal(void* ptr, size_t size, const char* file, uint32_t lin
 		MP_MESSAGE(msg);
 		return NULL;
 	}
-	mp_insert(new_block, file, line);
-	mp_total_alloc_size += size;
+	// The size is set before inserting since sampled locations are weighted by it
 	new_block->size = size;
-	mp_alloc_size += size;
+	shard = mp_shard(new_block->bytes);
+	MP_LOCK(&shard->lock);
+	MP_COUNTER_ADD(shard->counters.total_size, size);
+	MP_COUNTER_ADD(shard->counters.size, size);
+	MP_COUNTER_ADD(shard->counters.count, 1);
+	mp_shard_insert(shard, new_block);
+	MP_UNLOCK(&shard->lock);
+	struct MPStack stack;
+	mp_capture(&stack);
+	mp_locate(new_block, file, line, &stack);
 #ifdef MP_CHECK_OVERFLOW
 	memset(new_block->bytes + size, MP_BUFFER_PAD_VAL, MP_BUFFER_PAD_LEN);
 #endif
@@ -547,16 +1353,30 @@ void mp_free_internal(void* ptr, const char* file, uint32_t line)
 		return;
 	}
 #endif
-	struct MemBlock* block = mp_remove(ptr);
+	struct MPShard* shard = mp_shard(ptr);
+	MP_LOCK(&shard->lock);
+	struct MemBlock* block = mp_shard_remove(shard, ptr);
+#ifdef MP_SAMPLE
+	if (block == NULL && ptr && !mp_sample_freed(shard, ptr))
+	{
+		MP_COUNTER_SUB(shard->counters.count, 1);
+		MP_UNLOCK(&shard->lock);
+		free(ptr);
+		return;
+	}
+#endif
 	if (block == NULL)
 	{
+		MP_UNLOCK(&shard->lock);
 		char msg[MP_MSG_LEN];
 		snprintf(msg, sizeof msg, "%s:%u Freeing invalid or already freed pointer with adress %p", file, line, ptr);
 		MP_MESSAGE(msg);
 		return;
 	}
-	mp_alloc_count--;
-	mp_alloc_size -= block->size;
+	MP_COUNTER_SUB(shard->counters.count, 1);
+	MP_COUNTER_SUB(shard->counters.size, block->size);
+	MP_UNLOCK(&shard->lock);
+	mp_unlocate(block);
 
 #ifdef MP_CHECK_OVERFLOW
 	// Check integrity of buffer padding to detect overflows/overruns
@@ -568,7 +1388,7 @@ void mp_free_internal(void* ptr, const char* file, uint32_t line)
 		{
 			char msg[MP_MSG_LEN];
 			snprintf(msg, sizeof msg, "Buffer overflow after %zu bytes on pointer %p allocated at %s:%u", block->size,
-					 ptr, block->file, block->line);
+					 ptr, mp_block_file(block), mp_block_line(block));
 			MP_MESSAGE(msg);
 			break;
 		}
@@ -577,45 +1397,55 @@ void mp_free_internal(void* ptr, const char* file, uint32_t line)
 #ifdef MP_FILL_ON_FREE
 	memset(block->bytes, MP_BUFFER_PAD_VAL, block->size);
 #endif
+#ifdef MP_SAMPLE
+	mp_sample_retire(shard, block);
+#else
 	free(block);
+#endif
 }
 
-void* mp_bind_internal(void* ptr, const char* file, uint32_t line)
+MP_NOINLINE void* mp_bind_internal(void* ptr, const char* file, uint32_t line)
 {
-	struct MemBlock* block = mp_remove(ptr);
-	block->file = file;
-	block->line = line;
+	struct MPShard* shard = mp_shard(ptr);
+	MP_LOCK(&shard->lock);
+	struct MemBlock* block = mp_shard_search(shard, ptr);
+	MP_UNLOCK(&shard->lock);
+	// The block belongs to the caller, it can not be freed while it is moved to the new location
 	if (block)
 	{
-		mp_insert(block, file, line);
-		return ptr;
+		struct MPStack stack;
+		mp_capture(&stack);
+		mp_unlocate(block);
+		mp_locate(block, file, line, &stack);
 	}
 
 	return ptr;
 }
 
-void mp_insert(struct MemBlock* block, const char* file, uint32_t line)
+#ifndef MP_HEADER_LOOKUP
+void mp_insert(struct MPHashTable* table, struct MemBlock* block)
 {
 	block->next = NULL;
 	// Hash the pointer
-	if (mp_hashtable.size == 0)
+	if (table->size == 0)
 	{
-		mp_hashtable.size = 16;
-		mp_hashtable.items = calloc(mp_hashtable.size, sizeof(*mp_hashtable.items));
+		table->size = 16;
+		table->items = calloc(table->size, sizeof(*table->items));
 	}
-	if (mp_hashtable.count + 1 >= mp_hashtable.size * 0.7)
+	if (table->count + 1 >= table->size * 0.7)
 	{
-		mp_resize(1);
+		mp_resize(table, 1);
 	}
 	{
 		// Takes the hash of the bytes pointer of the block
-		size_t hash = mp_hash_ptr(block->bytes);
-		struct MemBlock* it = mp_hashtable.items[hash];
+		// Since size is a power of two, it is faster than modulo
+		size_t hash = mp_hash_ptr(block->bytes) & (table->size - 1);
+		struct MemBlock* it = table->items[hash];
 
 		if (it == NULL)
 		{
-			mp_hashtable.items[hash] = block;
-			mp_hashtable.count++;
+			table->items[hash] = block;
+			table->count++;
 		}
 
 		// Chain if hash collision
@@ -628,89 +1458,131 @@ void mp_insert(struct MemBlock* block, const char* file, uint32_t line)
 			it->next = block;
 		}
 	}
-	// Items are being reinserted
-	if (file == NULL)
-	{
-		return;
-	}
-	// Location
-	if (mp_locations == NULL)
-	{
-		mp_locations = malloc(sizeof(struct MPAllocLocation));
-		mp_locations->count = 0;
-		mp_locations->file = file;
-		mp_locations->line = line;
-		mp_locations->prev = NULL;
-		mp_locations->next = NULL;
-		block->count = mp_locations->count++;
-		return;
-	}
-	struct MPAllocLocation* it = mp_locations;
-	while (it)
-	{
+}
 
-		if (it->file == file && it->line == line)
-		{
-			block->count = it->count++;
+#endif
 
-			// Make sure it is always sorted by biggest on head
-			while (it->prev && it->prev->count < it->count)
-			{
-				struct MPAllocLocation* prev = it->prev;
-				// Head is changing
-				if (prev->prev == NULL)
-				{
-					mp_locations->prev = it;
-					mp_locations->next = it->next;
-					if (it->next)
-						it->next->prev = mp_locations;
-					it->next = mp_locations;
-					mp_locations = it;
-					it->prev = NULL;
-					break;
-				}
-				prev->next = it->next;
-				it->prev = prev->prev;
-				prev->prev->next = it;
-				prev->prev = it;
+// Returns 1 if the location is file:line called from stack
+static int mp_location_is(struct MPAllocLocation* location, const char* file, uint32_t line, const struct MPStack* stack)
+{
+	if (location->file != file || location->line != line)
+		return 0;
+#ifdef MP_BACKTRACE
+	return location->depth == stack->depth &&
+		   memcmp(location->frames, stack->frames, stack->depth * sizeof(*stack->frames)) == 0;
+#else
+	(void)stack;
+	return 1;
+#endif
+}
+
+// Finds the location of file:line called from stack or inserts it
+// Returns NULL if a new location could not be allocated
+static struct MPAllocLocation* mp_location_get(const char* file, uint32_t line, const struct MPStack* stack)
+{
+	// Files are string literals, so the pointer identifies the file
+	uint64_t key = ((uint64_t)(uintptr_t)file ^ ((uint64_t)line << 32 | line)) * 0x9E3779B97F4A7C15;
+#ifdef MP_BACKTRACE
+	for (uint32_t i = 0; i < stack->depth; i++)
+		key = (key ^ (uint64_t)(uintptr_t)stack->frames[i]) * 0x9E3779B97F4A7C15;
+#endif
+	MP_ATOMIC(struct MPAllocLocation*)* bucket = &mp_locations[(key >> 32) & (MP_LOCATION_BUCKETS - 1)];
 
-				it->next = prev;
+	struct MPAllocLocation* head = MP_LOAD_ACQUIRE(*bucket);
+	struct MPAllocLocation* searched = NULL;
+	struct MPAllocLocation* new_location = NULL;
+	while (1)
+	{
+		// Only the part of the chain that was not searched yet needs to be checked
+		for (struct MPAllocLocation* it = head; it != searched; it = it->next)
+		{
+			if (mp_location_is(it, file, line, stack))
+			{
+				free(new_location);
+				return it;
 			}
-			return;
 		}
-		// At end
-		if (it->next == NULL)
+		searched = head;
+
+		if (new_location == NULL)
 		{
-			struct MPAllocLocation* new_location = malloc(sizeof(struct MPAllocLocation));
-			new_location->count = 0;
+			new_location = calloc(1, sizeof(struct MPAllocLocation));
+			if (new_location == NULL)
+			{
+				MP_MESSAGE("Failed to allocate memory for allocation location");
+				return NULL;
+			}
 			new_location->file = file;
 			new_location->line = line;
-			new_location->prev = it;
-			new_location->next = NULL;
-			it->next = new_location;
-			block->count = new_location->count++;
-
-			return;
+#ifdef MP_BACKTRACE
+			new_location->depth = stack->depth;
+			memcpy(new_location->frames, stack->frames, stack->depth * sizeof(*stack->frames));
+#endif
 		}
-		it = it->next;
+		new_location->next = head;
+		// Another thread may insert into the bucket first, head is then updated and searched again
+		if (MP_CAS(*bucket, head, new_location))
+			return new_location;
 	}
 }
 
-void mp_resize(int direction)
+void mp_locate(struct MemBlock* block, const char* file, uint32_t line, const struct MPStack* stack)
 {
-	size_t old_size = mp_hashtable.size;
+	struct MPAllocLocation* location = mp_location_get(file, line, stack);
+	block->location = location;
+	if (location == NULL)
+	{
+		block->count = 0;
+		return;
+	}
+	block->count = MP_COUNTER_FETCH_ADD(location->count, 1);
+#ifdef MP_SAMPLE
+	size_t weight = (size_t)(mp_sample_weight(block->size) + 0.5);
+	size_t bytes = mp_sample_bytes(block->size);
+	MP_COUNTER_ADD(mp_sample_size, bytes);
+#else
+	size_t weight = 1;
+	size_t bytes = block->size;
+#endif
+	MP_COUNTER_ADD(location->alloc_count, weight);
+	MP_COUNTER_ADD(location->alloc_size, bytes);
+	MP_COUNTER_ADD(location->live_count, weight);
+	MP_COUNTER_ADD(location->live_size, bytes);
+}
+
+void mp_unlocate(struct MemBlock* block)
+{
+	struct MPAllocLocation* location = block->location;
+	if (location == NULL)
+		return;
+#ifdef MP_SAMPLE
+	size_t weight = (size_t)(mp_sample_weight(block->size) + 0.5);
+	size_t bytes = mp_sample_bytes(block->size);
+	MP_COUNTER_SUB(mp_sample_size, bytes);
+#else
+	size_t weight = 1;
+	size_t bytes = block->size;
+#endif
+	MP_COUNTER_SUB(location->live_count, weight);
+	MP_COUNTER_SUB(location->live_size, bytes);
+}
+
+#ifndef MP_HEADER_LOOKUP
+void mp_resize(struct MPHashTable* table, int direction)
+{
+	size_t old_size = table->size;
 	if (direction == 1)
-		mp_hashtable.size *= 2;
+		table->size *= 2;
 	else if (direction == -1)
-		mp_hashtable.size /= 2;
+		table->size /= 2;
 	else
 		return;
 
-	struct MemBlock** old_items = mp_hashtable.items;
-	mp_hashtable.items = calloc(mp_hashtable.size, sizeof(struct MemBlock*));
+	struct MemBlock** old_items = table->items;
+	table->items = calloc(table->size, sizeof(struct MemBlock*));
 
 	// Count will be reincreased when reinserting items
-	mp_hashtable.count = 0;
+	table->count = 0;
 	// Rehash and insert
 	for (size_t i = 0; i < old_size; i++)
 	{
@@ -720,17 +1592,19 @@ void mp_resize(int direction)
 		while (it)
 		{
 			next = it->next;
-			mp_insert(it, NULL, 0);
+			mp_insert(table, it);
 			it = next;
 		}
 	}
 	free(old_items);
 }
 
-struct MemBlock* mp_search(void* ptr)
+struct MemBlock* mp_search(struct MPHashTable* table, void* ptr)
 {
-	size_t hash = mp_hash_ptr(ptr);
-	struct MemBlock* it = mp_hashtable.items[hash];
+	if (table->size == 0)
+		return NULL;
+	size_t hash = mp_hash_ptr(ptr) & (table->size - 1);
+	struct MemBlock* it = table->items[hash];
 
 	// Search chain for the correct pointer
 	while (it)
@@ -744,10 +1618,12 @@ struct MemBlock* mp_search(void* ptr)
 	return NULL;
 }
 
-struct MemBlock* mp_remove(void* ptr)
+struct MemBlock* mp_remove(struct MPHashTable* table, void* ptr)
 {
-	size_t hash = mp_hash_ptr(ptr);
-	struct MemBlock* it = mp_hashtable.items[hash];
+	if (table->size == 0)
+		return NULL;
+	size_t hash = mp_hash_ptr(ptr) & (table->size - 1);
+	struct MemBlock* it = table->items[hash];
 	struct MemBlock* prev = NULL;
 
 	// Search chain for the correct pointer
@@ -757,20 +1633,21 @@ struct MemBlock* mp_remove(void* ptr)
 		{
 			// Bucket gets removed, no more left in chain
 			if (it->next == NULL)
-				mp_hashtable.count--;
+				table->count--;
 			if (prev) // Has a parent remove and reconnect chain
 			{
 				prev->next = it->next;
 			}
 			else // First one one chain, change head
 			{
-				mp_hashtable.items[hash] = it->next;
+				table->items[hash] = it->next;
 			}
 
 			// Check for resize down
-			if (mp_hashtable.count - 1 <= mp_hashtable.size * 0.4)
+			// A sampled table often holds few blocks, keep it at the initial size
+			if (table->size > 16 && table->count - 1 <= table->size * 0.4)
 			{
-				mp_resize(-1);
+				mp_resize(table, -1);
 			}
 
 			return it;
@@ -780,6 +1657,56 @@ struct MemBlock* mp_remove(void* ptr)
 	}
 	return NULL;
 }
+
+static void mp_shard_insert(struct MPShard* shard, struct MemBlock* block)
+{
+	mp_insert(&shard->table, block);
+}
+
+static struct MemBlock* mp_shard_search(struct MPShard* shard, void* ptr)
+{
+	return mp_search(&shard->table, ptr);
+}
+
+static struct MemBlock* mp_shard_remove(struct MPShard* shard, void* ptr)
+{
+	return mp_remove(&shard->table, ptr);
+}
+#else
+static void mp_shard_insert(struct MPShard* shard, struct MemBlock* block)
+{
+	block->magic = MP_MAGIC ^ (uintptr_t)block;
+	block->prev = NULL;
+	block->next = shard->blocks;
+	if (shard->blocks)
+		shard->blocks->prev = block;
+	shard->blocks = block;
+}
+
+static struct MemBlock* mp_shard_search(__attribute__((unused)) struct MPShard* shard, void* ptr)
+{
+	if (ptr == NULL)
+		return NULL;
+	struct MemBlock* block = (struct MemBlock*)((char*)ptr - offsetof(struct MemBlock, bytes));
+	return block->magic == (MP_MAGIC ^ (uintptr_t)block) ? block : NULL;
+}
+
+static struct MemBlock* mp_shard_remove(struct MPShard* shard, void* ptr)
+{
+	struct MemBlock* block = mp_shard_search(shard, ptr);
+	if (block == NULL)
+		return NULL;
+	// A second free of the block finds no magic
+	block->magic = 0;
+	if (block->prev)
+		block->prev->next = block->next;
+	else
+		shard->blocks = block->next;
+	if (block->next)
+		block->next->prev = block->prev;
+	return block;
+}
+#endif
 #endif
 #endif
 
@@ -12,17 +12,73 @@
 
 // When the last element allocated from a pool is freed, the internal blocks are also freed
 // This means that there is no need to pool cleanup at program termination to not leak memory
+// Set retain_blocks to keep some of them for pools that often become empty
+
+// Options are set on the pool after MEMPOOL_INIT and before the first allocation
+// mypool.retain_blocks = 1;
+// mypool.flags = MEMPOOL_GROW;
+
+// Aligned elements
+// mempool_t mypool = MEMPOOL_INIT_ALIGNED(sizeof(MyType), 128, MEMPOOL_CACHE_LINE);
+// Every element starts on its own cache line, so elements used by different threads do not share lines
+
+// Variable sized allocations
+// mempool_arena_t is a bump allocator over chained blocks, everything allocated is freed at once
+// mempool_arena_t arena = MEMPOOL_ARENA_INIT(4096);
+// mempool_arena_mark_t mark = mempool_arena_mark(&arena);
+// char* str = mempool_arena_alloc(&arena, len + 1, 1);
+// mempool_arena_reset(&arena, mark);
+// mempool_sized_t routes allocations of up to 256 bytes to pools of 16, 32, 64, 128, and 256 bytes
+// It has malloc like alloc, realloc and free functions and can be used for allocation hooks like JSON_MALLOC
+// #define JSON_MALLOC(s) mempool_sized_alloc(&sized, s)
+// #define JSON_REALLOC(p, s) mempool_sized_realloc(&sized, p, s)
+// #define JSON_FREE(p) mempool_sized_free(&sized, p)
+
+// Page providers
+// Blocks are allocated with MEMPOOL_MALLOC unless the pool has a provider
+// mypool.provider = &mempool_hugepages;
+// A provider allocates and frees whole blocks and gets the size of the block for both
+
+// Instrumentation
+// mempool_stats_t stats;
+// mempool_stats(&mypool, &stats);
+// mempool_occupancy(&mypool, histogram, 11);
+// Both walk the free list and blocks, they are meant for tuning and debugging and not for hot paths
+
+// Sharing a pool between threads
+// Define MEMPOOL_THREADSAFE in every file including mempool.h and set the MEMPOOL_SHARED flag on the pool
+// Every thread using the pool gets a cache of two magazines of free elements, most allocs and frees only touch those
+// Full and empty magazines are traded with a depot shared by the threads, which is the only part behind a lock
+// Elements can be freed on any thread, they return to the pool through the cache of the freeing thread
+// Every shared pool uses a pthread key, see PTHREAD_KEYS_MAX
+// The blocks of a shared pool are not freed when the last element is freed, use mempool_destroy
 
 // CONFIGURATION
-// MEMPOOL_MALLOC to define your own allocator used to allocate the pool
-// MEMPOOL_REALLOC to define your own allocator used to allocate the pool blocks
+// MEMPOOL_MALLOC to define your own allocator used to allocate the pool blocks
+// MEMPOOL_REALLOC to define your own allocator used to allocate the block list
 // MEMPOOL_FREE to define your own dealloctor when freeing the pool
 // Note: custom allocators should have similar behavious as malloc, realloc, and free
 // MEMPOOL_MESSAGE (default fputs(s, stderr) to define your own error message callback
 // MEMPOOL_MAGPIE to allow magpie to track where the mempool_alloc originated from
+// MEMPOOL_MAX_BLOCK_SIZE (default 16 MiB) sets the size at which blocks of a MEMPOOL_GROW pool stop doubling
+// MEMPOOL_THREADSAFE to allow pools to be shared between threads with MEMPOOL_SHARED, requires pthreads
+// MEMPOOL_MAGAZINE_SIZE (default 32) sets how many free elements each magazine of a thread cache holds
+// MEMPOOL_HUGEPAGES to define mempool_hugepages, a provider mapping huge pages with mmap, requires a POSIX system
+// -> Tries MAP_HUGETLB first and falls back to a normal mapping advised to use transparent huge pages
+// -> Block sizes are rounded up to MEMPOOL_HUGE_PAGE_SIZE, use blocks of a multiple of it
+// MEMPOOL_HUGE_PAGE_SIZE (default 2 MiB) sets the huge page size mempool_hugepages rounds to
+// MEMPOOL_STATS to count allocations, frees and the high-water mark of every pool for mempool_stats
+// -> Without it those fields of mempool_stats_t are 0 and alloc and free do no extra work
+// -> Adds the counters to mempool_t, define it in every file including mempool.h so they agree on its layout
 
 #ifndef MEMPOOL_H
 #define MEMPOOL_H
+#include <stddef.h>
+#include <stdint.h>
+#ifdef MEMPOOL_THREADSAFE
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
 
 struct mempool_free
 {
@@ -30,33 +86,141 @@ struct mempool_free
 	struct mempool_free* next;
 };
 
+// Flag to double the size of every new block, up to MEMPOOL_MAX_BLOCK_SIZE
+// A pool growing to n elements then needs O(log n) blocks instead of O(n)
+#define MEMPOOL_GROW 1
+
+// Alignment to give elements a cache line each
+#define MEMPOOL_CACHE_LINE 64
+
+// Allocates and frees the blocks of a pool
+// dealloc gets the same size as alloc was called with
+typedef struct mempool_provider
+{
+	void* (*alloc)(size_t size, void* ctx);
+	void (*dealloc)(void* block, size_t size, void* ctx);
+	void* ctx;
+} mempool_provider_t;
+
+#ifdef MEMPOOL_HUGEPAGES
+extern const mempool_provider_t mempool_hugepages;
+#endif
+
+#ifdef MEMPOOL_THREADSAFE
+// Flag to allow allocating and freeing from several threads at once
+#define MEMPOOL_SHARED 2
+
+#ifndef MEMPOOL_MAGAZINE_SIZE
+#define MEMPOOL_MAGAZINE_SIZE 32
+#endif
+
+// A stack of free elements
+struct mempool_magazine
+{
+	// Links magazines in the depot
+	struct mempool_magazine* next;
+	uint32_t count;
+	void* elements[MEMPOOL_MAGAZINE_SIZE];
+};
+
+// The elements cached by one thread
+struct mempool_cache
+{
+	struct mempool_t* pool;
+	// Links all caches of a pool
+	struct mempool_cache* next;
+	// Allocs and frees use the loaded magazine, previous is swapped in when it runs empty or full
+	struct mempool_magazine* loaded;
+	struct mempool_magazine* previous;
+};
+#endif
+
 typedef struct mempool_t
 {
 	// The size of each individual elemen
 	uint32_t element_size;
 	// The size of each block in bytes (element_size * element_count)
+	// With MEMPOOL_GROW, the size of the first block
 	uint32_t block_size;
 	uint32_t block_count;
+	// How many blocks the block list has room for, grows by doubling
+	uint32_t block_capacity;
+	// The block new elements are taken from
+	// Blocks after it are retained blocks that are not yet used again
+	uint32_t block_current;
+	// The size of the current block in bytes
+	uint32_t block_current_size;
 	uint32_t alloc_count;
-	// How much of the last pool that is used, e.g an index to the available bytes in the last block
+	// How much of the current block that is used, e.g an index to the available bytes in the block
 	// This excludes freed blocks
 	// In terms of bytes
 	uint32_t block_end;
+	// How many blocks are kept when the last element is freed, 0 frees everything
+	uint32_t retain_blocks;
+	// MEMPOOL_GROW, MEMPOOL_SHARED, or 0
+	uint32_t flags;
+	// The alignment of every element and block
+	uint32_t alignment;
+	// Allocates the blocks instead of MEMPOOL_MALLOC if not NULL
+	const mempool_provider_t* provider;
 	// A list of fixed size buffers
 	uint8_t** blocks;
 	// A pointer to all free elements
 	struct mempool_free* free_elements;
+#ifdef MEMPOOL_STATS
+	// Every file needs to agree on MEMPOOL_STATS, like on MEMPOOL_THREADSAFE
+	// The most elements allocated at once
+	uint32_t high_water;
+	// Elements allocated and freed since the pool was initialized
+	uint64_t total_allocs;
+	uint64_t total_frees;
+#endif
+#ifdef MEMPOOL_THREADSAFE
+	// Protects the blocks, the free list and the depot of a shared pool
+	pthread_mutex_t lock;
+	// The cache of the calling thread
+	pthread_key_t key;
+	// Set when key has been created
+	atomic_int key_created;
+	// The depot, magazines that have elements and magazines that are empty
+	struct mempool_magazine* full;
+	struct mempool_magazine* empty;
+	// All thread caches, freed with the pool
+	struct mempool_cache* caches;
+#endif
 } mempool_t, Mempool;
 
+#ifdef MEMPOOL_THREADSAFE
+#define MEMPOOL_INIT_LOCK .lock = PTHREAD_MUTEX_INITIALIZER,
+#else
+#define MEMPOOL_INIT_LOCK
+#endif
+
+// Elements are at least aligned for the free list link
+#define MEMPOOL_ALIGNMENT(align) ((align) < sizeof(void*) ? sizeof(void*) : (size_t)(align))
+
+// The size of pool elements, which need to fit a free list link and are a multiple of the alignment
+#define MEMPOOL_ELEMENT_SIZE(elem_size, align)                                                  \
+	((((elem_size) < sizeof(struct mempool_free) ? sizeof(struct mempool_free) : (elem_size)) + \
+	  MEMPOOL_ALIGNMENT(align) - 1) &                                                           \
+	 ~(MEMPOOL_ALIGNMENT(align) - 1))
+
 // Statically initializes a memory pool
 // element_size describes how large every allocation will be in bytes
 // element_count describes how many elements each block can store before the pool allocates a new one
 // -> A higher value may uses more memory that is unused if allocations aren't filled but results in less fragmented memory and fewer allocations
-#define MEMPOOL_INIT(elem_size, elem_count)                                                                \
-	(mempool_t)                                                                                            \
-	{                                                                                                      \
-		.element_size = elem_size < sizeof(struct mempool_free) ? sizeof(struct mempool_free) : elem_size, \
-		.block_size = elem_size * elem_count                                                               \
+// Elements are aligned to the size of a pointer
+#define MEMPOOL_INIT(elem_size, elem_count) MEMPOOL_INIT_ALIGNED(elem_size, elem_count, sizeof(void*))
+
+// Initializes a pool where every element is aligned to align, which needs to be a power of two
+// The element size is rounded up to a multiple of align
+#define MEMPOOL_INIT_ALIGNED(elem_size, elem_count, align)                   \
+	(mempool_t)                                                              \
+	{                                                                        \
+		.element_size = MEMPOOL_ELEMENT_SIZE(elem_size, align),              \
+		.block_size = MEMPOOL_ELEMENT_SIZE(elem_size, align) * (elem_count), \
+		.alignment = MEMPOOL_ALIGNMENT(align),                               \
+		MEMPOOL_INIT_LOCK                                                    \
 	}
 
 // Returnes an element_size chunk of memory from the pool
@@ -64,15 +228,162 @@ typedef struct mempool_t
 #define mempool_alloc(pool) mempool_alloc_internal(pool, __FILE__, __LINE__)
 void* mempool_alloc_internal(mempool_t* pool, const char* file, uint32_t line);
 
+// Allocates n elements and writes them to out
+// Takes a chain from the free list and carves the rest from the current block in one go
+// Returns how many elements were allocated, less than n only if a block could not be allocated
+#define mempool_alloc_n(pool, out, n) mempool_alloc_n_internal(pool, out, n, __FILE__, __LINE__)
+uint32_t mempool_alloc_n_internal(mempool_t* pool, void** out, uint32_t n, const char* file, uint32_t line);
+
 // Frees a chunk from the pool
 // Note: element must be previosly allocated from the pool
-// If the allocated count reaches zero the internal blocks are freed
+// If the allocated count reaches zero the internal blocks are freed, except for the first retain_blocks
 void mempool_free(mempool_t* pool, void* element);
 
+// Frees n elements, they are linked and spliced onto the free list at once
+void mempool_free_n(mempool_t* pool, void** elements, uint32_t n);
+
+// Frees the blocks that are retained and not used
+// If the pool has no allocations left, all blocks are freed regardless of retain_blocks
+// A shared pool first returns the elements of the full magazines in the depot, thread caches are not touched
+void mempool_trim(mempool_t* pool);
+
+// Frees all blocks of the pool at once, including elements that are still allocated
+// The pool is left empty and can be used again
+// A shared pool also frees the caches of all threads, no other thread can use the pool during the call
+void mempool_destroy(mempool_t* pool);
+
+// A report of how a pool uses its memory
+typedef struct mempool_stats_t
+{
+	// Elements allocated and not freed
+	// A shared pool counts the elements in thread caches as live, those in the depot are in cached
+	uint32_t live;
+	// Elements on the free list
+	uint32_t free_count;
+	// Elements in the current and retained blocks that have not been handed out yet
+	uint32_t unused_count;
+	// Free elements in the full magazines of the depot of a shared pool
+	uint32_t cached;
+	uint32_t block_count;
+	// Bytes of all blocks
+	size_t reserved;
+	// Bytes of the live elements
+	size_t used;
+	// The share of handed out elements that are free, 0 when none are
+	// A high value with a low live count means the free elements are spread over the blocks
+	float fragmentation;
+	// Only counted with MEMPOOL_STATS, otherwise 0
+	// A shared pool counts the elements moving between the blocks and the caches
+	uint32_t high_water;
+	uint64_t total_allocs;
+	uint64_t total_frees;
+} mempool_stats_t;
+
+// Fills out with the current state of the pool
+// A shared pool is locked during the call
+void mempool_stats(mempool_t* pool, mempool_stats_t* out);
+
+// Counts the blocks of the pool by how many of their elements are live
+// histogram[0] counts the blocks with no live elements
+// The other bucket_count - 1 buckets split the rest evenly, the last one includes the full blocks
+// Elements cached by a shared pool count as live
+// bucket_count needs to be at least 2
+// Returns 0 if the temporary block list could not be allocated
+int mempool_occupancy(mempool_t* pool, uint32_t* histogram, uint32_t bucket_count);
+
+// A block of an arena, the allocations follow the header
+struct mempool_arena_block
+{
+	struct mempool_arena_block* prev;
+	// Usable bytes after the header
+	size_t size;
+	// Bytes allocated after the header
+	size_t used;
+};
+
+typedef struct mempool_arena_t
+{
+	// The size of every block, larger allocations get a block of their own
+	size_t block_size;
+	// The newest block, linked to older blocks through prev
+	struct mempool_arena_block* blocks;
+	// A freed block kept by mempool_arena_reset for reuse
+	struct mempool_arena_block* spare;
+} mempool_arena_t;
+
+// The state of an arena to return to, an empty mark resets everything
+typedef struct mempool_arena_mark_t
+{
+	struct mempool_arena_block* block;
+	size_t used;
+} mempool_arena_mark_t;
+
+#define MEMPOOL_ARENA_INIT(bsize)                                                                                      \
+	(mempool_arena_t)                                                                                                  \
+	{                                                                                                                  \
+		.block_size = (bsize)                                                                                          \
+	}
+
+// Allocates size bytes aligned to align, which needs to be a power of two
+// Takes from the newest block or chains a new one
+#define mempool_arena_alloc(arena, size, align) mempool_arena_alloc_internal(arena, size, align, __FILE__, __LINE__)
+void* mempool_arena_alloc_internal(mempool_arena_t* arena, size_t size, size_t align, const char* file, uint32_t line);
+
+// Returns the current state of the arena
+mempool_arena_mark_t mempool_arena_mark(mempool_arena_t* arena);
+
+// Frees everything allocated after mark was taken
+// Marks need to be reset in the reverse order they were taken
+void mempool_arena_reset(mempool_arena_t* arena, mempool_arena_mark_t mark);
+
+// Frees all blocks of the arena, the arena can be used again
+void mempool_arena_destroy(mempool_arena_t* arena);
+
+// The size classes of mempool_sized_t, 16 << class
+#define MEMPOOL_SIZE_CLASSES	 5
+#define MEMPOOL_SIZE_CLASS_MAX 256
+
+// Every allocation is preceded by a header holding its size class
+// Allocations are aligned to 8 bytes
+#define MEMPOOL_SIZED_HEADER 8
+
+typedef struct mempool_sized_t
+{
+	mempool_t pools[MEMPOOL_SIZE_CLASSES];
+} mempool_sized_t;
+
+// Initializes a size class allocator with elem_count elements per block of every class
+#define MEMPOOL_SIZED_INIT(elem_count)                                                                                 \
+	(mempool_sized_t)                                                                                                  \
+	{                                                                                                                  \
+		.pools = {                                                                                                     \
+			MEMPOOL_INIT(MEMPOOL_SIZED_HEADER + 16, elem_count),                                                       \
+			MEMPOOL_INIT(MEMPOOL_SIZED_HEADER + 32, elem_count),                                                       \
+			MEMPOOL_INIT(MEMPOOL_SIZED_HEADER + 64, elem_count),                                                       \
+			MEMPOOL_INIT(MEMPOOL_SIZED_HEADER + 128, elem_count),                                                      \
+			MEMPOOL_INIT(MEMPOOL_SIZED_HEADER + 256, elem_count),                                                      \
+		}                                                                                                              \
+	}
+
+// Allocates size bytes from the smallest class that fits, or with MEMPOOL_MALLOC if larger than 256 bytes
+#define mempool_sized_alloc(sized, size) mempool_sized_alloc_internal(sized, size, __FILE__, __LINE__)
+void* mempool_sized_alloc_internal(mempool_sized_t* sized, size_t size, const char* file, uint32_t line);
+
+// Resizes an allocation like realloc, moving it to another class if it does not fit its current one
+#define mempool_sized_realloc(sized, p, size) mempool_sized_realloc_internal(sized, p, size, __FILE__, __LINE__)
+void* mempool_sized_realloc_internal(mempool_sized_t* sized, void* p, size_t size, const char* file, uint32_t line);
+
+// Frees an allocation from mempool_sized_alloc, p can be NULL
+void mempool_sized_free(mempool_sized_t* sized, void* p);
+
+// Frees all pools, including allocations that are still live
+void mempool_sized_destroy(mempool_sized_t* sized);
+
 #ifdef MEMPOOL_IMPLEMENTATION
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #ifndef MEMPOOL_MALLOC
 #define MEMPOOL_MALLOC(s) malloc(s)
@@ -86,82 +397,907 @@ void mempool_free(mempool_t* pool, void* element);
 #ifndef MEMPOOL_MESSAGE
 #define MEMPOOL_MESSAGE(s) fputs(s, stderr)
 #endif
+#ifndef MEMPOOL_MAX_BLOCK_SIZE
+#define MEMPOOL_MAX_BLOCK_SIZE (UINT32_C(1) << 24)
+#endif
+#ifndef MEMPOOL_HUGE_PAGE_SIZE
+#define MEMPOOL_HUGE_PAGE_SIZE ((size_t)2 << 20)
+#endif
 
-// Returnes an element_size chunk of memory from the pool
-// Either tries to fill a freed spot, take at the end of a block, or malloc a new block
-void* mempool_alloc_internal(mempool_t* pool, const char* file, uint32_t line)
+// The alignment malloc guarantees, larger alignments are made by over allocating
+#define MEMPOOL_MALLOC_ALIGNMENT 16
+
+#ifdef MEMPOOL_HUGEPAGES
+#include <sys/mman.h>
+
+static void* mempool_hugepages_alloc(size_t size, void* ctx)
 {
-	// First check for freed blocks
-	if (pool->free_elements)
+	(void)ctx;
+	size = (size + MEMPOOL_HUGE_PAGE_SIZE - 1) & ~(MEMPOOL_HUGE_PAGE_SIZE - 1);
+	void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	// No huge pages are reserved, ask for transparent huge pages instead
+	if (p == MAP_FAILED)
 	{
-		void* p = pool->free_elements;
-		pool->free_elements = pool->free_elements->next;
-		++pool->alloc_count;
-		return p;
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		madvise(p, size, MADV_HUGEPAGE);
+#endif
+	}
+	return p;
+}
+
+static void mempool_hugepages_free(void* block, size_t size, void* ctx)
+{
+	(void)ctx;
+	munmap(block, (size + MEMPOOL_HUGE_PAGE_SIZE - 1) & ~(MEMPOOL_HUGE_PAGE_SIZE - 1));
+}
+
+const mempool_provider_t mempool_hugepages = {mempool_hugepages_alloc, mempool_hugepages_free, NULL};
+#endif
+
+// Returns the size in bytes of block index
+static uint32_t mempool_block_size(mempool_t* pool, uint32_t index)
+{
+	uint32_t size = pool->block_size;
+	if (pool->flags & MEMPOOL_GROW)
+	{
+		for (uint32_t i = 0; i < index && size <= MEMPOOL_MAX_BLOCK_SIZE / 2; i++)
+			size *= 2;
+	}
+	return size;
+}
+
+// Allocates a block of size bytes aligned to the pool alignment
+static uint8_t* mempool_block_alloc(mempool_t* pool, uint32_t size, const char* file, uint32_t line)
+{
+	if (pool->provider)
+		return pool->provider->alloc(size, pool->provider->ctx);
+
+	// Over allocate and store the pointer to free before the aligned block
+	size_t extra = pool->alignment > MEMPOOL_MALLOC_ALIGNMENT ? pool->alignment - 1 + sizeof(void*) : 0;
+	uint8_t* raw = MEMPOOL_MALLOC(size + extra);
+	if (raw == NULL)
+		return NULL;
+	// Make magpie detect the called of this function
+#ifdef MEMPOOL_MAGPIE
+	mp_bind_internal(raw, file, line);
+#else
+	(void)file;
+	(void)line;
+#endif
+	if (extra == 0)
+		return raw;
+
+	uintptr_t aligned = ((uintptr_t)raw + sizeof(void*) + pool->alignment - 1) & ~(uintptr_t)(pool->alignment - 1);
+	((void**)aligned)[-1] = raw;
+	return (uint8_t*)aligned;
+}
+
+// Frees block index of the pool
+static void mempool_block_free(mempool_t* pool, uint32_t index)
+{
+	uint8_t* block = pool->blocks[index];
+	if (pool->provider)
+	{
+		pool->provider->dealloc(block, mempool_block_size(pool, index), pool->provider->ctx);
+	}
+	else if (pool->alignment > MEMPOOL_MALLOC_ALIGNMENT)
+	{
+		MEMPOOL_FREE(((void**)block)[-1]);
 	}
+	else
+	{
+		MEMPOOL_FREE(block);
+	}
+}
 
-	// Last pool is full, malloc a new one
-	// No pools have yet been allocated
-	if (pool->block_end == pool->block_size || pool->block_count == 0)
+// Allocates a new block at the end of the block list
+// Returns 0 on failure and leaves the pool unchanged
+static int mempool_add_block(mempool_t* pool, const char* file, uint32_t line)
+{
+	// Allocate space for the list that holds the blocks
+	if (pool->block_count == pool->block_capacity)
 	{
-		// Allocate space for the list that holds the blocks
-		void* tmp = MEMPOOL_REALLOC(pool->blocks, ++pool->block_count * sizeof(*pool->blocks));
+		uint32_t capacity = pool->block_capacity ? pool->block_capacity * 2 : 4;
+		void* tmp = MEMPOOL_REALLOC(pool->blocks, capacity * sizeof(*pool->blocks));
 		// Allocation error
 		if (tmp == NULL)
 		{
-			free(pool->blocks);
-			pool->blocks = NULL;
 			MEMPOOL_MESSAGE("Failed to allocate memory for block list");
-			return NULL;
+			return 0;
 		}
 		pool->blocks = tmp;
-		// Allocate the block
-		pool->blocks[pool->block_count - 1] = malloc(pool->block_size);
-		// Make magpie detect the called of this function
-#ifdef MEMPOOL_MAGPIE
-		mp_bind_internal(pool->blocks[pool->block_count - 1], file, line);
+		pool->block_capacity = capacity;
+	}
+
+	// Allocate the block
+	uint8_t* block = mempool_block_alloc(pool, mempool_block_size(pool, pool->block_count), file, line);
+	if (block == NULL)
+	{
+		MEMPOOL_MESSAGE("Failed to allocate memory for new pool block");
+		return 0;
+	}
+	pool->blocks[pool->block_count++] = block;
+	return 1;
+}
+
+// Frees all blocks from index keep on and restarts allocating from the first block
+// Note: only valid when no elements are allocated
+static void mempool_release(mempool_t* pool, uint32_t keep)
+{
+	if (keep > pool->block_count)
+		keep = pool->block_count;
+	for (uint32_t i = keep; i < pool->block_count; i++)
+	{
+		mempool_block_free(pool, i);
+	}
+	pool->block_count = keep;
+	if (keep == 0)
+	{
+		MEMPOOL_FREE(pool->blocks);
+		pool->blocks = NULL;
+		pool->block_capacity = 0;
+	}
+	pool->block_current = 0;
+	pool->block_current_size = keep ? mempool_block_size(pool, 0) : 0;
+	pool->block_end = 0;
+	pool->free_elements = NULL;
+}
+
+// Moves on to the next retained block or mallocs a new one
+// Returns 0 on failure
+static int mempool_next_block(mempool_t* pool, const char* file, uint32_t line)
+{
+	// No blocks have yet been allocated
+	uint32_t next = pool->block_current_size ? pool->block_current + 1 : 0;
+	if (next == pool->block_count && !mempool_add_block(pool, file, line))
+		return 0;
+	pool->block_current = next;
+	pool->block_current_size = mempool_block_size(pool, next);
+	// Start at the beginning of the block
+	pool->block_end = 0;
+	return 1;
+}
+
+// Counts n allocated elements for MEMPOOL_STATS
+static inline void mempool_count_allocs(mempool_t* pool, uint32_t n)
+{
+#ifdef MEMPOOL_STATS
+	pool->total_allocs += n;
+	if (pool->alloc_count > pool->high_water)
+		pool->high_water = pool->alloc_count;
+#else
+	(void)pool;
+	(void)n;
 #endif
-		// Start at the beginning of new pool
-		pool->block_end = 0;
-		if (pool->blocks[pool->block_count - 1] == NULL)
-		{
-			MEMPOOL_MESSAGE("Failed to allocate memory for new pool block");
-			return NULL;
-		}
+}
+
+static inline void mempool_count_frees(mempool_t* pool, uint32_t n)
+{
+#ifdef MEMPOOL_STATS
+	pool->total_frees += n;
+#else
+	(void)pool;
+	(void)n;
+#endif
+}
+
+// Takes an element from the free list or the current block
+// Either tries to fill a freed spot, take at the end of a block, or malloc a new block
+static void* mempool_take(mempool_t* pool, const char* file, uint32_t line)
+{
+	// First check for freed blocks
+	if (pool->free_elements)
+	{
+		void* p = pool->free_elements;
+		pool->free_elements = pool->free_elements->next;
+		++pool->alloc_count;
+		mempool_count_allocs(pool, 1);
+		return p;
 	}
 
-	// Get the pointer to the beginning of the free space in the last block
-	void* p = pool->blocks[pool->block_count - 1] + pool->block_end;
+	// Current block is full
+	if (pool->block_end == pool->block_current_size && !mempool_next_block(pool, file, line))
+		return NULL;
+
+	// Get the pointer to the beginning of the free space in the current block
+	void* p = pool->blocks[pool->block_current] + pool->block_end;
 
 	// Update end 'pointers'
 	pool->block_end += pool->element_size;
 	++pool->alloc_count;
+	mempool_count_allocs(pool, 1);
 
 	return p;
 }
 
-void mempool_free(mempool_t* pool, void* element)
+// Takes up to n elements and returns how many were taken
+static uint32_t mempool_take_n(mempool_t* pool, void** out, uint32_t n, const char* file, uint32_t line)
+{
+	uint32_t count = 0;
+	// Pop a chain from the free list
+	struct mempool_free* freed = pool->free_elements;
+	for (; count < n && freed; count++)
+	{
+		out[count] = freed;
+		freed = freed->next;
+	}
+	pool->free_elements = freed;
+
+	// Carve the rest from the blocks
+	while (count < n)
+	{
+		if (pool->block_end == pool->block_current_size && !mempool_next_block(pool, file, line))
+			break;
+		uint32_t fit = (pool->block_current_size - pool->block_end) / pool->element_size;
+		if (fit > n - count)
+			fit = n - count;
+		uint8_t* p = pool->blocks[pool->block_current] + pool->block_end;
+		for (uint32_t i = 0; i < fit; i++)
+			out[count++] = p + i * pool->element_size;
+		pool->block_end += fit * pool->element_size;
+	}
+
+	pool->alloc_count += count;
+	mempool_count_allocs(pool, count);
+	return count;
+}
+
+// Puts an element on the free list
+static void mempool_give(mempool_t* pool, void* element)
 {
 	--pool->alloc_count;
+	mempool_count_frees(pool, 1);
 	// Make the free struct fill the freed element
 	struct mempool_free* freed = element;
 	// Chain any existing freed blocks
 	freed->next = pool->free_elements;
 	pool->free_elements = freed;
+}
+
+// Links n elements and splices them onto the free list
+static void mempool_give_n(mempool_t* pool, void** elements, uint32_t n)
+{
+	if (n == 0)
+		return;
+	for (uint32_t i = 0; i + 1 < n; i++)
+		((struct mempool_free*)elements[i])->next = elements[i + 1];
+	((struct mempool_free*)elements[n - 1])->next = pool->free_elements;
+	pool->free_elements = elements[0];
+	pool->alloc_count -= n;
+	mempool_count_frees(pool, n);
+}
+
+#ifdef MEMPOOL_THREADSAFE
+static struct mempool_magazine* mempool_magazine_create(void)
+{
+	struct mempool_magazine* magazine = MEMPOOL_MALLOC(sizeof(struct mempool_magazine));
+	if (magazine)
+		magazine->count = 0;
+	return magazine;
+}
+
+// Puts a magazine in the depot, the lock needs to be held
+static void mempool_depot_push(mempool_t* pool, struct mempool_magazine* magazine)
+{
+	struct mempool_magazine** list = magazine->count ? &pool->full : &pool->empty;
+	magazine->next = *list;
+	*list = magazine;
+}
+
+// Takes a magazine from the depot or NULL, the lock needs to be held
+static struct mempool_magazine* mempool_depot_pop(struct mempool_magazine** list)
+{
+	struct mempool_magazine* magazine = *list;
+	if (magazine)
+		*list = magazine->next;
+	return magazine;
+}
+
+// Returns the magazines of an exiting thread to the depot
+static void mempool_cache_exit(void* data)
+{
+	struct mempool_cache* cache = data;
+	mempool_t* pool = cache->pool;
+	pthread_mutex_lock(&pool->lock);
+	mempool_depot_push(pool, cache->loaded);
+	mempool_depot_push(pool, cache->previous);
+	for (struct mempool_cache** it = &pool->caches; *it; it = &(*it)->next)
+	{
+		if (*it == cache)
+		{
+			*it = cache->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	MEMPOOL_FREE(cache);
+}
+
+// Returns the cache of the calling thread, creating the pool key and cache on first use
+static struct mempool_cache* mempool_cache_get(mempool_t* pool)
+{
+	if (!atomic_load_explicit(&pool->key_created, memory_order_acquire))
+	{
+		pthread_mutex_lock(&pool->lock);
+		if (!atomic_load_explicit(&pool->key_created, memory_order_relaxed))
+		{
+			pthread_key_create(&pool->key, mempool_cache_exit);
+			atomic_store_explicit(&pool->key_created, 1, memory_order_release);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	struct mempool_cache* cache = pthread_getspecific(pool->key);
+	if (cache)
+		return cache;
+
+	cache = MEMPOOL_MALLOC(sizeof(struct mempool_cache));
+	if (cache == NULL)
+	{
+		MEMPOOL_MESSAGE("Failed to allocate memory for thread cache");
+		return NULL;
+	}
+	cache->pool = pool;
+	cache->loaded = mempool_magazine_create();
+	cache->previous = mempool_magazine_create();
+	if (cache->loaded == NULL || cache->previous == NULL)
+	{
+		MEMPOOL_FREE(cache->loaded);
+		MEMPOOL_FREE(cache->previous);
+		MEMPOOL_FREE(cache);
+		MEMPOOL_MESSAGE("Failed to allocate memory for thread cache");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	cache->next = pool->caches;
+	pool->caches = cache;
+	pthread_mutex_unlock(&pool->lock);
+	pthread_setspecific(pool->key, cache);
+	return cache;
+}
+
+static void* mempool_cache_alloc(mempool_t* pool, struct mempool_cache* cache, const char* file, uint32_t line)
+{
+	if (cache->loaded->count == 0)
+	{
+		struct mempool_magazine* tmp = cache->loaded;
+		cache->loaded = cache->previous;
+		cache->previous = tmp;
+	}
+
+	if (cache->loaded->count == 0)
+	{
+		// Both are empty, trade one for a full magazine from the depot or refill it from the blocks
+		pthread_mutex_lock(&pool->lock);
+		struct mempool_magazine* full = mempool_depot_pop(&pool->full);
+		if (full)
+		{
+			mempool_depot_push(pool, cache->loaded);
+			cache->loaded = full;
+		}
+		else
+		{
+			while (cache->loaded->count < MEMPOOL_MAGAZINE_SIZE)
+			{
+				void* p = mempool_take(pool, file, line);
+				if (p == NULL)
+					break;
+				cache->loaded->elements[cache->loaded->count++] = p;
+			}
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		if (cache->loaded->count == 0)
+			return NULL;
+	}
+
+	return cache->loaded->elements[--cache->loaded->count];
+}
+
+static void mempool_cache_free(mempool_t* pool, struct mempool_cache* cache, void* element)
+{
+	if (cache == NULL)
+	{
+		// The element can still go back to the free list
+		pthread_mutex_lock(&pool->lock);
+		mempool_give(pool, element);
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+
+	if (cache->loaded->count == MEMPOOL_MAGAZINE_SIZE)
+	{
+		struct mempool_magazine* tmp = cache->loaded;
+		cache->loaded = cache->previous;
+		cache->previous = tmp;
+	}
 
-	// Free everything if pool has no allocations left
+	if (cache->loaded->count == MEMPOOL_MAGAZINE_SIZE)
+	{
+		// Both are full, trade one for an empty magazine from the depot
+		pthread_mutex_lock(&pool->lock);
+		struct mempool_magazine* empty = mempool_depot_pop(&pool->empty);
+		if (empty == NULL)
+			empty = mempool_magazine_create();
+		if (empty)
+		{
+			mempool_depot_push(pool, cache->loaded);
+			cache->loaded = empty;
+		}
+		else
+		{
+			mempool_give(pool, element);
+		}
+		pthread_mutex_unlock(&pool->lock);
+		if (empty == NULL)
+			return;
+	}
+
+	cache->loaded->elements[cache->loaded->count++] = element;
+}
+
+// Frees every magazine in a depot list
+static void mempool_depot_free(struct mempool_magazine* magazine)
+{
+	while (magazine)
+	{
+		struct mempool_magazine* next = magazine->next;
+		MEMPOOL_FREE(magazine);
+		magazine = next;
+	}
+}
+#endif
+
+// Returnes an element_size chunk of memory from the pool
+// Either tries to fill a freed spot, take at the end of a block, or malloc a new block
+void* mempool_alloc_internal(mempool_t* pool, const char* file, uint32_t line)
+{
+#ifdef MEMPOOL_THREADSAFE
+	if (pool->flags & MEMPOOL_SHARED)
+	{
+		struct mempool_cache* cache = mempool_cache_get(pool);
+		return cache ? mempool_cache_alloc(pool, cache, file, line) : NULL;
+	}
+#endif
+	return mempool_take(pool, file, line);
+}
+
+uint32_t mempool_alloc_n_internal(mempool_t* pool, void** out, uint32_t n, const char* file, uint32_t line)
+{
+#ifdef MEMPOOL_THREADSAFE
+	if (pool->flags & MEMPOOL_SHARED)
+	{
+		// The magazines are refilled a whole magazine at a time, lock traffic is already amortized
+		struct mempool_cache* cache = mempool_cache_get(pool);
+		uint32_t count = 0;
+		while (cache && count < n && (out[count] = mempool_cache_alloc(pool, cache, file, line)))
+			count++;
+		return count;
+	}
+#endif
+	return mempool_take_n(pool, out, n, file, line);
+}
+
+void mempool_free(mempool_t* pool, void* element)
+{
+#ifdef MEMPOOL_THREADSAFE
+	if (pool->flags & MEMPOOL_SHARED)
+	{
+		mempool_cache_free(pool, mempool_cache_get(pool), element);
+		return;
+	}
+#endif
+	mempool_give(pool, element);
+
+	// Free everything but the retained blocks if pool has no allocations left
 	if (pool->alloc_count == 0)
+	{
+		mempool_release(pool, pool->retain_blocks);
+	}
+}
+
+void mempool_free_n(mempool_t* pool, void** elements, uint32_t n)
+{
+#ifdef MEMPOOL_THREADSAFE
+	if (pool->flags & MEMPOOL_SHARED)
+	{
+		struct mempool_cache* cache = mempool_cache_get(pool);
+		for (uint32_t i = 0; i < n; i++)
+			mempool_cache_free(pool, cache, elements[i]);
+		return;
+	}
+#endif
+	mempool_give_n(pool, elements, n);
+
+	if (n && pool->alloc_count == 0)
+	{
+		mempool_release(pool, pool->retain_blocks);
+	}
+}
+
+void mempool_trim(mempool_t* pool)
+{
+#ifdef MEMPOOL_THREADSAFE
+	if (pool->flags & MEMPOOL_SHARED)
+	{
+		pthread_mutex_lock(&pool->lock);
+		// The elements in the depot are free, give them back so the blocks can be released
+		struct mempool_magazine* magazine = NULL;
+		while ((magazine = mempool_depot_pop(&pool->full)))
+		{
+			while (magazine->count)
+				mempool_give(pool, magazine->elements[--magazine->count]);
+			MEMPOOL_FREE(magazine);
+		}
+		mempool_depot_free(pool->empty);
+		pool->empty = NULL;
+	}
+#endif
+
+	if (pool->alloc_count == 0)
+	{
+		mempool_release(pool, 0);
+	}
+	else
+	{
+		// Blocks after the current one have not been allocated from since they were retained
+		for (uint32_t i = pool->block_current + 1; i < pool->block_count; i++)
+		{
+			mempool_block_free(pool, i);
+		}
+		pool->block_count = pool->block_current + 1;
+	}
+
+#ifdef MEMPOOL_THREADSAFE
+	if (pool->flags & MEMPOOL_SHARED)
+		pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+void mempool_destroy(mempool_t* pool)
+{
+#ifdef MEMPOOL_THREADSAFE
+	if (atomic_load_explicit(&pool->key_created, memory_order_acquire))
+	{
+		// Deleting the key first makes sure no exit handler runs for the caches freed below
+		pthread_key_delete(pool->key);
+		atomic_store_explicit(&pool->key_created, 0, memory_order_relaxed);
+	}
+	while (pool->caches)
+	{
+		struct mempool_cache* next = pool->caches->next;
+		MEMPOOL_FREE(pool->caches->loaded);
+		MEMPOOL_FREE(pool->caches->previous);
+		MEMPOOL_FREE(pool->caches);
+		pool->caches = next;
+	}
+	mempool_depot_free(pool->full);
+	mempool_depot_free(pool->empty);
+	pool->full = NULL;
+	pool->empty = NULL;
+#endif
+	mempool_release(pool, 0);
+	pool->alloc_count = 0;
+}
+
+// The elements of block index that have been handed out at some point
+static uint32_t mempool_block_carved(mempool_t* pool, uint32_t index)
+{
+	if (index < pool->block_current)
+		return mempool_block_size(pool, index) / pool->element_size;
+	if (index == pool->block_current)
+		return pool->block_end / pool->element_size;
+	return 0;
+}
+
+void mempool_stats(mempool_t* pool, mempool_stats_t* out)
+{
+	*out = (mempool_stats_t){0};
+#ifdef MEMPOOL_THREADSAFE
+	if (pool->flags & MEMPOOL_SHARED)
+	{
+		pthread_mutex_lock(&pool->lock);
+		for (struct mempool_magazine* magazine = pool->full; magazine; magazine = magazine->next)
+			out->cached += magazine->count;
+	}
+#endif
+
+	for (struct mempool_free* freed = pool->free_elements; freed; freed = freed->next)
+		out->free_count++;
+
+	size_t capacity = 0;
+	size_t carved = 0;
+	for (uint32_t i = 0; i < pool->block_count; i++)
+	{
+		size_t size = mempool_block_size(pool, i);
+		out->reserved += size;
+		capacity += size / pool->element_size;
+		carved += mempool_block_carved(pool, i);
+	}
+
+	out->block_count = pool->block_count;
+	out->unused_count = capacity - carved;
+	out->live = pool->alloc_count - out->cached;
+	out->used = (size_t)out->live * pool->element_size;
+	if (carved)
+		out->fragmentation = (float)(out->free_count + out->cached) / carved;
+#ifdef MEMPOOL_STATS
+	out->high_water = pool->high_water;
+	out->total_allocs = pool->total_allocs;
+	out->total_frees = pool->total_frees;
+#endif
+
+#ifdef MEMPOOL_THREADSAFE
+	if (pool->flags & MEMPOOL_SHARED)
+		pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+// A block sorted by address to find which block a free element belongs to
+struct mempool_block_range
+{
+	uint8_t* start;
+	uint8_t* end;
+	uint32_t live;
+};
+
+static int mempool_block_range_cmp(const void* a, const void* b)
+{
+	const struct mempool_block_range* ra = a;
+	const struct mempool_block_range* rb = b;
+	return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+int mempool_occupancy(mempool_t* pool, uint32_t* histogram, uint32_t bucket_count)
+{
+	memset(histogram, 0, bucket_count * sizeof(*histogram));
+	if (bucket_count < 2)
+		return 0;
+
+#ifdef MEMPOOL_THREADSAFE
+	if (pool->flags & MEMPOOL_SHARED)
+		pthread_mutex_lock(&pool->lock);
+#endif
+
+	int result = 1;
+	struct mempool_block_range* ranges = NULL;
+	if (pool->block_count)
+	{
+		ranges = MEMPOOL_MALLOC(pool->block_count * sizeof(*ranges));
+		result = ranges != NULL;
+	}
+
+	if (ranges)
 	{
 		for (uint32_t i = 0; i < pool->block_count; i++)
 		{
-			MEMPOOL_FREE(pool->blocks[i]);
+			ranges[i].start = pool->blocks[i];
+			ranges[i].end = pool->blocks[i] + mempool_block_size(pool, i);
+			ranges[i].live = mempool_block_carved(pool, i);
 		}
-		MEMPOOL_FREE(pool->blocks);
-		pool->blocks = NULL;
-		pool->block_count = 0;
-		pool->block_end = 0;
-		pool->free_elements = NULL;
+		qsort(ranges, pool->block_count, sizeof(*ranges), mempool_block_range_cmp);
+
+		// Every free element takes one from the live count of its block
+		for (struct mempool_free* freed = pool->free_elements; freed; freed = freed->next)
+		{
+			uint8_t* p = (uint8_t*)freed;
+			uint32_t lo = 0;
+			uint32_t hi = pool->block_count;
+			while (hi - lo > 1)
+			{
+				uint32_t mid = (lo + hi) / 2;
+				if (ranges[mid].start <= p)
+					lo = mid;
+				else
+					hi = mid;
+			}
+			if (p >= ranges[lo].start && p < ranges[lo].end)
+				ranges[lo].live--;
+		}
+
+		for (uint32_t i = 0; i < pool->block_count; i++)
+		{
+			uint32_t capacity = (ranges[i].end - ranges[i].start) / pool->element_size;
+			uint32_t live = ranges[i].live;
+			uint32_t bucket = live ? 1 + (uint64_t)(live - 1) * (bucket_count - 1) / capacity : 0;
+			histogram[bucket]++;
+		}
+		MEMPOOL_FREE(ranges);
 	}
+
+#ifdef MEMPOOL_THREADSAFE
+	if (pool->flags & MEMPOOL_SHARED)
+		pthread_mutex_unlock(&pool->lock);
+#endif
+	return result;
+}
+
+// Returns where an allocation of align would start in block, relative to the data
+static size_t mempool_arena_offset(struct mempool_arena_block* block, size_t align)
+{
+	uintptr_t data = (uintptr_t)(block + 1);
+	return ((data + block->used + align - 1) & ~(uintptr_t)(align - 1)) - data;
+}
+
+void* mempool_arena_alloc_internal(mempool_arena_t* arena, size_t size, size_t align, const char* file, uint32_t line)
+{
+	if (align == 0)
+		align = 1;
+
+	struct mempool_arena_block* block = arena->blocks;
+	if (block)
+	{
+		size_t offset = mempool_arena_offset(block, align);
+		if (offset + size <= block->size)
+		{
+			block->used = offset + size;
+			return (uint8_t*)(block + 1) + offset;
+		}
+	}
+
+	// Chain a new block, the space left in the previous one is not used again until it is reset
+	size_t need = size + align - 1;
+	if (arena->spare && arena->spare->size >= need)
+	{
+		block = arena->spare;
+		arena->spare = NULL;
+	}
+	else
+	{
+		size_t block_size = need > arena->block_size ? need : arena->block_size;
+		block = MEMPOOL_MALLOC(sizeof(struct mempool_arena_block) + block_size);
+		if (block == NULL)
+		{
+			MEMPOOL_MESSAGE("Failed to allocate memory for arena block");
+			return NULL;
+		}
+#ifdef MEMPOOL_MAGPIE
+		mp_bind_internal(block, file, line);
+#else
+		(void)file;
+		(void)line;
+#endif
+		block->size = block_size;
+	}
+	block->used = 0;
+	block->prev = arena->blocks;
+	arena->blocks = block;
+
+	size_t offset = mempool_arena_offset(block, align);
+	block->used = offset + size;
+	return (uint8_t*)(block + 1) + offset;
+}
+
+mempool_arena_mark_t mempool_arena_mark(mempool_arena_t* arena)
+{
+	mempool_arena_mark_t mark = {arena->blocks, arena->blocks ? arena->blocks->used : 0};
+	return mark;
+}
+
+void mempool_arena_reset(mempool_arena_t* arena, mempool_arena_mark_t mark)
+{
+	while (arena->blocks != mark.block)
+	{
+		struct mempool_arena_block* block = arena->blocks;
+		arena->blocks = block->prev;
+		// Keep one regular block for the next allocations after the reset
+		if (arena->spare == NULL && block->size == arena->block_size)
+		{
+			arena->spare = block;
+		}
+		else
+		{
+			MEMPOOL_FREE(block);
+		}
+	}
+	if (arena->blocks)
+		arena->blocks->used = mark.used;
+}
+
+void mempool_arena_destroy(mempool_arena_t* arena)
+{
+	mempool_arena_mark_t empty = {NULL, 0};
+	mempool_arena_reset(arena, empty);
+	if (arena->spare)
+	{
+		MEMPOOL_FREE(arena->spare);
+	}
+	arena->spare = NULL;
+}
+
+// The header value of allocations that are too large for a class
+#define MEMPOOL_SIZE_CLASS_LARGE UINT32_MAX
+
+// Returns the smallest class that fits size, or MEMPOOL_SIZE_CLASS_LARGE
+static uint32_t mempool_size_class(size_t size)
+{
+	if (size > MEMPOOL_SIZE_CLASS_MAX)
+		return MEMPOOL_SIZE_CLASS_LARGE;
+	uint32_t size_class = 0;
+	while ((size_t)16 << size_class < size)
+		size_class++;
+	return size_class;
+}
+
+void* mempool_sized_alloc_internal(mempool_sized_t* sized, size_t size, const char* file, uint32_t line)
+{
+	uint32_t size_class = mempool_size_class(size);
+	uint8_t* p = NULL;
+	if (size_class == MEMPOOL_SIZE_CLASS_LARGE)
+	{
+		p = MEMPOOL_MALLOC(MEMPOOL_SIZED_HEADER + size);
+#ifdef MEMPOOL_MAGPIE
+		if (p)
+			mp_bind_internal(p, file, line);
+#endif
+	}
+	else
+	{
+		p = mempool_alloc_internal(&sized->pools[size_class], file, line);
+	}
+	if (p == NULL)
+		return NULL;
+
+	*(uint32_t*)p = size_class;
+	return p + MEMPOOL_SIZED_HEADER;
+}
+
+void* mempool_sized_realloc_internal(mempool_sized_t* sized, void* p, size_t size, const char* file, uint32_t line)
+{
+	if (p == NULL)
+		return mempool_sized_alloc_internal(sized, size, file, line);
+
+	uint8_t* header = (uint8_t*)p - MEMPOOL_SIZED_HEADER;
+	uint32_t size_class = *(uint32_t*)header;
+	uint32_t new_class = mempool_size_class(size);
+
+	if (size_class == MEMPOOL_SIZE_CLASS_LARGE && new_class == MEMPOOL_SIZE_CLASS_LARGE)
+	{
+		uint8_t* tmp = MEMPOOL_REALLOC(header, MEMPOOL_SIZED_HEADER + size);
+		return tmp ? tmp + MEMPOOL_SIZED_HEADER : NULL;
+	}
+	// Still fits, shrinking within a class or to a smaller class keeps the allocation
+	if (size_class != MEMPOOL_SIZE_CLASS_LARGE && new_class <= size_class)
+		return p;
+
+	void* moved = mempool_sized_alloc_internal(sized, size, file, line);
+	if (moved == NULL)
+		return NULL;
+	// Only a larger class is moved to, so the entire old class fits
+	size_t old_size = size_class == MEMPOOL_SIZE_CLASS_LARGE ? size : (size_t)16 << size_class;
+	memcpy(moved, p, old_size < size ? old_size : size);
+	mempool_sized_free(sized, p);
+	return moved;
+}
+
+void mempool_sized_free(mempool_sized_t* sized, void* p)
+{
+	if (p == NULL)
+		return;
+
+	uint8_t* header = (uint8_t*)p - MEMPOOL_SIZED_HEADER;
+	uint32_t size_class = *(uint32_t*)header;
+	if (size_class == MEMPOOL_SIZE_CLASS_LARGE)
+	{
+		MEMPOOL_FREE(header);
+	}
+	else
+	{
+		mempool_free(&sized->pools[size_class], header);
+	}
+}
+
+void mempool_sized_destroy(mempool_sized_t* sized)
+{
+	for (uint32_t i = 0; i < MEMPOOL_SIZE_CLASSES; i++)
+		mempool_destroy(&sized->pools[i]);
 }
 
 #endif
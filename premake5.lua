@@ -18,7 +18,7 @@ project "test"
 		"mempool.h"
 	}
 
-	links "m"
+	links { "m", "pthread" }
 
 	filter "configurations:debug"
 		symbols "on"
@@ -32,3 +32,101 @@ project "test"
 	configuration "not notest"
 		postbuildcommands "./bin/test"
 
+-- The same tests with the open addressing storage of hashtable.h
+project "test_open_addressing"
+	kind "ConsoleApp"
+	language "C"
+	targetdir "bin"
+
+	files { 
+		"test.c",
+		"hashtable.h",
+		"mempool.h"
+	}
+
+	defines { "HASHTABLE_OPEN_ADDRESSING" }
+
+	links { "m", "pthread" }
+
+	filter "configurations:debug"
+		symbols "on"
+		optimize "off"
+		
+	filter "configurations:release"
+		symbols "off"
+		optimize "on"
+		
+	configuration "not notest"
+		postbuildcommands "./bin/test_open_addressing"
+
+-- And with incremental resizing
+project "test_incremental_resize"
+	kind "ConsoleApp"
+	language "C"
+	targetdir "bin"
+
+	files { 
+		"test.c",
+		"hashtable.h",
+		"mempool.h"
+	}
+
+	defines { "HASHTABLE_INCREMENTAL_RESIZE" }
+
+	links { "m", "pthread" }
+
+	filter "configurations:debug"
+		symbols "on"
+		optimize "off"
+		
+	filter "configurations:release"
+		symbols "off"
+		optimize "on"
+		
+	configuration "not notest"
+		postbuildcommands "./bin/test_incremental_resize"
+
+-- And with the lowest size tolerance, which derives the lowest valid shrink tolerance
+project "test_size_tolerance"
+	kind "ConsoleApp"
+	language "C"
+	targetdir "bin"
+
+	files { 
+		"test.c",
+		"hashtable.h",
+		"mempool.h"
+	}
+
+	defines { "HASHTABLE_SIZE_TOLERANCE=50" }
+
+	links { "m", "pthread" }
+
+	filter "configurations:debug"
+		symbols "on"
+		optimize "off"
+		
+	filter "configurations:release"
+		symbols "off"
+		optimize "on"
+		
+	configuration "not notest"
+		postbuildcommands "./bin/test_size_tolerance"
+
+project "bench"
+	kind "ConsoleApp"
+	language "C"
+	targetdir "bin"
+
+	files {
+		"bench.c",
+		"hashtable.h",
+		"mempool.h",
+		"magpie.h",
+		"libjson.h"
+	}
+
+	links { "m", "pthread" }
+
+	-- Timings are only meaningful optimized
+	optimize "on"
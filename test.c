@@ -1,25 +1,36 @@
 #define MP_IMPLEMENTATION
 #define MP_CHECK_FULL
+#define MP_THREADSAFE
 #include "magpie.h"
-#define HASHTABLE_IMPLEMENTATION
-#define hashtable_create(hashfunc, compfunc) mp_bind(hashtable_create_internal(hashfunc, compfunc));
-#include "hashtable.h"
-
 #define MEMPOOL_ALLOC(pool) mp_bind(mempool_alloc_internal(pool))
 
 #define MEMPOOL_IMPLEMENTATION
 #define MEMPOOL_MAGPIE
+#define MEMPOOL_THREADSAFE
+#define MEMPOOL_STATS
 #include "mempool.h"
 
+#define HASHTABLE_IMPLEMENTATION
+#define HASHTABLE_CONCURRENT
+#define HASHTABLE_MEMPOOL
+#define hashtable_create(hashfunc, compfunc) mp_bind(hashtable_create_internal(hashfunc, compfunc));
+#include "hashtable.h"
+
 #define LIBJSON_IMPLEMENTATION
+#define JSON_MEMPOOL
+#define JSON_THREADS
 #include "libjson.h"
 
 #define LIST_IMPLEMENTATION
+#define LIST_INLINE_SIZE 32
 #include "list.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+// The tests are asserts, keep them in release builds
+#undef NDEBUG
 #include <assert.h>
+#include <pthread.h>
 
 char* names[] = {"Aletha", "Bert",	  "Ceasar", "David",	 "Elize",	 "Felix",
 				 "George", "Heather", "Ingrid", "Josephine", "Katherine"};
@@ -32,10 +43,18 @@ struct Person
 
 #define lenof(arr) (sizeof(arr) / sizeof(*arr))
 
+static int sum_ages(const void* key, void* data, void* ctx)
+{
+	assert(*(const int*)key == ((struct Person*)data)->age);
+	*(int*)ctx += *(const int*)key;
+	return 0;
+}
+
 int test_hashtable()
 {
 	Hashtable* table = hashtable_create_uint32();
 	assert(table != NULL);
+	hashtable_reserve(table, lenof(names));
 
 	// Generate random people
 	for (int i = 0; i < 5; i++)
@@ -76,6 +95,22 @@ int test_hashtable()
 	assert(find_count == hashtable_get_count(table));
 	hashtable_iterator_end(it);
 
+	// Stack iterator yielding keys
+	hashtable_iterator stack_it;
+	hashtable_iterator_init(&stack_it, table);
+	const void* key = NULL;
+	find_count = 0;
+	while (hashtable_iterator_next_pair(&stack_it, &key, (void**)&p))
+	{
+		assert(key == &p->age);
+		++find_count;
+	}
+	assert(find_count == hashtable_get_count(table));
+
+	int sum = 0;
+	int stopped = hashtable_foreach(table, sum_ages, &sum);
+	assert(stopped == 0 && sum == 0 + 1 + 2 + 3 + 4);
+
 	struct Person* pfree = NULL;
 	while ((pfree = hashtable_pop(table)))
 	{
@@ -85,6 +120,317 @@ int test_hashtable()
 	hashtable_print(table, stdout);
 
 	hashtable_destroy(table);
+
+	// Length aware string keys
+	table = hashtable_create_string();
+	for (uint32_t i = 0; i < lenof(names); i++)
+		hashtable_insert_n(table, names[i], strlen(names[i]), names[i]);
+	// Find by a slice that is not terminated
+	const char* buffer = "GeorgeHeather";
+	assert(hashtable_find_n(table, buffer, 6) == names[6]);
+	assert(hashtable_find_n(table, buffer + 6, 7) == names[7]);
+	assert(hashtable_find_n(table, buffer, 5) == NULL);
+	assert(hashtable_find(table, "Heather") == names[7]);
+	char* removed = hashtable_remove_n(table, buffer + 6, 7);
+	assert(removed == names[7] && hashtable_get_count(table) == lenof(names) - 1);
+
+	// Batched lookups, Heather was removed
+	void* found[lenof(names)];
+	hashtable_find_batch(table, (const void* const*)names, lenof(names), found);
+	for (uint32_t i = 0; i < lenof(names); i++)
+		assert(found[i] == (i == 7 ? NULL : names[i]));
+	hashtable_destroy(table);
+	return 0;
+}
+
+HASHTABLE_DEFINE(agemap, uint32_t, struct Person*, hashtable_hash_uint32, hashtable_eq_uint32)
+
+int test_hashtable_typed()
+{
+	struct Person people[lenof(names)];
+	agemap_t ages = {0};
+	for (uint32_t i = 0; i < lenof(names); i++)
+	{
+		snprintf(people[i].name, sizeof(people[i].name), "%s", names[i]);
+		people[i].age = i * 10;
+		int replaced = agemap_insert(&ages, people[i].age, &people[i], NULL);
+		assert(replaced == 0);
+	}
+	assert(agemap_count(&ages) == lenof(names));
+
+	struct Person** found = agemap_find(&ages, 20);
+	assert(found && *found == &people[2]);
+	assert(agemap_find(&ages, 21) == NULL);
+
+	// Replacing returns the old value
+	struct Person* old = NULL;
+	int replaced = agemap_insert(&ages, 20, &people[0], &old);
+	assert(replaced == 1 && old == &people[2] && agemap_count(&ages) == lenof(names));
+
+	uint32_t age = 0;
+	uint32_t index = 0;
+	uint32_t find_count = 0;
+	struct Person* p = NULL;
+	while (agemap_next(&ages, &index, &age, &p))
+	{
+		assert(age == 20 || p->age == (int)age);
+		++find_count;
+	}
+	assert(find_count == lenof(names));
+
+	for (uint32_t i = 0; i < lenof(names); i++)
+	{
+		int removed = agemap_remove(&ages, i * 10, NULL);
+		assert(removed == 1);
+	}
+	int removed = agemap_remove(&ages, 0, NULL);
+	assert(agemap_count(&ages) == 0 && removed == 0);
+	agemap_destroy(&ages);
+
+	// Predefined string table
+	hashtable_string_t table = {0};
+	for (uint32_t i = 0; i < lenof(names); i++)
+		hashtable_string_insert(&table, names[i], &people[i], NULL);
+	char key[] = "Felix";
+	assert(*hashtable_string_find(&table, key) == &people[5]);
+	hashtable_string_destroy(&table);
+	return 0;
+}
+
+// Looks up every person from its own thread
+static void* find_people(void* table)
+{
+	for (int i = 0; i < (int)lenof(names); i++)
+	{
+		struct Person* p = hashtable_concurrent_find(table, &i);
+		if (p == NULL || p->age != i)
+			return table;
+	}
+	return NULL;
+}
+
+#define WRITER_KEYS 1000
+
+// Inserts a range of keys of its own and removes every other one while the finders run
+struct KeyWriter
+{
+	hashtable_concurrent_t* table;
+	uint32_t keys[WRITER_KEYS];
+};
+
+static void* write_keys(void* arg)
+{
+	struct KeyWriter* writer = arg;
+	for (uint32_t i = 0; i < WRITER_KEYS; i++)
+	{
+		if (hashtable_concurrent_insert(writer->table, &writer->keys[i], &writer->keys[i]) != NULL)
+			return arg;
+	}
+	for (uint32_t i = 0; i < WRITER_KEYS; i += 2)
+	{
+		if (hashtable_concurrent_remove(writer->table, &writer->keys[i]) != &writer->keys[i])
+			return arg;
+	}
+	return NULL;
+}
+
+int test_hashtable_concurrent()
+{
+	struct Person people[lenof(names)];
+	hashtable_concurrent_t* table = hashtable_concurrent_create_uint32(4);
+	for (uint32_t i = 0; i < lenof(names); i++)
+	{
+		snprintf(people[i].name, sizeof(people[i].name), "%s", names[i]);
+		people[i].age = i;
+		void* replaced = hashtable_concurrent_insert(table, &people[i].age, &people[i]);
+		assert(replaced == NULL);
+	}
+	assert(hashtable_concurrent_get_count(table) == lenof(names));
+
+	// The writers use disjoint keys above the ages
+	static struct KeyWriter writers[4];
+	pthread_t writer_threads[lenof(writers)];
+	for (uint32_t w = 0; w < lenof(writers); w++)
+	{
+		writers[w].table = table;
+		for (uint32_t i = 0; i < WRITER_KEYS; i++)
+			writers[w].keys[i] = (w + 1) * WRITER_KEYS + i;
+		pthread_create(&writer_threads[w], NULL, write_keys, &writers[w]);
+	}
+
+	pthread_t threads[4];
+	for (uint32_t i = 0; i < lenof(threads); i++)
+		pthread_create(&threads[i], NULL, find_people, table);
+
+	int failed = 0;
+	for (uint32_t i = 0; i < lenof(threads); i++)
+	{
+		void* ret = NULL;
+		pthread_join(threads[i], &ret);
+		failed |= ret != NULL;
+	}
+	for (uint32_t w = 0; w < lenof(writers); w++)
+	{
+		void* ret = NULL;
+		pthread_join(writer_threads[w], &ret);
+		failed |= ret != NULL;
+	}
+
+	// Only the odd keys of every writer are left
+	assert(hashtable_concurrent_get_count(table) == lenof(names) + lenof(writers) * WRITER_KEYS / 2);
+	for (uint32_t w = 0; w < lenof(writers); w++)
+	{
+		for (uint32_t i = 0; i < WRITER_KEYS; i++)
+		{
+			uint32_t* found = hashtable_concurrent_find(table, &writers[w].keys[i]);
+			assert(found == (i % 2 ? &writers[w].keys[i] : NULL));
+		}
+	}
+
+	int age = 3;
+	struct Person* removed = hashtable_concurrent_remove(table, &age);
+	assert(removed == &people[3]);
+	assert(hashtable_concurrent_find(table, &age) == NULL);
+
+	uint32_t pop_count = 0;
+	while (hashtable_concurrent_pop(table))
+		++pop_count;
+	assert(pop_count == lenof(names) - 1 + lenof(writers) * WRITER_KEYS / 2);
+
+	hashtable_concurrent_destroy(table);
+	return failed;
+}
+
+#ifdef HASHTABLE_OPEN_ADDRESSING
+// Places small keys in the slot of their value
+static uint32_t hash_identity(const void* key)
+{
+	return *(const uint32_t*)key;
+}
+
+int test_hashtable_open_addressing()
+{
+	uint32_t keys[80];
+	for (uint32_t i = 0; i < lenof(keys); i++)
+		keys[i] = i;
+
+	// Keys that share the first slot of their probe sequence
+	hashtable_t* table = hashtable_create(hash_identity, hashtable_comp_uint32);
+	for (uint32_t i = 0; i < 4; i++)
+		hashtable_insert(table, &keys[i * 16], &keys[i * 16]);
+	void* removed = hashtable_remove(table, &keys[16]);
+	assert(removed == &keys[16] && table->cur.deleted == 1);
+	// The tombstone does not end the probe sequence
+	assert(hashtable_find(table, &keys[48]) == &keys[48]);
+	// and is reused by the next insert of the sequence
+	hashtable_insert(table, &keys[64], &keys[64]);
+	assert(table->cur.deleted == 0 && table->cur.items[1].key == &keys[64]);
+	// The last slot of a sequence is emptied instead
+	removed = hashtable_remove(table, &keys[48]);
+	assert(removed == &keys[48] && table->cur.deleted == 0 && table->cur.ctrl[3] == HASHTABLE_CTRL_EMPTY);
+	hashtable_destroy(table);
+
+	// A table of mostly tombstones is rehashed without growing
+	table = hashtable_create(hash_identity, hashtable_comp_uint32);
+	for (uint32_t i = 0; i < 11; i++)
+		hashtable_insert(table, &keys[i], &keys[i]);
+	for (uint32_t i = 0; i < 8; i++)
+		hashtable_remove(table, &keys[i]);
+	assert(table->cur.deleted == 8 && hashtable_get_count(table) == 3);
+	hashtable_insert(table, &keys[16], &keys[16]);
+	assert(table->cur.size == 16 && table->cur.deleted == 0 && hashtable_get_count(table) == 4);
+	for (uint32_t i = 8; i < 11; i++)
+		assert(hashtable_find(table, &keys[i]) == &keys[i]);
+	assert(hashtable_find(table, &keys[16]) == &keys[16] && hashtable_find(table, &keys[0]) == NULL);
+
+	// Iteration and pop skip tombstones
+	for (uint32_t i = 20; i < 30; i++)
+		hashtable_insert(table, &keys[i], &keys[i]);
+	hashtable_remove(table, &keys[9]);
+	hashtable_remove(table, &keys[25]);
+	hashtable_iterator it;
+	hashtable_iterator_init(&it, table);
+	const void* key = NULL;
+	void* data = NULL;
+	uint32_t find_count = 0;
+	while (hashtable_iterator_next_pair(&it, &key, &data))
+	{
+		assert(key == data && key != &keys[9] && key != &keys[25]);
+		++find_count;
+	}
+	assert(find_count == hashtable_get_count(table) && find_count == 12);
+
+	uint32_t size = table->cur.size;
+	uint32_t pop_count = 0;
+	while ((data = hashtable_pop(table)))
+	{
+		assert(data != &keys[9] && data != &keys[25]);
+		++pop_count;
+	}
+	assert(pop_count == 12 && hashtable_get_count(table) == 0 && table->cur.size == size);
+	hashtable_destroy(table);
+	return 0;
+}
+#endif
+
+int test_hashtable_resize()
+{
+	uint32_t* keys = malloc(1000 * sizeof(uint32_t));
+	hashtable_t* table = hashtable_create_uint32();
+	int migrating = 0;
+	for (uint32_t i = 0; i < 1000; i++)
+	{
+		keys[i] = i;
+		hashtable_insert(table, &keys[i], &keys[i]);
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+		// Check a resize while only some of the buckets are migrated
+		if (!migrating && table->old.size >= 128)
+		{
+			migrating = 1;
+			assert(table->migrate > 0 && table->migrate < table->old.size);
+			// Both arrays are searched
+			for (uint32_t j = 0; j <= i; j++)
+				assert(hashtable_find(table, &keys[j]) == &keys[j]);
+			assert(hashtable_find(table, &i) == &keys[i]);
+			uint32_t missing = 1000;
+			assert(hashtable_find(table, &missing) == NULL);
+			// Removing finds keys in the old array
+			for (uint32_t j = 0; j <= i; j += 3)
+			{
+				void* removed = hashtable_remove(table, &keys[j]);
+				assert(removed == &keys[j]);
+			}
+			for (uint32_t j = 0; j <= i; j += 3)
+				hashtable_insert(table, &keys[j], &keys[j]);
+		}
+#endif
+	}
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	assert(migrating);
+#else
+	(void)migrating;
+#endif
+	assert(hashtable_get_count(table) == 1000);
+	for (uint32_t i = 0; i < 1000; i++)
+		assert(hashtable_find(table, &keys[i]) == &keys[i]);
+
+	// Draining the table with pop does not shrink it
+	uint32_t size = table->cur.size;
+	uint32_t pop_count = 0;
+	uint64_t sum = 0;
+	uint32_t* data;
+	while ((data = hashtable_pop(table)))
+	{
+		sum += *data;
+		++pop_count;
+	}
+	assert(pop_count == 1000 && sum == 999 * 1000 / 2);
+	assert(hashtable_get_count(table) == 0 && table->cur.size == size);
+#ifdef HASHTABLE_INCREMENTAL_RESIZE
+	assert(table->old.size == 0);
+#endif
+	hashtable_destroy(table);
+	free(keys);
 	return 0;
 }
 
@@ -106,6 +452,87 @@ int test_mempool(int pool_size)
 		printf("[%4u]: name: %s, age: %d\n", i, people[i]->name, people[i]->age);
 	}
 
+	for (uint32_t i = 0; i < lenof(names); i++)
+	{
+		mempool_free(&pool, people[i]);
+	}
+	assert(pool.block_count == 0);
+
+	// A retained block is reused when the pool repeatedly becomes empty
+	pool.retain_blocks = 1;
+	for (int i = 0; i < 4; i++)
+	{
+		struct Person* p = mempool_alloc(&pool);
+		assert(p != NULL && pool.block_count == 1);
+		mempool_free(&pool, p);
+	}
+	assert(pool.block_count == 1);
+	mempool_trim(&pool);
+	assert(pool.block_count == 0);
+
+	// Growing blocks double in size
+	pool.flags = MEMPOOL_GROW;
+	uint32_t count = pool_size * 15;
+	struct Person** many = malloc(count * sizeof(*many));
+	for (uint32_t i = 0; i < count; i++)
+	{
+		many[i] = mempool_alloc(&pool);
+		assert(many[i] != NULL);
+	}
+	assert(pool.block_count == 4);
+	mempool_destroy(&pool);
+	free(many);
+
+	// Bulk allocation reuses the freed chain before carving new elements
+	struct Person* batch[lenof(names)];
+	uint32_t allocated = mempool_alloc_n(&pool, (void**)batch, lenof(names));
+	assert(allocated == lenof(names));
+	mempool_free_n(&pool, (void**)batch, 4);
+	assert(pool.alloc_count == lenof(names) - 4);
+	allocated = mempool_alloc_n(&pool, (void**)batch, 4);
+	assert(allocated == 4);
+	mempool_free_n(&pool, (void**)batch, lenof(names));
+	assert(pool.alloc_count == 0 && pool.block_count == pool.retain_blocks);
+	mempool_trim(&pool);
+
+	// Stats and occupancy of a pool where every other element is freed
+	mempool_t sparse = MEMPOOL_INIT(sizeof(struct Person), pool_size);
+	uint32_t sparse_count = pool_size * 4;
+	struct Person** elements = malloc(sparse_count * sizeof(*elements));
+	allocated = mempool_alloc_n(&sparse, (void**)elements, sparse_count);
+	assert(allocated == sparse_count);
+	for (uint32_t i = 0; i < sparse_count; i += 2)
+	{
+		mempool_free(&sparse, elements[i]);
+	}
+	mempool_stats_t stats;
+	mempool_stats(&sparse, &stats);
+	assert(stats.live == sparse_count / 2 && stats.free_count == sparse_count / 2 && stats.unused_count == 0);
+	assert(stats.block_count == 4 && stats.reserved == 4 * sparse.block_size);
+	assert(stats.used == stats.live * sparse.element_size && stats.fragmentation == 0.5f);
+	assert(stats.high_water == sparse_count && stats.total_allocs == sparse_count);
+	// Empty the first block, the others stay half full
+	for (uint32_t i = 1; i < (uint32_t)pool_size; i += 2)
+	{
+		mempool_free(&sparse, elements[i]);
+	}
+	uint32_t histogram[3];
+	int has_occupancy = mempool_occupancy(&sparse, histogram, lenof(histogram));
+	assert(has_occupancy);
+	assert(histogram[0] == 1 && histogram[1] == 3 && histogram[2] == 0);
+	mempool_destroy(&sparse);
+	free(elements);
+
+	// Every element starts on its own cache line
+	mempool_t aligned = MEMPOOL_INIT_ALIGNED(sizeof(int), pool_size, MEMPOOL_CACHE_LINE);
+	assert(aligned.element_size == MEMPOOL_CACHE_LINE);
+	for (uint32_t i = 0; i < lenof(names); i++)
+	{
+		int* p = mempool_alloc(&aligned);
+		assert(p != NULL && (uintptr_t)p % MEMPOOL_CACHE_LINE == 0);
+	}
+	mempool_destroy(&aligned);
+
 	return 0;
 }
 
@@ -125,6 +552,581 @@ int test_json()
 	return 0;
 }
 
+int test_json_insitu()
+{
+	char str[] = "{\"name\": \"Ad\\tam\", \"friends\": [\"Be\\\"rt\", \"Ceasar\"], \"age\": 17}";
+	size_t mem_count = mp_get_count();
+	JSON* root = json_loadstring_insitu(str);
+	assert(root != NULL);
+	// Only the JSON structs are allocated
+	assert(mp_get_count() - mem_count == 6);
+
+	// Strings point into the source and the escapes are decoded in place
+	char* name = json_get_member_string(root, "name");
+	assert(name > str && name < str + sizeof str && strcmp(name, "Ad\tam") == 0);
+	JSON* friends = json_get_member(root, "friends");
+	assert(strcmp(json_get_name(friends), "friends") == 0);
+	assert(strcmp(json_get_string(json_get_elements(friends)), "Be\"rt") == 0);
+	assert(json_get_member_number(root, "age") == 17);
+
+	// Borrowed strings are replaced by owned ones
+	json_set_string(json_get_member(root, "name"), "Eliza");
+	assert(strcmp(json_get_member_string(root, "name"), "Eliza") == 0);
+	int written = json_writefile(root, "insitu.json", JSON_FORMAT);
+	assert(written == 0);
+	json_destroy(root);
+
+	// The file contents are owned by the root
+	JSON* file = json_loadfile_insitu("insitu.json");
+	assert(file != NULL);
+	assert(strcmp(json_get_member_string(file, "name"), "Eliza") == 0);
+	assert(strcmp(json_get_string(json_get_elements(json_get_member(file, "friends"))), "Be\"rt") == 0);
+	json_destroy(file);
+	remove("insitu.json");
+
+	// A member that fails to load is not linked
+	char invalid[] = "{\"a\": x}";
+	JSON* failed = json_loadstring_insitu(invalid);
+	assert(failed == NULL);
+
+	// Members without a key are invalid, the previous key is not reused
+	const char* keyless[] = {"{\"a\": 1, : 2}", "{\"a\": 1, : x}", "{\"a\" 1}"};
+	for (uint32_t i = 0; i < lenof(keyless); i++)
+	{
+		char copy[32];
+		snprintf(copy, sizeof copy, "%s", keyless[i]);
+		failed = json_loadstring(copy);
+		assert(failed == NULL);
+		failed = json_loadstring_insitu(copy);
+		assert(failed == NULL);
+	}
+	assert(mp_get_count() == mem_count);
+	return 0;
+}
+
+int test_json_numbers()
+{
+	// Numbers are read exactly and printed with the shortest digits that round trip
+	char str[] = "[0.1, 1e-7 , 1.6E6,\n\t123456789012345678, -0.05, 2.2250738585072014e-308, 17, 0.3333333333333333]";
+	JSON* root = json_loadstring(str);
+	assert(root != NULL && json_get_count(root) == 8);
+	char* out = json_tostring(root, JSON_COMPACT);
+	assert(strcmp(out, "[0.1,1e-7,1600000,123456789012345680,-0.05,2.2250738585072014e-308,17,0.3333333333333333]") == 0);
+	free(out);
+	json_destroy(root);
+
+	// Numbers out of the fast path are read by strtod
+	char slow[] = "[1.00000000000000000000000001, 1e300, 123456789012345678901234567890.5e-10]";
+	root = json_loadstring(slow);
+	assert(root != NULL);
+	assert(json_get_number(json_get_element(root, 0)) == 1.0);
+	assert(json_get_number(json_get_element(root, 1)) == 1e300);
+	assert(json_get_number(json_get_element(root, 2)) == 123456789012345678901234567890.5e-10);
+	json_destroy(root);
+	return 0;
+}
+
+int test_json_reader()
+{
+	// Tokens split over chunks
+	const char* str = "{\"name\": \"Ad\\nam\", \"friends\": [17, true, null]}";
+	const int tokens[] = {JSON_TOKEN_BEGIN_OBJECT, JSON_TOKEN_KEY,	JSON_TOKEN_STRING, JSON_TOKEN_KEY,
+						  JSON_TOKEN_BEGIN_ARRAY,  JSON_TOKEN_NUMBER, JSON_TOKEN_BOOL,	 JSON_TOKEN_NULL,
+						  JSON_TOKEN_END_ARRAY,	   JSON_TOKEN_END_OBJECT, JSON_TOKEN_END};
+	json_reader_t* reader = json_reader_create(NULL, NULL);
+	size_t fed = 0;
+	for (size_t i = 0; i < sizeof tokens / sizeof *tokens; i++)
+	{
+		int token;
+		while ((token = json_reader_next(reader)) == JSON_TOKEN_MORE)
+		{
+			size_t len = strlen(str);
+			if (fed == len)
+			{
+				json_reader_finish(reader);
+				continue;
+			}
+			size_t n = len - fed < 3 ? len - fed : 3;
+			json_reader_feed(reader, str + fed, n);
+			fed += n;
+		}
+		assert(token == tokens[i]);
+		if (i == 2)
+			assert(strcmp(json_reader_string(reader, NULL), "Ad\nam") == 0);
+		if (i == 5)
+			assert(json_reader_number(reader) == 17 && json_reader_depth(reader) == 2);
+	}
+	json_reader_destroy(reader);
+
+	// Large arrays are loaded one element at a time
+	FILE* fp = fopen("records.json", "w+");
+	assert(fp != NULL);
+	fputs("[", fp);
+	for (int i = 0; i < 1000; i++)
+		fprintf(fp, "%s{\"id\": %d, \"name\": \"record %d\"}", i ? ",\n" : "", i, i);
+	fputs("]", fp);
+	rewind(fp);
+	reader = json_reader_create_file(fp);
+	int token = json_reader_next(reader);
+	assert(token == JSON_TOKEN_BEGIN_ARRAY);
+	JSON* record;
+	int count = 0;
+	while ((record = json_reader_load(reader)))
+	{
+		char name[32];
+		snprintf(name, sizeof name, "record %d", count);
+		assert(json_get_member_number(record, "id") == count);
+		assert(strcmp(json_get_member_string(record, "name"), name) == 0);
+		json_destroy(record);
+		count++;
+	}
+	assert(count == 1000 && json_reader_token(reader) == JSON_TOKEN_END_ARRAY);
+	token = json_reader_next(reader);
+	assert(token == JSON_TOKEN_END);
+	json_reader_destroy(reader);
+	fclose(fp);
+	remove("records.json");
+	return 0;
+}
+
+int test_json_doc()
+{
+	size_t mem_count = mp_get_count();
+	json_doc_t* doc = json_doc_loadstring("{\"name\": \"Adam\", \"friends\": [{\"name\": \"Bert\"}], \"age\": 17}");
+	assert(doc != NULL);
+	// The document and the blocks of its arena
+	assert(mp_get_count() - mem_count == 2);
+	JSON* root = json_doc_root(doc);
+	assert(strcmp(json_get_member_string(root, "name"), "Adam") == 0);
+	assert(strcmp(json_get_member_string(json_get_elements(json_get_member(root, "friends")), "name"), "Bert") == 0);
+
+	// Changes are allocated from the arena
+	json_set_string(json_get_member(root, "name"), "Jacob");
+	JSON* lover = json_doc_create_empty(doc);
+	json_add_member(lover, "name", json_doc_create_empty(doc));
+	json_set_string(json_get_member(lover, "name"), "Eliza");
+	json_add_member(root, "lover", lover);
+	assert(mp_get_count() - mem_count == 2);
+	json_destroy(json_pop_member(root, "age"));
+	assert(strcmp(json_get_member_string(json_get_member(root, "lover"), "name"), "Eliza") == 0);
+
+	// Objects from the heap are destroyed with the document
+	json_add_element(json_get_member(root, "friends"), json_create_string("Ceasar"));
+	json_doc_destroy(doc);
+	assert(mp_get_count() == mem_count);
+
+	// In-situ documents borrow the strings of the source
+	char str[] = "{\"name\": \"Ad\\tam\", \"age\": 17}";
+	doc = json_doc_loadstring_insitu(str);
+	assert(doc != NULL);
+	char* name = json_get_member_string(json_doc_root(doc), "name");
+	assert(name > str && name < str + sizeof str && strcmp(name, "Ad\tam") == 0);
+	json_doc_destroy(doc);
+	char invalid[] = "{\"a\": x}";
+	doc = json_doc_loadstring_insitu(invalid);
+	assert(doc == NULL);
+	assert(mp_get_count() == mem_count);
+	return 0;
+}
+
+int test_json_index()
+{
+	// Lookups above JSON_INDEX_MIN members go through the hash index
+	JSON* object = json_create_object();
+	char name[32];
+	for (int i = 0; i < 1000; i++)
+	{
+		snprintf(name, sizeof name, "member%d", i);
+		json_add_member(object, name, json_create_number(i));
+	}
+	assert(json_get_count(object) == 1000);
+	assert(json_get_member_number(object, "member517") == 517);
+	assert(json_get_member(object, "member1000") == NULL);
+
+	// Duplicates are replaced in place
+	json_add_member(object, "member3", json_create_string("three"));
+	assert(json_get_count(object) == 1000);
+	assert(strcmp(json_get_member_string(object, "member3"), "three") == 0);
+	assert(strcmp(json_get_next(json_get_next(json_get_next(json_get_members(object))))->name, "member3") == 0);
+
+	json_destroy(json_pop_member(object, "member999"));
+	json_destroy(json_pop_member(object, "member0"));
+	assert(json_get_count(object) == 998);
+	assert(json_get_member(object, "member999") == NULL);
+	assert(json_get_member_number(object, "member998") == 998);
+	json_add_member(object, "member0", json_create_null());
+	assert(json_get_type(json_get_member(object, "member0")) == JSON_TNULL);
+	json_destroy(object);
+
+	// Elements are found by position in constant time
+	JSON* array = json_create_array();
+	for (int i = 0; i < 1000; i++)
+		json_add_element(array, json_create_number(i));
+	assert(json_get_number(json_get_element(array, 731)) == 731);
+	assert(json_get_element(array, 1000) == NULL);
+	json_insert_element(array, 10, json_create_string("ten"));
+	assert(strcmp(json_get_string(json_get_element(array, 10)), "ten") == 0);
+	assert(json_get_number(json_get_element(array, 11)) == 10);
+	JSON* element = json_pop_element(array, 500);
+	assert(json_get_number(element) == 499);
+	json_destroy(element);
+	element = json_pop_element(array, -1);
+	assert(json_get_number(element) == 999);
+	json_destroy(element);
+	assert(json_get_count(array) == 999);
+	assert(json_get_number(json_get_element(array, 998)) == 998);
+	json_destroy(array);
+	return 0;
+}
+
+struct json_sink
+{
+	char buf[256];
+	size_t length;
+	int calls;
+};
+
+static size_t json_sink_write(void* ctx, const char* buf, size_t size)
+{
+	struct json_sink* sink = ctx;
+	memcpy(sink->buf + sink->length, buf, size);
+	sink->length += size;
+	sink->calls++;
+	return size;
+}
+
+int test_json_writer()
+{
+	JSON* root = json_loadstring("{\"quote\": \"say \\\"hi\\\"\\n\\u0001\\\\\", \"list\": [1, {\"deep\": []}], \"e\": \"\\u00e9\"}");
+	assert(root != NULL);
+	assert(strcmp(json_get_member_string(root, "e"), "\xc3\xa9") == 0);
+
+	// Escaped straight into the buffer, control characters without a short escape as \u00XX
+	const char* expected = "{\"quote\":\"say \\\"hi\\\"\\n\\u0001\\\\\",\"list\":[1,{\"deep\":[]}],\"e\":\"\xc3\xa9\"}";
+	struct json_sink sink = {0};
+	json_writer_t* writer = json_writer_create(json_sink_write, &sink);
+	json_writer_write(writer, root, JSON_COMPACT);
+	json_writer_raw(writer, "\n", 1);
+	assert(sink.calls == 0);
+	int flushed = json_writer_destroy(writer);
+	assert(flushed == 0);
+	assert(sink.length == strlen(expected) + 1 && memcmp(sink.buf, expected, sink.length - 1) == 0);
+
+	char* str = json_tostring(root, JSON_FORMAT);
+	assert(strstr(str, "\n\t\t{\n\t\t\t\"deep\": []\n\t\t}\n") != NULL);
+	free(str);
+
+	// Written files read back the same
+	int written = json_writefile(root, "writer.json", JSON_FORMAT);
+	assert(written == 0);
+	JSON* back = json_loadfile("writer.json");
+	remove("writer.json");
+	assert(back != NULL);
+	assert(strcmp(json_get_member_string(back, "quote"), "say \"hi\"\n\x01\\") == 0);
+	assert(json_get_number(json_get_element(json_get_member(back, "list"), 0)) == 1);
+	json_destroy(back);
+	json_destroy(root);
+	return 0;
+}
+
+struct json_lines_sum
+{
+	pthread_mutex_t lock;
+	double ids;
+	size_t offsets;
+};
+
+static void json_lines_add(JSON* record, size_t offset, void* ctx)
+{
+	struct json_lines_sum* sum = ctx;
+	pthread_mutex_lock(&sum->lock);
+	sum->ids += json_get_member_number(record, "id");
+	sum->offsets += offset;
+	pthread_mutex_unlock(&sum->lock);
+	json_destroy(record);
+}
+
+int test_json_lines()
+{
+	// Blank and invalid lines are skipped
+	size_t mem_count = mp_get_count();
+	FILE* fp = fopen("lines.json", "w");
+	assert(fp != NULL);
+	long offsets = 0;
+	for (int i = 0; i < 5000; i++)
+	{
+		offsets += ftell(fp);
+		fprintf(fp, "{\"id\": %d, \"name\": \"%s\"}\n", i, names[i % lenof(names)]);
+		if (i % 1000 == 0)
+			fputs("\n\t\n{\"id\": 1,\n\"split\": 1}\n{\"a\": x}\n[1, x]\n", fp);
+	}
+	fclose(fp);
+
+	struct json_lines_sum sum = {PTHREAD_MUTEX_INITIALIZER, 0, 0};
+	long loaded = json_load_lines("lines.json", 4, json_lines_add, &sum);
+	remove("lines.json");
+	assert(loaded == 5000);
+	assert(sum.ids == 4999.0 * 5000 / 2);
+	assert(sum.offsets == (size_t)offsets);
+	assert(mp_get_count() == mem_count);
+	loaded = json_load_lines("missing.json", 4, json_lines_add, &sum);
+	assert(loaded == -1);
+	return 0;
+}
+
+int test_json_lazy()
+{
+	char str[] = "{\"user\": {\"name\": \"Adam\\u00e9\", \"id\": 7}, \"items\": [1, [2, 3], {\"a\": \"b\"}], \"total\": 42}";
+	char copy[sizeof str];
+	memcpy(copy, str, sizeof str);
+	JSON* root = json_loadstring_lazy(str);
+	assert(root != NULL);
+	assert(json_get_member_number(root, "total") == 42);
+	assert(strcmp(json_get_member_string(json_get_member(root, "user"), "name"), "Adam\xc3\xa9") == 0);
+
+	// Subtrees that were not visited are not built
+	JSON* items = json_get_member(root, "items");
+	assert(items->members == NULL && items->tape->size == 8);
+	assert(json_get_count(items) == 3);
+	assert(json_get_count(json_get_element(items, 1)) == 2);
+
+	// Writes the same as a fully loaded tree
+	JSON* full = json_loadstring(copy);
+	char* lazy_str = json_tostring(root, JSON_COMPACT);
+	char* full_str = json_tostring(full, JSON_COMPACT);
+	assert(strcmp(lazy_str, full_str) == 0);
+	free(lazy_str);
+	free(full_str);
+	json_destroy(full);
+
+	json_destroy(json_pop_member(root, "user"));
+	json_add_member(root, "user", json_create_null());
+	assert(json_get_type(json_get_member(root, "user")) == JSON_TNULL);
+	json_destroy(root);
+
+	char invalid[] = "{\"a\": [1, 2}";
+	JSON* failed = json_loadstring_lazy(invalid);
+	assert(failed == NULL);
+	return 0;
+}
+
+int test_list()
+{
+	// Small lists stay inline
+	size_t mem_count = mp_get_count();
+	list_t small = list_create(sizeof(uint32_t));
+	for (uint32_t i = 0; i < 8; i++)
+		list_push(&small, &i);
+	assert(small.data == NULL && mp_get_count() == mem_count);
+	assert(*(uint32_t*)list_get(&small, 7) == 7 && list_get(&small, 8) == NULL);
+	uint32_t more[] = {8, 9, 10};
+	list_push_n(&small, more, lenof(more));
+	assert(small.data != NULL && small.count == 11 && list_at(&small, uint32_t, 10) == 10);
+	list_destroy(&small);
+	assert(mp_get_count() == mem_count);
+
+	list_t list = list_create(sizeof(struct Person));
+	list_reserve(&list, 100);
+	assert(list.size == 100);
+	for (uint32_t i = 0; i < lenof(names); i++)
+	{
+		struct Person* p = list_push(&list, NULL);
+		snprintf(p->name, sizeof p->name, "%s", names[i]);
+		p->age = i;
+	}
+	for (uint32_t i = 0; i < 1000; i++)
+	{
+		struct Person copy = list_at(&list, struct Person, i % lenof(names));
+		list_push(&list, &copy);
+	}
+	assert(list.count == lenof(names) + 1000 && list.size == 1600);
+
+	// The last element takes the place of the removed one
+	uint32_t count = list.count;
+	struct Person last = list_at(&list, struct Person, count - 1);
+	list_swap_remove(&list, 0);
+	assert(list.count == count - 1 && strcmp(list_at(&list, struct Person, 0).name, last.name) == 0);
+	list_remove(&list, 0);
+	assert(list_at(&list, struct Person, 0).age == 1);
+	struct Person first = {"First", 0};
+	list_insert(&list, 0, &first);
+	assert(strcmp(list_at(&list, struct Person, 0).name, "First") == 0);
+	struct Person* popped = list_pop(&list);
+	assert(popped == &list_at(&list, struct Person, list.count) && strcmp(popped->name, last.name) != 0);
+
+	while (list.count > 1)
+		list_pop(&list);
+	list_shrink(&list);
+	list_clear(&list);
+	assert(list_pop(&list) == NULL);
+	list_destroy(&list);
+	return 0;
+}
+
+int test_mempool_variable()
+{
+	// Names are copied into an arena and dropped at once
+	mempool_arena_t arena = MEMPOOL_ARENA_INIT(64);
+	mempool_arena_mark_t mark = mempool_arena_mark(&arena);
+	char* copies[lenof(names)];
+	for (uint32_t i = 0; i < lenof(names); i++)
+	{
+		size_t len = strlen(names[i]) + 1;
+		copies[i] = mempool_arena_alloc(&arena, len, 1);
+		memcpy(copies[i], names[i], len);
+	}
+	struct Person* p = mempool_arena_alloc(&arena, sizeof(struct Person), _Alignof(struct Person));
+	assert((uintptr_t)p % _Alignof(struct Person) == 0);
+	for (uint32_t i = 0; i < lenof(names); i++)
+		assert(strcmp(copies[i], names[i]) == 0);
+	mempool_arena_reset(&arena, mark);
+	assert(arena.blocks == NULL);
+	mempool_arena_destroy(&arena);
+
+	// Size classes grow through realloc and fall back to malloc above 256 bytes
+	mempool_sized_t sized = MEMPOOL_SIZED_INIT(8);
+	char* str = mempool_sized_alloc(&sized, 10);
+	snprintf(str, 10, "%s", names[0]);
+	str = mempool_sized_realloc(&sized, str, 100);
+	assert(strcmp(str, names[0]) == 0 && sized.pools[3].alloc_count == 1);
+	str = mempool_sized_realloc(&sized, str, 1000);
+	assert(strcmp(str, names[0]) == 0 && sized.pools[3].alloc_count == 0);
+	mempool_sized_free(&sized, str);
+	mempool_sized_destroy(&sized);
+	return 0;
+}
+
+// Allocates people from a shared pool, they are freed by the main thread
+static void* alloc_people(void* pool)
+{
+	struct Person** people = malloc(lenof(names) * sizeof(*people));
+	for (uint32_t i = 0; i < lenof(names); i++)
+	{
+		people[i] = mempool_alloc(pool);
+		people[i]->age = i;
+	}
+	return people;
+}
+
+int test_mempool_shared()
+{
+	mempool_t pool = MEMPOOL_INIT(sizeof(struct Person), 4);
+	pool.flags = MEMPOOL_SHARED;
+
+	pthread_t threads[3];
+	for (uint32_t t = 0; t < lenof(threads); t++)
+		pthread_create(&threads[t], NULL, alloc_people, &pool);
+
+	for (uint32_t t = 0; t < lenof(threads); t++)
+	{
+		struct Person** people = NULL;
+		pthread_join(threads[t], (void**)&people);
+		for (uint32_t i = 0; i < lenof(names); i++)
+		{
+			assert(people[i]->age == (int)i);
+			mempool_free(&pool, people[i]);
+		}
+		free(people);
+	}
+
+	// The elements freed here are cached by this thread and reused
+	struct Person* p = mempool_alloc(&pool);
+	assert(p != NULL);
+	mempool_free(&pool, p);
+
+	mempool_destroy(&pool);
+	return 0;
+}
+
+// Allocates, grows and frees blocks, every block is checked before it is freed
+static void* churn_blocks(void* arg)
+{
+	char* blocks[64];
+	for (int round = 0; round < 100; round++)
+	{
+		for (uint32_t i = 0; i < lenof(blocks); i++)
+		{
+			blocks[i] = malloc(16 + i);
+			memset(blocks[i], 'a', 16 + i);
+		}
+		for (uint32_t i = 0; i < lenof(blocks); i += 2)
+		{
+			blocks[i] = realloc(blocks[i], 64 + i);
+		}
+		for (uint32_t i = 0; i < lenof(blocks); i++)
+		{
+			if (mp_validate(blocks[i]) != MP_VALIDATE_OK)
+				return arg;
+			free(blocks[i]);
+		}
+	}
+	return NULL;
+}
+
+int test_magpie_threads()
+{
+	size_t count = mp_get_count();
+	size_t total = mp_get_total_count();
+	pthread_t threads[4];
+	for (uint32_t i = 0; i < lenof(threads); i++)
+		pthread_create(&threads[i], NULL, churn_blocks, (void*)names);
+
+	int failed = 0;
+	for (uint32_t i = 0; i < lenof(threads); i++)
+	{
+		void* ret = NULL;
+		pthread_join(threads[i], &ret);
+		failed |= ret != NULL;
+	}
+	assert(mp_get_count() == count);
+	assert(mp_get_total_count() == total + lenof(threads) * 100 * 64);
+	return failed;
+}
+
+int test_magpie_snapshot()
+{
+	mp_snapshot_t before = mp_snapshot();
+	char* blocks[3];
+	uint32_t line = __LINE__ + 2;
+	for (uint32_t i = 0; i < lenof(blocks); i++)
+		blocks[i] = malloc(100);
+	mp_snapshot_t after = mp_snapshot();
+	mp_snapshot_t growth = mp_snapshot_diff(&before, &after);
+
+	// Only the new site grew
+	assert(growth.count == 1);
+	mp_site_t* site = &growth.sites[0];
+	assert(site->line == line && site->live_count == 3 && site->live_size == 300 && site->alloc_count == 3);
+
+	int exported = mp_export(&growth, "heap.folded", MP_EXPORT_COLLAPSED);
+	assert(exported == 0);
+	FILE* fp = fopen("heap.folded", "r");
+	assert(fp != NULL);
+	char buf[512] = {0};
+	char* read = fgets(buf, sizeof buf, fp);
+	assert(read != NULL);
+	fclose(fp);
+	remove("heap.folded");
+	char expected[64];
+	snprintf(expected, sizeof expected, "test.c:%u 300\n", line);
+	assert(strstr(buf, expected));
+
+	for (uint32_t i = 0; i < lenof(blocks); i++)
+	{
+		free(blocks[i]);
+	}
+	mp_snapshot_t freed = mp_snapshot();
+	mp_snapshot_t shrink = mp_snapshot_diff(&after, &freed);
+	assert(shrink.count == 1 && shrink.sites[0].live_size == -300 && shrink.sites[0].alloc_count == 0);
+
+	mp_snapshot_free(&before);
+	mp_snapshot_free(&after);
+	mp_snapshot_free(&growth);
+	mp_snapshot_free(&freed);
+	mp_snapshot_free(&shrink);
+	return 0;
+}
+
 int main()
 {
 	if (test_hashtable())
@@ -132,11 +1134,93 @@ int main()
 		printf("Hash table test failed\n");
 		return -1;
 	}
+	if (test_hashtable_typed())
+	{
+		printf("Typed hash table test failed\n");
+		return -1;
+	}
+	if (test_hashtable_concurrent())
+	{
+		printf("Concurrent hash table test failed\n");
+		return -1;
+	}
+	if (test_hashtable_resize())
+	{
+		printf("Hash table resize test failed\n");
+		return -1;
+	}
+#ifdef HASHTABLE_OPEN_ADDRESSING
+	if (test_hashtable_open_addressing())
+	{
+		printf("Open addressing hash table test failed\n");
+		return -1;
+	}
+#endif
+	if (test_magpie_threads())
+	{
+		printf("Magpie thread test failed\n");
+		return -1;
+	}
+	// The sites of a snapshot are estimated when sampling
+#ifndef MP_SAMPLE
+	if (test_magpie_snapshot())
+	{
+		printf("Magpie snapshot test failed\n");
+		return -1;
+	}
+#endif
 	test_mempool(2);
 	test_mempool(8);
 	test_mempool(32);
+	test_mempool_shared();
+	test_mempool_variable();
 
 	//test_json();
+	if (test_json_insitu())
+	{
+		printf("In-situ json test failed\n");
+		return -1;
+	}
+	if (test_json_numbers())
+	{
+		printf("Json number test failed\n");
+		return -1;
+	}
+	if (test_json_reader())
+	{
+		printf("Json reader test failed\n");
+		return -1;
+	}
+	if (test_json_doc())
+	{
+		printf("Json document test failed\n");
+		return -1;
+	}
+	if (test_json_index())
+	{
+		printf("Json index test failed\n");
+		return -1;
+	}
+	if (test_json_writer())
+	{
+		printf("Json writer test failed\n");
+		return -1;
+	}
+	if (test_json_lines())
+	{
+		printf("Json lines test failed\n");
+		return -1;
+	}
+	if (test_json_lazy())
+	{
+		printf("Lazy json test failed\n");
+		return -1;
+	}
+	if (test_list())
+	{
+		printf("List test failed\n");
+		return -1;
+	}
 	mp_print_locations();
 	mp_terminate();
 	if (mp_get_count() > 0)